@@ -9,15 +9,58 @@
 #include <math.h>
 #include <stdbool.h>
 #include <time.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/uio.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <poll.h>
+#include <sys/wait.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#ifdef ZLIB
+#include <zlib.h>
+#endif
 
 #define START_DATE 2700
 #define START_DAYS 26
-#define NUM_KL 26
+#define NUM_KL 26       // Defaults, see WorldConfig
 #define NUM_SB 3
 #define NUM_STARS 262
-#define QS_SIZE 8
+#define GALAXY_SIZE 8
+#define QS_SIZE 8       // Sectors per quadrant side
+#define MAX_QK 4        // Max klingons in one quadrant
+#define MAX_QB 2        // Max starbases in one quadrant
+#define QUADRANT_COPY 80 // Bytes a scan copied for the record before archiveQuadrant(): 3 int counts, a flag & the sector grid
 #define PLAYER_ENERGY 3000
+#define PLAYER_TORPEDOES 10
+#define REPAIR_DAYS 4.0 // Stardates to repair a device from -1
+#define RAID_MIN 4      // Stardates before klingons that moved in on a starbase destroy it, see galaxyTick()
+#define TICK_TASKS 4096 // Quadrants a galaxy needs before its tick is worth spreading over threads
+#define TICK_BENCH 200  // Ticks -B -T times
+#define SWEEP_AXES 4    // Parameters one -P sweep can vary
+#define SWEEP_BATCH 50  // Games every open cell of a sweep plays between checks of its win rate
+#define SWEEP_CI 0.02   // Cells stop once their win rate is known to +-2 points (95% Wilson interval)
+#define MAX_TRACK 72    // Sectors a move can enter: 8 quadrants & 8 sectors at warp 7.9
 #define STR_SIZE 50
+#define POOL_PREFETCH 2 // Worlds the pool keeps generated ahead of the game
+#define PROTOCOL_LINE 512 // Longest line protocol line, either way
+#define PROTOCOL_MOVES 1000 // Commands a line protocol game gets, as many as a simulated one
+#define MAX_BOTS 16     // -X bots one harness can play
+#define TACTICS_SHIP 25 // Ship energy & shield units the combat solver tells apart, see Tactics
+#define TACTICS_KLINGON 5 // & klingon energy units
+#define TACTICS_PLIES 6 // Commands ahead it looks at most
+#define TACTICS_BUDGET 20000 // Positions one piece of advice may visit, ~2 ms, see deepenCombat()
+#define TACTICS_MAX (1 << 20) // Positions its cache holds before it starts over
 
 
 // Structs & Enums
@@ -27,6 +70,7 @@ enum status_t {warp, srs, lrs, pha, tor, damageControl, she, libComp};
 typedef struct Entity {
     int energy;
     int pos[4];
+    unsigned short id;            // Unique within its quadrant & type, see getHandle()
 } Entity;
 typedef struct Entity Starbase;
 typedef struct Entity Klingon;
@@ -41,306 +85,5054 @@ typedef struct Player {
     Condition condition;
 } Player;
 
+// A quadrant's sectors & entities, only built once the quadrant is touched (see touchQuadrant)
+typedef struct SectorMap {
+    bool mutated;                 // Changed since it was generated, so it can't be evicted
+    char sector[QS_SIZE][QS_SIZE];
+    Klingon klingons[MAX_QK];     // Live entities are packed at the front, the quadrant's counts say how many
+    Starbase starbases[MAX_QB];
+    Star stars[];                 // numStars stars
+} SectorMap;
+
 typedef struct Quadrant {
+    unsigned char numKlingons;
+    unsigned char numStarbases;
+    unsigned char numStars;
+    SectorMap *map;               // NULL until touched
+} Quadrant;
+
+// Refers to an entity across removals, which move other entities around in their array
+typedef struct Handle {
+    int q1;
+    int q2;
+    char type;                    // 'k', 'b', or 's'
+    unsigned short id;
+} Handle;
+
+// Galaxy dimensions & entity counts, chosen when the world is created
+typedef struct WorldConfig {
+    int rows;
+    int cols;
     int numKlingons;
     int numStarbases;
     int numStars;
+    int days;                     // Stardates to complete the mission in
+    unsigned long long seed;      // 0 picks a new one for every world
+    int threads;                  // Threads worldInit may use, the result is the same for any count
+    bool tick;                    // Klingons act galaxy-wide every stardate, see galaxyTick()
+    int energy;                   // The Enterprise's energy at the start & after resupplies
+    int fire;                     // Klingon hits, in percent of the usual
+    int phasers;                  // Phaser hits, in percent of the usual
+} WorldConfig;
+
+// Command line options
+typedef struct Options {
+    WorldConfig config;
+    bool benchGen;                // Time world generation on 1 vs config.threads threads, then exit
+    int simGames;                 // Games for the autopilot to play before exiting, 0 to play yourself
+    const char *traceFile;        // Chrome trace-event output, NULL for none
+    const char *feedName;         // Shared memory to publish the game to, NULL for none
+    const char *watchName;        // Shared memory of a game to watch instead of playing
+    bool ansi;                    // Full-screen ANSI mode, see Screen
+    bool compress;                // Deflate the session's output, see outputDictionary
+    bool inflate;                 // Decompress a -z stream from stdin instead of playing
+    const char *journalFile;      // Write-ahead journal, NULL for none
+    bool journalAsync;            // Don't wait for journal records to be durable
+    const char *recoverFile;      // Journal to rebuild sessions from
+    int ships;                    // Autopilot ships to play one shared galaxy with, 0 for none
+    int idleSecs;                 // Seconds at the COMMAND prompt before the game hibernates, 0 never
+    const char *sweep;            // Parameter grid for the autopilot to play, see sweepParameters(), NULL for none
+    const char *datasetFile;      // Trajectory dataset of the -S games to write, NULL for none
+    const char *readFile;         // Trajectory dataset to read & summarize instead of playing
+    const char *templateFile;     // Galaxy template every game plays, see Template, NULL for none
+    bool protocol;                // Play over the line protocol on stdin & stdout, see protocolCommand()
+    const char *bots[MAX_BOTS];   // Bot commands for the harness to play against each other, see playBots()
+    int numBots;
+    int moveMillis;               // How long a bot may think over one move
+} Options;
+
+// A stream of the counter-based generator, see rngInit()
+typedef struct Rng {
+    uint32_t key[2];
+    uint32_t ctr[4];              // Block number, then stream id
+    uint32_t out[4];
+    int left;
+} Rng;
+
+#define RNG_QUOTAS   (1ULL << 60) // Stream ids
+#define RNG_ROW      (2ULL << 60)
+#define RNG_QUADRANT (3ULL << 60)
+#define RNG_DICE     (4ULL << 60)
+#define RNG_TICK     (6ULL << 60) // With the tick's stardate << 32 & the quadrant
+#define RNG_ARRIVAL  (7ULL << 60)
+
+// Instrumentation, only built with -DSTATS. Without it the STAT_ macros are empty.
+// Latencies go in log-linear histograms (HIST_SUB buckets per power of two, so about 6%
+// resolution up to 2^64 ns) & everything is atomic, as the prefetch thread draws numbers too
+#ifdef STATS
+#define HIST_SUB 16
+#define HIST_BUCKETS (HIST_SUB + 60 * HIST_SUB)
+
+enum statOp_t {statNAV, statSRS, statLRS, statPHA, statTOR, statSHE, statDAM, statCOM, statXXX, statINS,
+               statPRE, statSTATS, statOther, statNavigate, statPhasers, statTorpedo, statShields, statAutopilot,
+               statOutput, statWrite, numStatOps};
+
+typedef struct Histogram {
+    atomic_ullong count;
+    atomic_ullong sum;
+    atomic_ullong max;
+    atomic_ullong bucket[HIST_BUCKETS];
+} Histogram;
+
+typedef struct Stats {
+    Histogram op[numStatOps];   // Command dispatches (including reading their input) & game actions
+    atomic_ullong nearbyLookups;
+    atomic_ullong sortCompares;
+    atomic_ullong rngDraws;
+    atomic_ullong collisionChecks;
+    atomic_ullong outputBytes;    // Game output sent, escape sequences included
+    atomic_ullong sentBytes;      // What that came to after compression
+} Stats;
+
+Stats stats;
+
+long long statNow();              // Declared early for the small functions' macros
+void statRecord(int op, long long ns);
+
+#define STAT_COUNT(counter) atomic_fetch_add_explicit(&stats.counter, 1, memory_order_relaxed)
+#define STAT_ADD(counter, n) atomic_fetch_add_explicit(&stats.counter, n, memory_order_relaxed)
+#define STAT_BEGIN(t) long long t = statNow()
+#define STAT_END(t, op) statRecord(op, statNow() - (t))
+#else
+#define STAT_COUNT(counter) ((void) 0) // Still a statement, so an if can guard one
+#define STAT_ADD(counter, n) ((void) 0)
+#define STAT_BEGIN(t)
+#define STAT_END(t, op) ((void) 0)
+#endif
+
+// Chrome trace-event output, on with -t FILE. Every thread fills trace chunks of its own without
+// locking, and full chunks go on a lock-free stack that the flush thread writes out
+#define TRACE_CHUNK 1024
+#define TRACE_WORKER_TID 1000     // Tracks of runTasks' workers, reused by every call
+
+typedef struct TraceEvent {
+    const char *name;
+    long long start;              // ns since the trace was opened
+    long long dur;                // -1 names the thread's track
+} TraceEvent;
+
+typedef struct TraceChunk {
+    struct TraceChunk *next;
+    int tid;
+    int used;
+    TraceEvent events[TRACE_CHUNK];
+} TraceChunk;
+
+typedef struct Tracer {
+    FILE *out;                    // NULL while not tracing
+    long long origin;
+    long long written;
+    _Atomic(TraceChunk *) full;   // Chunks waiting to be written
+    atomic_int numThreads;
+    atomic_int namedWorkers;      // Worker tracks named so far
+    atomic_bool closing;
+    pthread_t flusher;
+} Tracer;
+
+Tracer tracer;
+_Thread_local TraceChunk *traceChunk; // The chunk this thread is filling
+_Thread_local int traceTid;
+
+// Game output of one session goes through a single-producer single-consumer ring. The game thread
+// formats into it without locking & the session's writer thread drains it with writev, so the game
+// never waits on the terminal. The writer is only woken at prompts, when the ring gets half full
+// & when the session closes; the mutex is just for sleeping & waking
+#define OUT_RING (1 << 16)
+
+typedef struct Output {
+    char ring[OUT_RING];
+    _Atomic size_t head;          // Bytes put in, only the game thread moves it
+    _Atomic size_t tail;          // Bytes written out, only the writer moves it
+    int fd;
+    bool wanted;                  // Under lock: the game thread wants the ring written out
+    bool closing;                 // Under lock
+    pthread_mutex_t lock;
+    pthread_cond_t wake;          // For the writer
+    pthread_cond_t drained;       // For the game thread, when tail moves
+    pthread_t writer;
+#ifdef ZLIB
+    z_stream *z;                  // NULL unless compressing
+    unsigned char *zbuf;          // OUT_ZBUF bytes of compressed output
+#endif
+} Output;
+
+#ifdef ZLIB
+// Compression of a session's output, on with -z & undone by -Z. The raw deflate window &
+// hash table are kept small so a session never holds more than about 40KB for it, & a preset
+// dictionary of the game's fixed text gets the first screens compressed as well as the later
+// ones. Each batch the writer sends ends in a sync flush, so the client can show every prompt
+#define OUT_ZWINDOW 12            // 4KB window
+#define OUT_ZMEM 5                // 16KB hash table
+#define OUT_ZBUF 4096
+
+// Least to most common, as deflate reaches the end of the dictionary cheapest
+const char outputDictionary[] =
+    "NUMBER OF UNITS TO FIRE? PHASERS LOCKED ON TARGET;  ENERGY AVAILABLE = "
+    "PHOTON TORPEDO COURSE (1-9) TORPEDO TRACK:\n*** KLINGON DESTROYED ***\nTORPEDO MISSED\n"
+    "     NUMBER OF UNITS TO SHIELDS? DEFLECTOR CONTROL ROOM REPORT:\n  'SHIELDS NOW AT  UNITS PER YOUR COMMAND.'\n"
+    "DEVICE                    STATE OF REPAIR\nWARP ENGINES              SHORT RANGE SENSORS       "
+    "LONG RANGE SENSORS        PHASER CONTROL            PHOTON TUBES              DAMAGE CONTROL            "
+    "SHIELD CONTROL            LIBRARY-COMPUTER          "
+    "        COMPUTER RECORD OF GALAXY FOR QUADRANT \n       1     2     3     4     5     6     7     8\n"
+    "     ----- ----- ----- ----- ----- ----- ----- -----\n1     ***   ***   ***   ***   ***   ***   ***   ***\n"
+    "COMPUTER ACTIVE AND AWAITING COMMAND: LONG RANGE SCAN FOR QUADRANT "
+    "    -------------------\n :  ***  :  ***  :  ***  :  \n    -------------------\n :  "
+    " UNIT HIT ON KLINGON AT SECTOR     (SENSORS SHOW  UNITS REMAINING)\n"
+    " UNIT HIT ON ENTERPRISE FROM SECTOR       <SHIELDS DOWN TO  UNITS>\n"
+    "WARP FACTOR (0-8.0) COURSE (1-9) COMBAT AREA      CONDITION RED\n   SHIELDS DANGEROUSLY LOW\n"
+    "------------------------------------\n   *                              "
+    "       STARDATE:            2700\n       CONDITION:           GREEN\n"
+    "       QUADRANT:            \n       SECTOR:              \n       PHOTON TORPEDOES:    10\n"
+    "       TOTAL ENERGY:        3000\n       SHIELDS:             0\n       KLINGONS REMAINING:  26 [0]\n"
+    "------------------------------------\nCOMMAND: ";
+#endif
+
+_Thread_local Output *output;     // The calling thread's session, NULL drops its output
+
+// Full-screen ANSI mode, on with -a. The short range scan & the galactic record get fixed panels
+// at the top of the terminal, & everything else scrolls below them. Panel output is captured
+// into a frame instead of being sent, then only the cells that differ from what the terminal
+// already shows go out, as cursor-addressed runs
+#define SCREEN_COLS 80
+#define SCREEN_ROWS 30            // Panel rows, the separator & scrolling messages go below
+#define SCREEN_SRS 0              // First row of each panel
+#define SCREEN_RECORD 10
+#define SCREEN_GAP 6              // Unchanged cells worth resending to save a cursor move
+
+typedef struct Screen {
+    char shown[SCREEN_ROWS][SCREEN_COLS]; // What the terminal shows
+    char frame[SCREEN_ROWS][SCREEN_COLS]; // Being drawn
+    int height;                   // Terminal rows
+    int row;                      // Capture position, -1 while not capturing
+    int col;
+    int top;                      // Rows of the capturing panel
+    int end;
+} Screen;
+
+_Thread_local Screen *screen;     // NULL for plain output
+
+// Spectator feed, on with -f NAME: after every command the game publishes its state to
+// /dev/shm/NAME, for any number of viewers (-w NAME) to read at their own pace. It's a seqlock:
+// the game makes seq odd, writes & makes seq even again, and a reader retries any copy that saw
+// seq odd or changed. The game never waits on readers & publishing makes no syscalls
+#define FEED_MAGIC 0x46535354     // "TSSF"
+#define FEED_EVENTS 8
+#define FEED_EVENT_LEN 64
+
+// What a reader copies out of the feed, besides the quadrant counts
+typedef struct FeedState {
+    unsigned long long seed;
+    int date;
+    int daysRem;
+    int numKlingons;
+    int numStarbases;
+    int pos[4];
+    int energy;
+    int shield;
+    int photon;
+    Condition condition;
+    bool gameOver;
+    bool closed;                  // The game has exited
+    char sector[QS_SIZE][QS_SIZE]; // The player's quadrant
+    unsigned numEvents;           // Events ever published, the last FEED_EVENTS are in event
+    char event[FEED_EVENTS][FEED_EVENT_LEN];
+} FeedState;
+
+typedef struct Feed {
+    uint32_t magic;               // Set once the rest is ready
+    uint32_t size;                // Bytes in the mapping
+    int rows;
+    int cols;
+    _Atomic uint64_t seq;         // Odd while the game is writing
+    FeedState state;
+    uint16_t quads[];             // rows*cols of K<<12 | B<<8 | stars, like the archive
+} Feed;
+
+_Thread_local Feed *feed;         // The calling thread's feed, NULL if it isn't publishing
+_Thread_local unsigned long long feedSeed; // World & quadrant generation last published
+_Thread_local unsigned feedQuadGen;
+char feedPath[STR_SIZE + 2];      // "/NAME", for unlinking on exit
+
+// Write-ahead journal, on with -J FILE. Every session appends its galaxy seed & then each command
+// with its arguments before the command is applied, & a snapshot of the world every
+// JOURNAL_SNAP_EVERY commands, so -R FILE can rebuild any session from its last snapshot. Records
+// from all sessions share one file & a committer thread writes & fsyncs them in groups: it waits
+// up to JOURNAL_WINDOW for more records unless JOURNAL_BATCH bytes are pending or every session
+// is already waiting on it. Sessions wait for their records to be durable unless -U is given
+#define JOURNAL_WINDOW 2000000    // ns
+#define JOURNAL_BATCH (1 << 16)
+#define JOURNAL_SNAP_EVERY 64
+
+enum journalType_t {journalSeed_, journalNAV, journalPHA, journalTOR, journalSHE, journalSRS, journalLRS,
+                    journalSnap, journalEnd_};
+
+typedef struct JournalRecord {
+    uint32_t size;                // Whole record, header included, a multiple of 8
+    uint32_t check;               // FNV-1a of the rest of the record
+    uint32_t session;
+    uint32_t type;
+} JournalRecord;
+
+// Payload of command records
+typedef struct JournalArgs {
+    double a;
+    double b;
+} JournalArgs;
+
+// Payload of snapshots, followed by the quadrant counts (packed), the archive, the scanned bits,
+// then numMaps mutated sector maps, each after its quadrant index & size, then the event heap
+typedef struct JournalSnapshot {
+    int date;
+    int daysRem;
+    int numKlingons;
+    int numStarbases;
+    Player player;
+    Rng dice;
+    double clock;
+    double repairDue[8];
+    int raided;
+    uint32_t numQuads;
+    uint32_t numMaps;
+    uint32_t numEvents;
+} JournalSnapshot;
+
+typedef struct Journal {
+    int fd;
+    bool sync;                    // Sessions wait for their records to be on disk
+    char *buf;                    // Records appended since the last commit
+    char *spare;                  // The committer writes from here
+    size_t used;
+    size_t cap;
+    size_t spareCap;
+    unsigned long long appended;  // Bytes appended & bytes durable
+    unsigned long long committed;
+    long long first;              // When the oldest pending record was appended
+    int active;                   // Sessions with a game going
+    int waiting;                  // Sessions waiting on a commit
+    uint32_t nextSession;
+    unsigned long long records;
+    unsigned long long commits;
+    bool closing;
+    int error;                    // errno of the write or sync that failed the journal, 0 while it's sound
+    pthread_mutex_t lock;
+    pthread_cond_t work;          // For the committer
+    pthread_cond_t durable;       // For sessions waiting on a commit
+    pthread_t committer;
+} Journal;
+
+Journal *journal;                 // NULL if not journaling
+_Thread_local uint32_t journalSession; // The calling thread's session, 0 before its first game
+_Thread_local int journalCommands;     // Commands since its last snapshot
+
+int hibernateSecs;                // Idle seconds before the game is hibernated, 0 never, see awaitCommand()
+
+// Where each game of a journal starts, was last snapshotted & ends (0 if it didn't)
+typedef struct JournalGame {
+    uint32_t session;
+    size_t seed;
+    size_t snap;
+    size_t end;
+} JournalGame;
+
+// What recoverJournal found, for main to resume
+typedef struct Recovery {
+    const char *data;             // The journal, mapped
+    size_t size;
+    size_t valid;                 // Bytes of whole records, anything after is torn & dropped
+    uint32_t maxSession;
+    uint32_t session;             // Unfinished session to resume, 0 if none
+    unsigned long long seed;      // Its galaxy
+    size_t from;                  // Its last snapshot, or its seed record if it has none
+} Recovery;
+
+// Trajectory dataset, on with -D FILE: every autopilot step of the -S games as a row of
+// observation, action, reward & whether the game is done. Simulator threads fill columns of
+// their own & append them as chunks: a TrajChunk, then each column's values back to back,
+// padded to 8 bytes, deflated as a whole with -DZLIB. Raw chunks are read straight out of an
+// mmap, see readDataset(). Values are in the host's byte order
+#define TRAJ_MAGIC 0x324a5254u    // "TRJ2", the columns wide enough for any galaxy -g allows
+#define TRAJ_ROWS 4096            // Rows per chunk
+#define ALIGN8(n) (((n) + 7) & ~(size_t) 7)
+
+// seed u64, step u32, energy & shield i32, photon u8, pos u16[4], condition u8, damage f32[8],
+// counts u16[9] of the 3x3 quadrants around the ship (as packCounts(), 0xffff off the galaxy),
+// klingons u32 left, clock f32, command u8 (a journalType_t, 0 for none), args f32[2], reward f32
+// (klingons destroyed by the step), done u8 (0 playing, 1 won, 2 lost, 3 out of time, 4 cut off)
+enum trajColumn_t {trajSeed, trajStep, trajEnergy, trajShield, trajPhoton, trajPos, trajCondition, trajDamage,
+                   trajCounts, trajKlingons, trajClock, trajCommand, trajArgs, trajReward, trajDone, numTrajColumns};
+const int trajWidth[numTrajColumns] = {8, 4, 4, 4, 1, 8, 1, 32, 18, 4, 4, 1, 8, 4, 1};
+
+typedef struct TrajChunk {
+    uint32_t magic;
+    uint32_t rows;
+    uint32_t stored;              // Bytes after the header, a multiple of 8
+    uint32_t raw;                 // Bytes of the columns, padding included
+    uint32_t deflated;            // 1 if the stored bytes are the columns deflated
+    uint32_t reserved[3];
+} TrajChunk;
+
+typedef struct Dataset {
+    int fd;
+    atomic_llong end;             // Where the next chunk goes, threads reserve their room from here
+    atomic_llong rows;
+    atomic_llong chunks;
+    atomic_llong rawBytes;
+    atomic_llong writeNanos;      // Spent packing & writing chunks, across threads
+    atomic_int error;             // errno of the first chunk that didn't make it, none are written after it
+} Dataset;
+
+Dataset *dataset;                 // NULL if not writing one
+
+// A simulator thread's rows not written yet. The last one stays until the next step begins,
+// so a game cut off by its turn limit can still be marked done
+typedef struct Trajectory {
+    int rows;
+    int step;                     // Of the game being played
+    unsigned char *columns[numTrajColumns];
+    unsigned char *packed;        // Staging for deflate
+    unsigned char *out;
+    size_t outCap;
+} Trajectory;
+
+_Thread_local Trajectory *trajectory; // The calling thread's, NULL if it isn't recording
+
+#define TRACE_BEGIN(t) long long t = tracer.out ? traceNow() : 0
+#define TRACE_END(t, name) do { if (tracer.out) traceEvent(name, t, traceNow() - (t)); } while (0)
+// Times call for both the stats & the trace
+#define SPAN(op, name, call) do { STAT_BEGIN(s_); TRACE_BEGIN(t_); call; TRACE_END(t_, name); STAT_END(s_, op); } while (0)
+
+// Generation counters, bumped whenever the state they cover changes. Derived state keeps
+// the generations it was built from & is only rebuilt once they've moved on
+typedef struct Generations {
+    unsigned quadrants;           // Entity counts & sector contents of any quadrant
+    unsigned position;            // The ship's quadrant & sector
+    unsigned stats;               // The ship's energy, shields & torpedoes
+    unsigned damage;              // Device damage
+} Generations;
+
+// Work done by entity lookups & the scan archive, reported by the simulator
+typedef struct Counters {
+    unsigned long long entityScans;
+    unsigned long long slotsScanned;
+    unsigned long long slotsSaved; // Slots a fixed size array with destroyed entries left in would have scanned on top
+    unsigned long long archiveScans;
+    unsigned long long archiveBytes; // Bytes archiveQuadrant() wrote, against QUADRANT_COPY per scan for a copy
+    unsigned long long condSkipped;  // Work left out because its generations hadn't changed
+    unsigned long long boardSkipped;
+    unsigned long long archiveSkipped;
+    unsigned long long events;       // Events advanceClock() ran
+} Counters;
+
+// Something due at a fractional stardate, see advanceClock()
+typedef struct Event {
+    double at;                    // Stardates since the start
+    int type;
+    int arg;                      // Device repaired, or quadrant raided
+} Event;
+
+enum eventType_t {eventRepair, eventResupply, eventRaid, eventTick};
+
+// Where a move or a torpedo goes, worked out without changing the game, see navTrack()
+typedef struct Track {
+    int length;
+    int path[MAX_TRACK][4];       // Q1, Q2, S1, S2 of every sector entered
+    int pos[4];                   // Where it ends
+    char stop;                    // ' ' ran its course, '|' galactic perimeter, '>' torpedo left the
+                                  // quadrant, else what's in the sector that stopped it
+    int at[4];                    // That sector
+    Entity *hit;                  // What the torpedo hits
+} Track;
+
+// What a NAV or TOR would do, for PREVIEW & bots, see previewNav() & previewTor()
+typedef struct Preview {
+    const char *refused;          // Why the command would be turned down, NULL if it wouldn't
+    Track track;
+    int energy;                   // Cost
+    int torpedoes;
+    double days;
+    double fire;                  // Klingon fire the shields can expect, from previewFire()
+    double maxFire;               // & the most it can be
+    bool docks;                   // Arrives in a starbase's quadrant & gets resupplied
+} Preview;
+
+// A position of the combat solver's model: the ship's energy, shields & torpedoes and each
+// klingon's energy (-1 once it's destroyed), rounded to TACTICS_SHIP & TACTICS_KLINGON units
+typedef struct Combat {
+    int energy;
+    int shield;
+    int torpedoes;
+    int klingon[MAX_QK];          // By the klingon's place in Tactics' roster
+    bool shieldsSet;              // The last command set the shields, so the next one fires
+    int plies;                    // Commands left to look ahead
+    int devices;                  // Bits for working phasers, photon tubes & shield control
+} Combat;
+
+// A solved position: its value with best play & the command that gets it
+typedef struct TacticsEntry {
+    uint64_t key;                 // See combatKey(), 0 for an empty slot
+    float value;
+    char action;                  // 'P'hasers, 'T'orpedo, 'S'hields, 0 if nothing helps
+    int arg;                      // Units, or the roster klingon the torpedo's aimed at
+} TacticsEntry;
+
+// The library-computer's tactical advice: an exact solver of the fight in the ship's quadrant
+// as a stochastic game, with phaser & klingon hits at the low & high half of their dice and
+// a value of the chance of destroying every klingon before they destroy the ship (plus a
+// sliver for the energy left). Its transposition table is kept for as long as the ship &
+// the klingons it counted stay put, so later turns of the fight start from what's solved. Each
+// klingon hit has the same chance of damaging each device as an even spread over the 8 would
+typedef struct Tactics {
+    bool valid;
+    int pos[4];                   // The ship's when the roster was taken
+    int numKlingons;              // The roster: the quadrant's klingons at the time
+    int kPos[MAX_QK][2];
+    double kDist[MAX_QK];
+    double kCourse[MAX_QK];       // Torpedo course at each
+    int kPath[MAX_QK][MAX_QK];    // The klingons that course runs into, in order, before anything else stops it
+    int kPathLen[MAX_QK];
+    bool protected;               // A starbase shields the ship from klingon fire
+    int fire;                     // The world's config.fire & config.phasers
+    int phasers;
+    TacticsEntry *table;          // Open addressing on the key
+    int cap;                      // A power of 2
+    int count;
+    long long solved;             // Positions solved since the roster was taken
+    long long visited;            // Positions solved or looked up, the solver's work
+    long long budget;             // What visited may reach before the search under way is dropped
+    bool out;                     // It has been, so nothing more it finds is stored
+    uint64_t shielded;            // Key of where the last shield advice leads, as it can't be followed by another
+} Tactics;
+
+// Galaxy template, on with -G FILE: a galaxy generated once & written out whole (the quadrant
+// counts, the starbase field, every sector map & the events scheduled at the start), then
+// mapped read only by every game that plays it, in this process or any other, so they all
+// share its pages. A game's world only keeps an overlay of the quadrants it changed or scanned.
+// Offsets are from the start of the file, values in the host's byte order
+#define TEMPLATE_MAGIC 0x4c504d54u // "TMPL"
+
+typedef struct Template {
+    uint32_t magic;
+    uint32_t numEvents;
+    uint64_t size;                // Bytes in the file
+    WorldConfig config;           // The galaxy's, seed included
+    int start[2];
+    uint64_t quadrants;           // rows*cols Quadrants, without maps
+    uint64_t field;               // sbDist of every quadrant, then sbNearest
+    uint64_t maps;                // rows*cols offsets of the quadrants' SectorMaps, each 8 byte aligned
+    uint64_t events;              // numEvents Events, a heap as World.events
+} Template;
+
+// A template world's copy of one of the template's quadrants, made the first time the world
+// changes, touches or scans it, see overlayQuadrant()
+typedef struct Overlay {
+    int q;
+    Quadrant quad;                // Starts out as the template's
+    uint16_t archive;             // What World.archive & World.scanned are for other worlds
     bool scanned;
-    char sector[QS_SIZE][QS_SIZE];
-} Quadrant;
+} Overlay;
+
+typedef struct World {
+    WorldConfig config;
+    unsigned long long seed;
+    int start[2];              // Starting quadrant
+    int date;
+    int daysRem;
+    int numKlingons;
+    int numStarbases;
+    Quadrant *quadrant;        // rows*cols quadrants, use getQuadrant(). NULL in template worlds
+    int *maps;                 // Quadrants with a generated sector map
+    int numMaps;
+    int capMaps;
+    uint16_t *archive;         // Per quadrant: counts as of its last scan, see archiveQuadrant()
+    uint64_t *scanned;         // Bit per quadrant: scanned at least once
+    int *sbDist;               // Per quadrant: quadrants to the nearest starbase (-1 if none left)
+    int *sbNearest;            // Per quadrant: index of the nearest quadrant with a starbase
+    const Template *tmpl;      // Template the world plays, NULL if it has quadrants of its own
+    Overlay **overlay;         // Template worlds: hash table of their overlays on the quadrant index
+    int numOverlay;
+    int capOverlay;            // A power of 2
+    Counters counters;
+    Generations gen;
+    Generations condGen;       // gen when the condition was last updated
+    Generations boardGen;      // gen when srsBoard was last drawn
+    Generations archiveGen;    // gen when the player's quadrant was last archived
+    double clock;              // Stardates since the start, date & daysRem follow its whole part
+    Event *events;             // Min-heap on at
+    int numEvents;
+    int capEvents;
+    double repairDue[8];       // Per device: when its repair is due. Repair events due at other times are stale
+    int raided;                // Starbases destroyed by klingons
+    char srsBoard[QS_SIZE][3 + QS_SIZE*4 + 1]; // Sector rows of the short range scan
+    size_t capQuads;           // Quadrants the buffers above have room for
+    struct WorldPool *pool;    // Pool the world was taken from, NULL if none
+    struct Galaxy *galaxy;     // Galaxy this world is a ship's view of, NULL if the world is its own
+    Tactics *tactics;          // Combat solver's cache, see tacticalAdvice(), NULL until asked
+    Player player;
+    bool gameOver;
+} World;
+
+const char *const deviceNames[8] = {"WARP ENGINES", "SHORT RANGE SENSORS", "LONG RANGE SENSORS", "PHASER CONTROL",
+                                    "PHOTON TUBES", "DAMAGE CONTROL", "SHIELD CONTROL", "LIBRARY-COMPUTER"};
+const Template *galaxyTemplate;   // Template worldInit() sets worlds up from, NULL to generate them
+
+// Recycles worlds between games. The worlds & their buffers live in one cache aligned,
+// huge page backed mapping, and a prefetch thread generates the next games ahead of time
+typedef struct WorldPool {
+    WorldConfig config;
+    unsigned long long nextSeed;  // Worlds get consecutive seeds, starting from config.seed if set
+    char *slots;                  // numSlots worlds with their buffers, stride bytes apart
+    size_t stride;
+    size_t mapped;
+    int numSlots;
+    World **recycled;             // Worlds waiting to be regenerated
+    int numRecycled;
+    World **ready;                // Ring of generated worlds, handed out in seed order
+    int readyHead;
+    int numReady;
+    int prefetch;                 // Worlds to keep ready
+    bool generating;              // The prefetcher has a world out of the lists
+    bool asleep;                  // The player hibernated, so nothing gets generated, see poolSleep()
+    pthread_t prefetcher;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;          // For the prefetcher: a world was recycled, or the pool is closing
+    pthread_cond_t generated;     // For takers: a world is ready
+    bool closing;
+} WorldPool;
+
+// Shared by the simulator's threads
+typedef struct Simulation {
+    WorldPool pool;
+    int games;
+    atomic_int next;              // Games handed out so far
+    pthread_mutex_t lock;         // Guards the totals below
+    int won;
+    int lost;
+    int outOfTime;
+    long long commands;
+    Counters counters;
+    long long worldBytes;         // Held by the games' worlds as they ended, see worldBytes()
+    size_t maxWorldBytes;
+} Simulation;
+
+// One combination of a sweep's parameter values
+typedef struct SweepCell {
+    WorldConfig config;
+    int games;                    // Played so far, the same for every cell still open
+    bool open;                    // Still playing: its win rate isn't known precisely enough yet
+    atomic_int won;
+    atomic_int lost;
+    atomic_int outOfTime;
+    atomic_llong commands;
+} SweepCell;
+
+// Shared by the tasks of a sweep's batch
+typedef struct Sweep {
+    SweepCell *cells;
+    int numCells;
+    int *batch;                   // Open cells, each playing batchGames games from game cells->games
+    int numBatch;
+    int batchGames;
+    unsigned long long seed;      // Game g of every cell gets seed + g, so cells differ only in parameters
+} Sweep;
+
+// Shared by the shards of galaxyTick()
+typedef struct Tick {
+    World *world;
+    long long stardate;           // Keys the tick's random numbers
+    int *moves;                   // Per quadrant: where one of its klingons goes, -1 to stay
+} Tick;
+
+// One galaxy shared by the -M ships. Each ship plays through a World of its own (its player,
+// galactic record, caches & events) whose quadrants, sector maps & starbase field are this
+// world's. A command locks the quadrants it can touch, see shipTurn()
+typedef struct Galaxy {
+    World world;
+    pthread_mutex_t *locks;       // Per quadrant
+    atomic_int *holders;          // Per quadrant, the ship thread holding its lock (1 up), 0 if none
+    pthread_mutex_t mapsLock;     // Guards world.maps, which touchQuadrant appends to
+    pthread_mutex_t fieldLock;    // Guards the starbase field
+    atomic_int numKlingons;
+    atomic_int *klingons;         // Per quadrant, its numKlingons for ships that don't hold its lock
+    World *ships;
+    int numShips;
+    int threads;
+    atomic_int nextThread;        // Threads started so far, each plays every threads'th ship
+    atomic_llong locked;          // Quadrant locks taken & how many of them had to wait
+    atomic_llong contended;
+    atomic_llong unlocked;        // Sector maps a ship touched without holding their quadrant's lock
+    pthread_mutex_t lock;         // Guards the totals below
+    long long commands;
+    int won;
+    int lost;
+    int outOfTime;
+    Counters counters;
+} Galaxy;
+
+_Thread_local int shipThread;     // The calling thread's number in its galaxy (1 up), 0 if it isn't playing one
+
+// An external bot the -X harness plays over the line protocol: a process of its own, its
+// stdin & stdout piped to the harness, & the world of the game it's playing
+typedef struct Bot {
+    const char *command;
+    pid_t pid;
+    int in;                       // The bot's stdin, -1 once it's done
+    int out;                      // The bot's stdout
+    char line[PROTOCOL_LINE];     // Read from out, up to the end of the next command
+    int length;
+    World world;
+    Rng dice;                     // The game's dice, swapped in for the bot's commands
+    int game;                     // Games started
+    int moves;                    // In this game
+    long long sent;               // When the last observation went out, ns
+    long long deadline;           // When the bot's command has to be in by
+    bool done;
+    const char *forfeit;          // Why it gave up the games it had left, NULL if it didn't
+    long long totalMoves;
+    long long thinking;           // ns between observations & commands
+    long long slowest;
+    int won;
+    int lost;
+    int outOfTime;
+} Bot;
+
+// The -X bots' tournament, see playBots()
+typedef struct Harness {
+    WorldConfig config;           // Game g of every bot gets seed config.seed + g
+    int games;
+    long long limit;              // ns a bot may think over one move
+    Bot *bots;
+    int numBots;
+} Harness;
+
+
+// Small Functions
+
+// Philox4x32-10 block: out is a pure function of (ctr, key)
+void philox(const uint32_t ctr[4], const uint32_t key[2], uint32_t out[4]) {
+    uint32_t c0 = ctr[0], c1 = ctr[1], c2 = ctr[2], c3 = ctr[3];
+    uint32_t k0 = key[0], k1 = key[1];
+    for (int i=0; i<10; i++) {
+        uint64_t p0 = (uint64_t) 0xD2511F53u * c0;
+        uint64_t p1 = (uint64_t) 0xCD9E8D57u * c2;
+        c0 = (uint32_t) (p1 >> 32) ^ c1 ^ k0;
+        c1 = (uint32_t) p1;
+        c2 = (uint32_t) (p0 >> 32) ^ c3 ^ k1;
+        c3 = (uint32_t) p0;
+        k0 += 0x9E3779B9u;
+        k1 += 0xBB67AE85u;
+    }
+    out[0] = c0;
+    out[1] = c1;
+    out[2] = c2;
+    out[3] = c3;
+}
+
+// Counter-based generator: stream keyed by (seed, stream id). Every stream can be drawn
+// independently of the others, so quadrants & rows can be generated in any order on any thread
+void rngInit(Rng *rng, unsigned long long seed, unsigned long long stream) {
+    rng->key[0] = (uint32_t) seed;
+    rng->key[1] = (uint32_t) (seed >> 32);
+    rng->ctr[0] = rng->ctr[1] = 0;
+    rng->ctr[2] = (uint32_t) stream;
+    rng->ctr[3] = (uint32_t) (stream >> 32);
+    rng->left = 0;
+}
+
+unsigned long long rngNext(Rng *rng) {
+    STAT_COUNT(rngDraws);
+    if (rng->left == 0) {
+        philox(rng->ctr, rng->key, rng->out);
+        if (++rng->ctr[0] == 0) rng->ctr[1]++;
+        rng->left = 4;
+    }
+    rng->left -= 2;
+    return (unsigned long long) rng->out[rng->left] << 32 | rng->out[rng->left + 1];
+}
+
+int rngRange(Rng *rng, int lo, int hi) {
+    return lo + (int) (rngNext(rng) % (unsigned long long) (hi - lo));
+}
+
+// Gameplay randomness comes from the thread's dice, seeded for every game so the galaxy seed
+// decides the whole game, whichever thread plays it
+_Thread_local Rng dice;
+
+void seedDice(unsigned long long seed) {
+    rngInit(&dice, seed, RNG_DICE);
+}
+
+int randRange(int lo, int hi) {
+    return rngRange(&dice, lo, hi);
+}
+
+double drand() {
+    return rngRange(&dice, 0, 1000) / (1000.00);
+}
+
+unsigned long long newSeed() {
+    return ((unsigned long long) rand() << 32 ^ (unsigned long long) rand() << 16 ^ rand()) | 1;
+}
+
+long long traceNow() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000LL + t.tv_nsec - tracer.origin;
+}
+
+// Hands the thread's chunk to the flush thread. Threads call this before they end
+void traceFlushThread() {
+    TraceChunk *chunk = traceChunk;
+    if (!chunk) return;
+    traceChunk = NULL;
+    chunk->next = atomic_load(&tracer.full);
+    while (!atomic_compare_exchange_weak(&tracer.full, &chunk->next, chunk));
+}
+
+void traceEvent(const char *name, long long start, long long dur) {
+    if (!traceChunk) {
+        if (!traceTid) traceTid = atomic_fetch_add(&tracer.numThreads, 1) + 1;
+        traceChunk = malloc(sizeof(TraceChunk));
+        if (!traceChunk) return;
+        traceChunk->tid = traceTid;
+        traceChunk->used = 0;
+    }
+    traceChunk->events[traceChunk->used++] = (TraceEvent) {name, start, dur};
+    if (traceChunk->used == TRACE_CHUNK) traceFlushThread();
+}
+
+// Names the calling thread's track
+void traceThreadName(const char *name) {
+    if (tracer.out) traceEvent(name, 0, -1);
+}
+
+// Flush thread: writes out full chunks every 20ms, until the trace is closed
+void *traceFlusher(void *arg) {
+    (void) arg;
+    while (true) {
+        bool closing = atomic_load(&tracer.closing);
+        TraceChunk *chunk = atomic_exchange(&tracer.full, NULL);
+        while (chunk) {
+            for (int i=0; i<chunk->used; i++) {
+                TraceEvent *e = &chunk->events[i];
+                fprintf(tracer.out, tracer.written++ ? ",\n" : "\n");
+                if (e->dur < 0) {
+                    fprintf(tracer.out, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, "
+                                        "\"args\": {\"name\": \"%s %d\"}}", chunk->tid, e->name, chunk->tid);
+                } else {
+                    fprintf(tracer.out, "{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, "
+                                        "\"ts\": %lld.%03lld, \"dur\": %lld.%03lld}", e->name, chunk->tid,
+                            e->start / 1000, e->start % 1000, e->dur / 1000, e->dur % 1000);
+                }
+            }
+            TraceChunk *next = chunk->next;
+            free(chunk);
+            chunk = next;
+        }
+        if (closing) return NULL;
+        struct timespec pause = {0, 20000000};
+        nanosleep(&pause, NULL);
+    }
+}
+
+// Writes what's been traced so far & stops tracing. Events other threads record later are dropped
+void traceClose() {
+    if (!tracer.out) return;
+    traceFlushThread();
+    atomic_store(&tracer.closing, true);
+    pthread_join(tracer.flusher, NULL);
+    fprintf(tracer.out, "\n]}\n");
+    fclose(tracer.out);
+    tracer.out = NULL;
+}
+
+bool traceOpen(const char *path) {
+    tracer.out = fopen(path, "w");
+    if (!tracer.out) return false;
+    tracer.origin = 0;
+    tracer.origin = traceNow();
+    fprintf(tracer.out, "{\"traceEvents\": [");
+    pthread_create(&tracer.flusher, NULL, traceFlusher, NULL);
+    atexit(traceClose);
+    return true;
+}
+
+// Wakes the writer to write out everything in the ring
+void outputWake(Output *o) {
+    pthread_mutex_lock(&o->lock);
+    o->wanted = true;
+    pthread_cond_signal(&o->wake);
+    pthread_mutex_unlock(&o->lock);
+}
+
+// Wakes the writer & waits until it's written out at least up to byte `until`
+void outputWait(Output *o, size_t until) {
+    pthread_mutex_lock(&o->lock);
+    o->wanted = true;
+    pthread_cond_signal(&o->wake);
+    while ((ssize_t) (until - atomic_load_explicit(&o->tail, memory_order_acquire)) > 0) {
+        pthread_cond_wait(&o->drained, &o->lock);
+    }
+    pthread_mutex_unlock(&o->lock);
+}
+
+// Writer thread: writes out the ring in one writev each time it's woken, until the session closes
+#ifdef ZLIB
+// Compresses the ring's bytes in iov & writes them out, ending with flush (Z_SYNC_FLUSH, or
+// Z_FINISH to end the stream). Returns the bytes consumed
+ssize_t outputDeflate(Output *o, struct iovec *iov, int flush) {
+    z_stream *z = o->z;
+    for (int i=0; i<2; i++) {
+        z->next_in = iov[i].iov_base;
+        z->avail_in = (uInt) iov[i].iov_len;
+        do {
+            z->next_out = o->zbuf;
+            z->avail_out = OUT_ZBUF;
+            deflate(z, i == 1 ? flush : Z_NO_FLUSH);
+            unsigned char *out = o->zbuf;
+            size_t left = OUT_ZBUF - z->avail_out;
+            STAT_ADD(sentBytes, left);
+            while (left) {
+                ssize_t n = write(o->fd, out, left);
+                if (n < 0 && errno == EINTR) continue;
+                if (n < 0) return -1;
+                out += n;
+                left -= n;
+            }
+        } while (z->avail_out == 0);
+    }
+    return (ssize_t) (iov[0].iov_len + iov[1].iov_len);
+}
+#endif
+
+void *outputWriter(void *arg) {
+    Output *o = arg;
+    traceThreadName("WRITER");
+    size_t tail = 0;
+    while (true) {
+        pthread_mutex_lock(&o->lock);
+        while (!o->wanted && !o->closing) pthread_cond_wait(&o->wake, &o->lock);
+        o->wanted = false;
+        bool closing = o->closing;
+        pthread_mutex_unlock(&o->lock);
+
+        size_t head;
+        while ((head = atomic_load_explicit(&o->head, memory_order_acquire)) != tail) {
+            STAT_BEGIN(t);
+            // The bytes may wrap around the end of the ring
+            size_t at = tail % OUT_RING, len = head - tail;
+            struct iovec iov[2] = {{o->ring + at, len}, {o->ring, 0}};
+            if (at + len > OUT_RING) {
+                iov[0].iov_len = OUT_RING - at;
+                iov[1].iov_len = len - iov[0].iov_len;
+            }
+            ssize_t n;
+#ifdef ZLIB
+            if (o->z) n = outputDeflate(o, iov, Z_SYNC_FLUSH);
+            else
+#endif
+            {
+                n = writev(o->fd, iov, 2);
+                if (n < 0 && errno == EINTR) continue;
+                STAT_ADD(sentBytes, n > 0 ? n : 0);
+            }
+            tail += n < 0 ? len : (size_t) n;  // Output that can't be written is dropped
+            STAT_END(t, statWrite);
+
+            pthread_mutex_lock(&o->lock);
+            atomic_store_explicit(&o->tail, tail, memory_order_release);
+            pthread_cond_broadcast(&o->drained);
+            pthread_mutex_unlock(&o->lock);
+        }
+        if (closing) break;
+    }
+    traceFlushThread();
+    return NULL;
+}
+
+// Publishes n bytes written at head, waking the writer if that's made the ring half full
+void outputAdvance(Output *o, size_t head, size_t n) {
+    STAT_ADD(outputBytes, n);
+    atomic_store_explicit(&o->head, head + n, memory_order_release);
+    size_t used = head + n - atomic_load_explicit(&o->tail, memory_order_acquire);
+    if (used >= OUT_RING/2 && used - n < OUT_RING/2) outputWake(o);
+}
+
+// Copies n bytes into the ring, waiting for the writer only if it's full
+void outputPut(Output *o, const char *s, size_t n) {
+    size_t head = atomic_load_explicit(&o->head, memory_order_relaxed);
+    while (n) {
+        size_t room = OUT_RING - (head - atomic_load_explicit(&o->tail, memory_order_acquire));
+        if (!room) {
+            outputWait(o, head - OUT_RING/2);
+            continue;
+        }
+        size_t at = head % OUT_RING, len = n;
+        if (len > room) len = room;
+        if (len > OUT_RING - at) len = OUT_RING - at;
+        memcpy(o->ring + at, s, len);
+        outputAdvance(o, head, len);
+        s += len;
+        n -= len;
+        head += len;
+    }
+}
+
+// Draws captured text into the panel's frame, clipped to the panel
+void screenPut(Screen *s, const char *text, int n) {
+    for (int i=0; i<n; i++) {
+        if (text[i] == '\n') {
+            s->row++;
+            s->col = 0;
+        } else if (s->row < s->end && s->col < SCREEN_COLS) {
+            s->frame[s->row][s->col++] = text[i];
+        }
+    }
+}
+
+// printf for the game's output, which goes to the calling thread's session
+void gamePrintf(const char *format, ...) {
+    Output *o = output;
+    if (!o) return;
+    if (screen && screen->row >= 0) {
+        char line[256];
+        va_list args;
+        va_start(args, format);
+        int n = vsnprintf(line, sizeof(line), format, args);
+        va_end(args);
+        screenPut(screen, line, n < (int) sizeof(line) ? n : (int) sizeof(line) - 1);
+        return;
+    }
+    STAT_BEGIN(t);
+    // Format straight into the ring if it fits before the ring's end or the writer's tail
+    size_t head = atomic_load_explicit(&o->head, memory_order_relaxed), at = head % OUT_RING;
+    size_t room = OUT_RING - (head - atomic_load_explicit(&o->tail, memory_order_acquire));
+    if (room > OUT_RING - at) room = OUT_RING - at;
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(o->ring + at, room, format, args);
+    va_end(args);
+    if (n >= 0 && (size_t) n < room) {
+        outputAdvance(o, head, n);
+    } else if (n > 0) {
+        char *line = malloc(n + 1);
+        if (line) {
+            va_start(args, format);
+            vsnprintf(line, n + 1, format, args);
+            va_end(args);
+            outputPut(o, line, n);
+            free(line);
+        }
+    }
+    STAT_END(t, statOutput);
+}
+
+// Flush point, before the game waits for input: has the writer write out the prompt without
+// waiting for it
+void flushOutput() {
+    if (output) outputWake(output);
+}
+
+// Waits until the calling thread's output is all written, for writing to the fd directly after
+void drainOutput() {
+    if (output) outputWait(output, atomic_load_explicit(&output->head, memory_order_relaxed));
+}
+
+// A session writing to fd, compressed if compress is set (which needs ZLIB)
+Output *outputOpen(int fd, bool compress) {
+    Output *o = malloc(sizeof(Output));
+    if (!o) return NULL;
+#ifdef ZLIB
+    o->z = NULL;
+    o->zbuf = NULL;
+    if (compress) {
+        o->z = calloc(1, sizeof(z_stream));
+        o->zbuf = malloc(OUT_ZBUF);
+        if (!o->z || !o->zbuf || deflateInit2(o->z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, OUT_ZWINDOW, OUT_ZMEM,
+                                              Z_DEFAULT_STRATEGY) != Z_OK) {
+            free(o->z);
+            free(o->zbuf);
+            free(o);
+            return NULL;
+        }
+        deflateSetDictionary(o->z, (const Bytef *) outputDictionary, sizeof(outputDictionary) - 1);
+    }
+#else
+    if (compress) {
+        free(o);
+        return NULL;
+    }
+#endif
+    atomic_init(&o->head, 0);
+    atomic_init(&o->tail, 0);
+    o->fd = fd;
+    o->wanted = o->closing = false;
+    pthread_mutex_init(&o->lock, NULL);
+    pthread_cond_init(&o->wake, NULL);
+    pthread_cond_init(&o->drained, NULL);
+    if (pthread_create(&o->writer, NULL, outputWriter, o)) {
+#ifdef ZLIB
+        if (o->z) deflateEnd(o->z);
+        free(o->z);
+        free(o->zbuf);
+#endif
+        free(o);
+        return NULL;
+    }
+    return o;
+}
+
+// Writes out what's left & ends the session's writer
+void outputClose(Output *o) {
+    pthread_mutex_lock(&o->lock);
+    o->closing = true;
+    pthread_cond_signal(&o->wake);
+    pthread_mutex_unlock(&o->lock);
+    pthread_join(o->writer, NULL);
+#ifdef ZLIB
+    if (o->z) {
+        // End the stream, so the client knows it's complete
+        struct iovec none[2] = {{NULL, 0}, {NULL, 0}};
+        outputDeflate(o, none, Z_FINISH);
+        deflateEnd(o->z);
+        free(o->z);
+        free(o->zbuf);
+    }
+#endif
+    pthread_mutex_destroy(&o->lock);
+    pthread_cond_destroy(&o->wake);
+    pthread_cond_destroy(&o->drained);
+    free(o);
+}
+
+// atexit() hook, so the game's last words get out on every exit path
+void closeOutput() {
+    if (!output) return;
+    outputClose(output);
+    output = NULL;
+}
+
+// Clears the terminal & sets the messages scrolling below the panels. False if it's too short
+bool screenOpen() {
+    struct winsize ws;
+    int height = 0;
+    if (!ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws)) height = ws.ws_row;
+    else if (getenv("LINES")) height = atoi(getenv("LINES"));
+    if (!height) height = 50;
+    if (height < SCREEN_ROWS + 8) return false;
+
+    Screen *s = malloc(sizeof(Screen));
+    if (!s) return false;
+    memset(s->shown, ' ', sizeof(s->shown));
+    memset(s->frame, ' ', sizeof(s->frame));
+    s->height = height;
+    s->row = -1;
+    gamePrintf("\033[2J\033[%d;1H", SCREEN_ROWS + 1);
+    for (int i=0; i<SCREEN_COLS; i++) gamePrintf("=");
+    gamePrintf("\033[%d;%dr\033[%d;1H", SCREEN_ROWS + 2, height, SCREEN_ROWS + 2);
+    screen = s;
+    return true;
+}
+
+// Starts capturing game output into the panel from row top up to end
+void screenCapture(int top, int end) {
+    Screen *s = screen;
+    if (!s) return;
+    memset(s->frame[top], ' ', (size_t) (end - top) * SCREEN_COLS);
+    s->row = s->top = top;
+    s->col = 0;
+    s->end = end;
+}
+
+// Stops capturing & sends the panel's changed cells, leaving the cursor where the messages are
+void screenRelease() {
+    Screen *s = screen;
+    if (!s || s->row < 0) return;
+    int top = s->top, end = s->end;
+    s->row = -1;
+
+    bool moved = false;
+    for (int r=top; r<end; r++) {
+        int c = 0;
+        while (c < SCREEN_COLS) {
+            if (s->frame[r][c] == s->shown[r][c]) {
+                c++;
+                continue;
+            }
+            // A run of changes, taking in short stretches of unchanged cells
+            int last = c;
+            for (int i=c+1; i<SCREEN_COLS && i<=last+SCREEN_GAP; i++) {
+                if (s->frame[r][i] != s->shown[r][i]) last = i;
+            }
+            if (!moved) gamePrintf("\0337");
+            moved = true;
+            gamePrintf("\033[%d;%dH%.*s", r + 1, c + 1, last - c + 1, &s->frame[r][c]);
+            memcpy(&s->shown[r][c], &s->frame[r][c], last - c + 1);
+            c = last + 1;
+        }
+    }
+    if (moved) gamePrintf("\0338");
+}
+
+// atexit() hook: gives the terminal its whole height back
+void screenClose() {
+    Screen *s = screen;
+    if (!s) return;
+    gamePrintf("\033[r\033[%d;1H\n", s->height);
+    screen = NULL;
+    free(s);
+}
+
+uint32_t fnv1a(const void *data, size_t n, uint32_t hash) {
+    const unsigned char *bytes = data;
+    for (size_t i=0; i<n; i++) hash = (hash ^ bytes[i]) * 16777619u;
+    return hash;
+}
+
+// A quadrant's counts as the archive & the feed keep them
+uint16_t packCounts(const Quadrant *quad) {
+    return (uint16_t) (quad->numKlingons << 12 | quad->numStarbases << 8 | quad->numStars);
+}
+
+// Seqlock write side, see Feed
+void feedBegin(Feed *f) {
+    atomic_store_explicit(&f->seq, atomic_load_explicit(&f->seq, memory_order_relaxed) + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+void feedEnd(Feed *f) {
+    atomic_store_explicit(&f->seq, atomic_load_explicit(&f->seq, memory_order_relaxed) + 1, memory_order_release);
+}
+
+// Adds a line to the feed's recent events
+void feedEvent(const char *format, ...) {
+    Feed *f = feed;
+    if (!f) return;
+    feedBegin(f);
+    va_list args;
+    va_start(args, format);
+    vsnprintf(f->state.event[f->state.numEvents % FEED_EVENTS], FEED_EVENT_LEN, format, args);
+    va_end(args);
+    f->state.numEvents++;
+    feedEnd(f);
+}
+
+typedef struct TaskPool {
+    void (*fn)(void *ctx, int task);
+    void *ctx;
+    int numTasks;
+    atomic_int next;
+    atomic_int workers;
+} TaskPool;
+
+void *taskWorker(void *arg) {
+    TaskPool *pool = arg;
+    int task;
+    while ((task = atomic_fetch_add(&pool->next, 1)) < pool->numTasks) {
+        pool->fn(pool->ctx, task);
+    }
+    return NULL;
+}
+
+// Entry of the threads runTasks starts
+void *taskThread(void *arg) {
+    TaskPool *pool = arg;
+    if (tracer.out) {
+        int worker = atomic_fetch_add(&pool->workers, 1);
+        traceTid = TRACE_WORKER_TID + worker;
+        // Only the first thread on a track names it
+        int named = atomic_load(&tracer.namedWorkers);
+        while (named <= worker && !atomic_compare_exchange_weak(&tracer.namedWorkers, &named, worker+1));
+        if (named <= worker) traceThreadName("WORKER");
+    }
+    taskWorker(pool);
+    traceFlushThread();
+    return NULL;
+}
+
+// Runs fn(ctx, 0..numTasks-1) on up to `threads` threads, including the calling one
+void runTasks(void (*fn)(void *ctx, int task), void *ctx, int numTasks, int threads) {
+    TaskPool pool = {fn, ctx, numTasks, 0, 0};
+    if (threads > numTasks) threads = numTasks;
+    if (threads < 1) threads = 1;
+
+    pthread_t workers[threads];
+    int started = 0;
+    for (int i=1; i<threads; i++) {
+        if (pthread_create(&workers[started], NULL, taskThread, &pool) == 0) started++;
+    }
+    taskWorker(&pool);
+    for (int i=0; i<started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+}
+
+int numCores() {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int) n : 1;
+}
+
+// A template world's overlay of quadrant q, NULL if it has none
+Overlay *findOverlay(World *world, int q) {
+    if (!world->numOverlay) return NULL;
+    unsigned mask = (unsigned) world->capOverlay - 1;
+    for (unsigned i=(unsigned) q * 2654435761u & mask; world->overlay[i]; i=(i+1) & mask) {
+        if (world->overlay[i]->q == q) return world->overlay[i];
+    }
+    return NULL;
+}
+
+// Quadrant q of the galaxy. A template world gets the template's, which is read only, unless
+// it has an overlay of it. Write through ownQuadrant() instead
+Quadrant *quadrantAt(World *world, int q) {
+    if (!world->tmpl) return &world->quadrant[q];
+    Overlay *o = findOverlay(world, q);
+    return o ? &o->quad : (Quadrant *) ((const char *) world->tmpl + world->tmpl->quadrants) + q;
+}
+
+// Bounds-safe quadrant access, NULL outside of the galaxy
+Quadrant *getQuadrant(World *world, int q1, int q2) {
+    if (q1 < 0 || q1 >= world->config.rows || q2 < 0 || q2 >= world->config.cols) return NULL;
+    return quadrantAt(world, q1*world->config.cols + q2);
+}
+
+double getDistance(Player *player, const int *to) {
+    int x = ((player->pos[1] * 8) + player->pos[3]) - ((to[1]*8)+to[3]);
+    int y = ((player->pos[0] * 8) + player->pos[2]) - ((to[0]*8)+to[2]);
+    return sqrt(pow(x,2) + pow(y,2));
+}
+
+// Direction (course 1-9) & distance from (C1,A) to (W1,X), as used by the library-computer
+void calcDirection(double C1, double A, double W1, double X, double *dir, double *dist) {
+    double DIR = 0;
+    X = X-A;
+    A = C1-W1;
+    if ((X < 0 && A > 0) || (X >= 0 && A < 0)) {
+        // Between course 3 & 5, or 7 & 9
+        C1 = (X < 0) ? 3 : 7;
+        if (fabs(A) >= fabs(X)) {
+            DIR = C1+(fabs(X)/fabs(A));
+        }
+        else {
+            DIR = C1+(((fabs(X)-fabs(A))+fabs(X))/fabs(X));
+        }
+    }
+    else if (X != 0 || A != 0) {
+        // Between course 1 & 3, or 5 & 7
+        C1 = (X < 0) ? 5 : 1;
+        if (fabs(A) <= fabs(X)) {
+            DIR = C1+(fabs(A)/fabs(X));
+        }
+        else {
+            DIR = C1+(((fabs(A)-fabs(X))+fabs(A))/fabs(A));
+        }
+    }
+    *dir = DIR;
+    *dist = sqrt( pow(X, 2)+pow(A, 2));
+}
+
+// Sectors moved per step along a course (1-9): 1 is along the row, counting counterclockwise
+void courseStep(double course, double *rowStep, double *colStep) {
+    static const int movement[10][2] = {
+            {0,0},      // NOTHING
+            {0,1},      // 1
+            {-1,1},     // 2
+            {-1,0},     // 3
+            {-1,-1},    // 4
+            {0,-1},     // 5
+            {1,-1},     // 6
+            {1,0},      // 7
+            {1,1},      // 8
+            {0,1},      // 9
+    };
+    if (course >= 9) course -= 8; // Course 9 is course 1
+    int c = (int) floor(course);
+    *rowStep = movement[c][0] + (movement[c + 1][0] - movement[c][0]) * (course - c);
+    *colStep = movement[c][1] + (movement[c + 1][1] - movement[c][1]) * (course - c);
+}
+
+
+// Functions Header
+void printTitle();
+bool parseOptions(Options *opts, int argc, char *argv[]);
+void splitQuota(int total, const int *cap, int *quota, int rows, Rng *rng);
+void generateRow(void *ctx, int row);
+void worldInit(World *world, const WorldConfig *config);
+void benchGeneration(const WorldConfig *config);
+void benchTick(const WorldConfig *config);
+void tickRow(void *ctx, int row);
+void galaxyTick(World *world);
+void moveKlingon(World *world, int from, int to, long long stardate);
+void autopilot(World *world);
+void *simulateWorker(void *arg);
+void simulateGames(const Options *opts);
+int autopilotGame(World *world, int maxTurns);
+bool configValid(const WorldConfig *config);
+double wilsonHalfWidth(int wins, int games);
+void sweepGame(void *ctx, int task);
+bool datasetOpen(const char *path);
+void datasetClose();
+Trajectory *trajectoryOpen();
+void trajectoryClose(Trajectory *t);
+void trajectoryWrite(Trajectory *t, int rows);
+void trajectoryObserve(World *world);
+void trajectoryAction(int type, double a, double b);
+void trajectoryStep(World *world, int destroyed);
+bool readDataset(const char *path);
+bool sweepParameters(const Options *opts);
+bool autopilotFight(World *world);
+bool autopilotCourse(World *world, double *course, double *warpFactor);
+void lockQuadrants(Galaxy *g, int top, int left, int bottom, int right);
+void unlockQuadrants(Galaxy *g, int top, int left, int bottom, int right);
+void shipTurn(Galaxy *g, World *ship);
+void *shipWorker(void *arg);
+void playGalaxy(const Options *opts);
+int appendf(char *buf, size_t cap, int n, const char *format, ...);
+int protocolObserve(World *world, const char *code, const char *extra, char *buf, size_t cap);
+const char *protocolRefusal(const char *refused);
+const char *protocolCommand(World *world, const char *line, char *extra, size_t cap);
+const char *protocolOutcome(World *world, int moves);
+void playProtocol(const Options *opts);
+long long monotonicNanos();
+bool startBot(Bot *bot);
+void botSend(Harness *h, Bot *bot, const char *code, const char *extra);
+void botForfeit(Bot *bot, const char *why);
+void botNextGame(Harness *h, Bot *bot);
+void botLine(Harness *h, Bot *bot, const char *line, long long now);
+void botRead(Harness *h, Bot *bot, long long now);
+bool playBots(const Options *opts);
+bool feedOpen(const char *name, const WorldConfig *config);
+void feedPublish(World *world);
+void feedClose();
+int watchFeed(const char *name);
+int inflateStream();
+bool journalOpen(const char *path, const Options *opts, const Recovery *rec);
+void *journalCommitter(void *arg);
+unsigned long long journalAppend(uint32_t type, const void *payload, size_t n);
+bool journalWait(unsigned long long lsn);
+int journalFailed();
+void journalSeed(World *world);
+bool journalCommand(World *world, int type, double a, double b);
+char *encodeSnapshot(World *world, size_t *bytes);
+void journalSnapshot(World *world);
+void journalEnd(World *world);
+void journalClose();
+uint32_t worldDigest(const World *world);
+bool journalRestore(World *world, const char *data, size_t n);
+int journalReplay(World *world, const Recovery *rec, uint32_t session, size_t from, size_t until);
+bool recoverJournal(const char *path, const WorldConfig *config, Recovery *rec);
+void journalResume(World *world, const Recovery *rec);
+void freeMaps(World *world);
+void freeWorld(World *world);
+void scheduleEvent(World *world, int type, int arg, double at);
+Event popEvent(World *world);
+void advanceClock(World *world, double days);
+void runEvent(World *world, const Event *event);
+void poolInit(WorldPool *pool, const WorldConfig *config, int prefetch, int players);
+void *prefetchWorlds(void *arg);
+World *poolTake(WorldPool *pool);
+void poolRecycle(WorldPool *pool, World *world);
+void poolClose(WorldPool *pool);
+void poolSleep(WorldPool *pool, World *taken);
+void poolWake(WorldPool *pool);
+void awaitCommand(World *world);
+bool hibernateWorld(World *world, const char *path);
+void wakeWorld(World *world, const char *path);
+bool templateWrite(const char *path, const WorldConfig *config);
+bool templateOpen(const char *path, WorldConfig *config);
+void templateWorld(World *world, const Template *t);
+void overlayInsert(Overlay **table, int cap, Overlay *o);
+Overlay *overlayQuadrant(World *world, int q);
+Quadrant *ownQuadrant(World *world, int q);
+void clearOverlay(World *world);
+void ownStarbaseField(World *world);
+size_t worldBytes(World *world);
+SectorMap *touchQuadrant(World *world, int q1, int q2);
+void generateMap(World *world, int q1, int q2, SectorMap *map);
+void evictQuadrants(World *world);
+int spreadStarbaseField(World *world, int q, int *queue, int tail);
+void buildStarbaseField(World *world);
+int compareSeeds(const void *a, const void *b);
+void removeStarbaseFromField(World *world, int q1, int q2);
+bool nearestStarbase(World *world, Starbase **base, double *course, double *warp);
+void archiveQuadrant(World *world, int q1, int q2);
+bool archivedCounts(World *world, int q, uint16_t *counts);
+void updateCond(World *world);
+Entity *entitySlots(SectorMap *map, char type);
+unsigned char *entityCountPtr(Quadrant *quad, char type);
+int entityCount(Quadrant *quad, char type);
+Handle getHandle(const Entity *entity, char type);
+Entity *resolveHandle(World *world, Handle handle);
+void removeEntity(World *world, Entity *entity, char type);
+Entity *getNearbyEntity(World *world, int n, char type);
+void getCmd(World *world);
+void cmdNAV(World *world);
+void navigate(World *world, double courseInput, double warpInput);
+void printStat(World *world, int n);
+void cmdSRS(World *world);
+void cmdLRS(World *world);
+void cmdPHA(World *world);
+void firePhasers(World *world, int input);
+void cmdTOR(World *world);
+void fireTorpedo(World *world, double courseInput);
+void navTrack(World *world, double courseInput, double warpInput, bool clear, Track *track);
+void torpedoTrack(World *world, double courseInput, Track *track);
+void previewFire(World *world, const Entity *spared, Preview *preview);
+void previewNav(World *world, double courseInput, double warpInput, Preview *preview);
+void previewTor(World *world, double courseInput, Preview *preview);
+void cmdPRE(World *world, const char *input);
+uint64_t combatKey(const Combat *c);
+Combat combatRound(Combat c);
+void tacticsStore(Tactics *t, const TacticsEntry *e);
+TacticsEntry *tacticsLookup(Tactics *t, uint64_t key);
+double klingonFire(Tactics *t, const Combat *c);
+double solveCombat(Tactics *t, const Combat *c, char *action, int *arg);
+double deepenCombat(Tactics *t, const Combat *c, char *action, int *arg, int *plies);
+Tactics *tacticsFor(World *world, Combat *c);
+void freeTactics(World *world);
+void tacticalAdvice(World *world);
+void cmdSHE(World *world);
+void setShields(World *world, int input);
+void cmdDAM(World *world);
+void cmdCOM(World *world);
+void cmdXXX(World *world);
+void sortEntities(Entity **entity, double *dist, int n);
+#ifdef STATS
+int histBucket(unsigned long long v);
+unsigned long long histValue(int bucket);
+unsigned long long histPercentile(Histogram *hist, double p);
+void printStats(FILE *out, bool json);
+void dumpStats();
+void *statsSignalThread(void *arg);
+void cmdSTATS(char *input);
+#endif
+void klingonShooting(World *world);
+World *checkGameOver(World *world);
+void printInstructions();
+
+
+// MARK - Game Main Entry Point //
+int main(int argc, char *argv[]) {
+    srand(time(NULL));
+#ifdef STATS
+    // SIGUSR1 dumps the stats from a thread of its own. Block it before any other thread
+    // starts, so they all inherit the mask & the signal only ever reaches sigwait()
+    sigset_t usr1;
+    sigemptyset(&usr1);
+    sigaddset(&usr1, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &usr1, NULL);
+    pthread_t statsThread;
+    pthread_create(&statsThread, NULL, statsSignalThread, NULL);
+    atexit(dumpStats);
+#endif
+
+    Options opts = {
+            .config = {
+                    .rows = GALAXY_SIZE,
+                    .cols = GALAXY_SIZE,
+                    .numKlingons = NUM_KL,
+                    .numStarbases = NUM_SB,
+                    .numStars = NUM_STARS,
+                    .days = START_DAYS,
+                    .seed = 0,
+                    .threads = numCores(),
+                    .energy = PLAYER_ENERGY,
+                    .fire = 100,
+                    .phasers = 100
+            },
+            .benchGen = false,
+            .simGames = 0,
+            .traceFile = NULL,
+            .feedName = NULL,
+            .watchName = NULL,
+            .ansi = false,
+            .compress = false,
+            .inflate = false,
+            .journalFile = NULL,
+            .journalAsync = false,
+            .recoverFile = NULL,
+            .moveMillis = 1000
+    };
+    if (!parseOptions(&opts, argc, argv)) return 1;
+    if (opts.traceFile && !traceOpen(opts.traceFile)) {
+        fprintf(stderr, "CAN'T WRITE TRACE TO %s\n", opts.traceFile);
+        return 1;
+    }
+    if (opts.watchName) return watchFeed(opts.watchName);
+    if (opts.inflate) return inflateStream();
+    if (opts.readFile) return readDataset(opts.readFile) ? 0 : 1;
+    if (opts.benchGen) {
+        benchGeneration(&opts.config);
+        if (opts.config.tick) benchTick(&opts.config);
+        return 0;
+    }
+    if (opts.sweep) return sweepParameters(&opts) ? 0 : 1;
+    if (opts.templateFile && !templateOpen(opts.templateFile, &opts.config)) {
+        fprintf(stderr, "CAN'T USE THE GALAXY TEMPLATE %s\n", opts.templateFile);
+        return 1;
+    }
+    if (opts.numBots) return playBots(&opts) ? 0 : 1;
+    Recovery rec = {0};
+    if (opts.recoverFile) {
+        if (!recoverJournal(opts.recoverFile, &opts.config, &rec)) return 1;
+        if (!rec.session) return 0; // Nothing to resume, the report was all
+        opts.config.seed = rec.seed;
+        opts.journalFile = opts.recoverFile;
+    }
+    if (opts.journalFile && !journalOpen(opts.journalFile, &opts, &rec)) {
+        fprintf(stderr, "CAN'T WRITE THE JOURNAL TO %s\n", opts.journalFile);
+        return 1;
+    }
+    if (opts.protocol) {
+        playProtocol(&opts);
+        return 0;
+    }
+    if (opts.simGames) {
+        simulateGames(&opts);
+        return 0;
+    }
+    if (opts.ships) {
+        playGalaxy(&opts);
+        return 0;
+    }
+    traceThreadName("GAME");
+    output = outputOpen(STDOUT_FILENO, opts.compress);
+    if (!output) {
+#ifdef ZLIB
+        fprintf(stderr, "CAN'T START THE OUTPUT WRITER\n");
+#else
+        fprintf(stderr, opts.compress ? "COMPRESSION NEEDS A -DZLIB BUILD\n" : "CAN'T START THE OUTPUT WRITER\n");
+#endif
+        return 1;
+    }
+    atexit(closeOutput);
+    if (opts.ansi) {
+        if (!screenOpen()) {
+            fprintf(stderr, "THE TERMINAL NEEDS AT LEAST %d ROWS FOR -a\n", SCREEN_ROWS + 8);
+            return 1;
+        }
+        atexit(screenClose);
+    }
+    if (opts.feedName && !feedOpen(opts.feedName, &opts.config)) {
+        fprintf(stderr, "CAN'T PUBLISH THE GAME TO %s\n", opts.feedName);
+        return 1;
+    }
+
+    // Hibernating waits for input on the descriptor, so stdin can't hold any back in its buffer
+    hibernateSecs = opts.idleSecs;
+    if (hibernateSecs) setvbuf(stdin, NULL, _IONBF, 0);
+
+    // The first galaxy gets generated while the title is up
+    WorldPool pool;
+    poolInit(&pool, &opts.config, POOL_PREFETCH, 1);
+    if (!rec.session) printTitle(); // A resumed player has been through it
+    World *world = poolTake(&pool);
+    seedDice(world->seed);
+    if (rec.session) journalResume(world, &rec);
+    else journalSeed(world);
+    if (journalCommand(world, journalSRS, 0, 0)) cmdSRS(world);
+    world = checkGameOver(world);
+    feedPublish(world);
+
+    while (!world->gameOver){
+        getCmd(world);
+        world = checkGameOver(world);
+        feedPublish(world);
+    }
+
+    poolClose(&pool);
+    return 0;
+}
+// END OF MAIN //
+
+
+// Functions :-
+void printTitle(){
+    gamePrintf("\n*****************************************\n");
+    gamePrintf("*                   *                   *\n");
+    gamePrintf("*                 * * *                 *\n");
+    gamePrintf("*     * *    SUPER STAR TREK   * *      *\n");
+    gamePrintf("*               * *   * *               *\n");
+    gamePrintf("*              * *     * *              *\n");
+    gamePrintf("*****************************************\n");
+    gamePrintf("\n                                    ,------*------,\n");
+    gamePrintf("                    ,-------------   '---  ------'\n");
+    gamePrintf("                     '-------- --'      / /\n");
+    gamePrintf("                         ,---' '-------/ /--,\n");
+    gamePrintf("                          '----------------'\n");
+    gamePrintf("                    THE USS ENTERPRISE --- NCC-1701\n");
+
+    gamePrintf("\n\nDO YOU WANT TO SEE THE GAME INSTRUCTIONS BEFORE STARTING (y/n)? ");
+    flushOutput();
+    int ans = tolower(getchar());
+    while(fgetc(stdin)!='\n'); // Trim extra input
+    if (ans == 'y') printInstructions();
+}
+
+// Reads the galaxy configuration from the command line:
+//   -g ROWSxCOLS  galaxy size in quadrants
+//   -k N          number of klingons
+//   -b N          number of starbases
+//   -s N          number of stars
+//   -d N          stardates to complete the mission in
+//   -r SEED       seed of the first galaxy, the ones after it count up from there
+//   -j N          threads used to generate the galaxy, & to play simulated games on
+//   -B            benchmark galaxy generation on 1 vs N threads
+//   -T            klingons move & raid galaxy-wide every stardate (with -B, benchmark that too)
+//   -S N          let the autopilot play N games & report, seeds follow on from -r
+//   -t FILE       write a Chrome trace of the session to FILE
+//   -f NAME       publish the game to spectators in shared memory NAME
+//   -w NAME       watch the game published in NAME instead of playing
+//   -a            full-screen ANSI mode, redrawing only what changed
+//   -z            compress the game's output (needs a -DZLIB build)
+//   -Z            decompress -z output from stdin to stdout
+//   -J FILE       journal every session's commands to FILE
+//   -U            don't wait for the journal to be on disk
+//   -R FILE       replay the journal FILE, then resume its unfinished game
+//   -M N          let N autopilot ships play one galaxy together & report
+//   -H SECONDS    hibernate the game to disk after SECONDS idle at the COMMAND prompt
+//   -P GRID       sweep the autopilot over a parameter grid, up to -S games a cell, see sweepParameters()
+//   -D FILE       with -S, write every autopilot step to the trajectory dataset FILE, see Dataset
+//   -V FILE       read the trajectory dataset FILE & summarize it
+//   -G FILE       every game plays the galaxy template FILE, written from the galaxy options if it doesn't exist
+//   -L            play over the line protocol on stdin & stdout, see playProtocol()
+//   -X COMMAND    a bot for the harness to play -S games with over the line protocol, up to MAX_BOTS of them
+//   -x MS         milliseconds a -X bot may think over one move
+bool parseOptions(Options *opts, int argc, char *argv[]) {
+    WorldConfig *config = &opts->config;
+    int opt;
+    while ((opt = getopt(argc, argv, "g:k:b:s:d:r:j:BTS:t:f:w:azZJ:UR:M:H:P:D:V:G:LX:x:")) != -1) {
+        switch (opt) {
+            case 'g':
+                if (sscanf(optarg, "%dx%d", &config->rows, &config->cols) != 2) config->rows = 0;
+                break;
+            case 'k':
+                config->numKlingons = atoi(optarg);
+                break;
+            case 'b':
+                config->numStarbases = atoi(optarg);
+                break;
+            case 's':
+                config->numStars = atoi(optarg);
+                break;
+            case 'd':
+                config->days = atoi(optarg);
+                break;
+            case 'r':
+                config->seed = strtoull(optarg, NULL, 10);
+                break;
+            case 'j':
+                config->threads = atoi(optarg);
+                break;
+            case 'B':
+                opts->benchGen = true;
+                break;
+            case 'T':
+                config->tick = true;
+                break;
+            case 'S':
+                opts->simGames = atoi(optarg);
+                break;
+            case 't':
+                opts->traceFile = optarg;
+                break;
+            case 'f':
+                opts->feedName = optarg;
+                break;
+            case 'w':
+                opts->watchName = optarg;
+                break;
+            case 'a':
+                opts->ansi = true;
+                break;
+            case 'z':
+                opts->compress = true;
+                break;
+            case 'Z':
+                opts->inflate = true;
+                break;
+            case 'J':
+                opts->journalFile = optarg;
+                break;
+            case 'U':
+                opts->journalAsync = true;
+                break;
+            case 'R':
+                opts->recoverFile = optarg;
+                break;
+            case 'M':
+                opts->ships = atoi(optarg);
+                break;
+            case 'H':
+                opts->idleSecs = atoi(optarg);
+                break;
+            case 'P':
+                opts->sweep = optarg;
+                break;
+            case 'D':
+                opts->datasetFile = optarg;
+                break;
+            case 'V':
+                opts->readFile = optarg;
+                break;
+            case 'G':
+                opts->templateFile = optarg;
+                break;
+            case 'L':
+                opts->protocol = true;
+                break;
+            case 'X':
+                if (opts->numBots == MAX_BOTS) {
+                    fprintf(stderr, "AT MOST %d BOTS\n", MAX_BOTS);
+                    return false;
+                }
+                opts->bots[opts->numBots++] = optarg;
+                break;
+            case 'x':
+                opts->moveMillis = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-g ROWSxCOLS] [-k KLINGONS] [-b STARBASES] [-s STARS] [-d DAYS]\n"
+                                "       [-r SEED] [-j THREADS] [-B] [-T] [-S GAMES] [-t TRACE] [-f FEED] [-w FEED] [-a] [-z | -Z]\n"
+                                "       [-J JOURNAL [-U]] [-R JOURNAL] [-M SHIPS] [-H SECONDS] [-P GRID] [-D DATASET] [-V DATASET]\n"
+                                "       [-G TEMPLATE] [-L] [-X BOT ... [-x MS]]\n", argv[0]);
+                return false;
+        }
+    }
+
+    long quads = (long) config->rows * config->cols;
+    if (!configValid(config) || opts->simGames < 0 || opts->ships < 0 || opts->idleSecs < 0 || opts->ships > quads * QS_SIZE * QS_SIZE / 4
+        || (opts->ships && opts->journalFile) || (opts->datasetFile && !opts->simGames)
+        || (opts->datasetFile && (config->rows > 65536 || config->cols > 65536)) // Positions are u16 in the dataset
+        || (opts->templateFile && (opts->benchGen || opts->ships || opts->sweep)) || opts->moveMillis <= 0
+        || (opts->protocol && (opts->simGames || opts->ships || opts->recoverFile || opts->ansi || opts->compress))
+        || (opts->numBots && (opts->protocol || opts->ships || opts->sweep || opts->journalFile || opts->recoverFile))) {
+        fprintf(stderr, "INVALID GALAXY CONFIGURATION\n");
+        return false;
+    }
+    return true;
+}
+
+// Splits total over the rows in proportion to their capacity (which is never exceeded).
+// The rounding leftovers go to random rows
+void splitQuota(int total, const int *cap, int *quota, int rows, Rng *rng) {
+    long long capSum = 0;
+    for (int r=0; r<rows; r++) capSum += cap[r];
+
+    int given = 0;
+    for (int r=0; r<rows; r++) {
+        quota[r] = capSum ? (int) ((long long) total * cap[r] / capSum) : 0;
+        given += quota[r];
+    }
+    while (given < total) {
+        int r = rngRange(rng, 0, rows);
+        if (quota[r] < cap[r]) {
+            quota[r]++;
+            given++;
+        }
+    }
+}
+
+typedef struct RowQuotas {
+    World *world;
+    int *starbases;
+    int *klingons;
+    int *stars;
+} RowQuotas;
+
+// Fills one galaxy row's quadrant counts from its own generator stream. Rows only
+// touch their own quadrants, so they can run on any thread in any order
+void generateRow(void *ctx, int row) {
+    TRACE_BEGIN(t);
+    RowQuotas *quotas = ctx;
+    World *world = quotas->world;
+    int cols = world->config.cols;
+    int startQ1 = world->start[0], startQ2 = world->start[1];
+    Rng rng;
+    rngInit(&rng, world->seed, RNG_ROW | row);
+
+    // Generate starbases in the row
+    for (int i=0; i<quotas->starbases[row]; i++) {
+        while (1) {
+            // Make sure starbases don't spawn in the first quadrant's column
+            int q2 = startQ2;
+            while (q2 == startQ2) q2 = rngRange(&rng, 0, cols);
+            Quadrant *quad = getQuadrant(world, row, q2);
+            // Make sure the quadrant isn't full already
+            if (quad->numStarbases < MAX_QB){
+                quad->numStarbases++;
+                break;
+            }
+        }
+    }
+
+    // Generate klingons in the row
+    for (int i=0; i<quotas->klingons[row]; i++) {
+        while (1) {
+            int q2 = startQ2;
+            while (q2 == startQ2) q2 = rngRange(&rng, 0, cols);
+            Quadrant *quad = getQuadrant(world, row, q2);
+            // Make sure that the quadrant isn't full of klingons already & there isn't any starbases
+            if (quad->numKlingons < MAX_QK && !quad->numStarbases){
+                quad->numKlingons++;
+                break;
+            }
+        }
+    }
+
+    // Generate stars in the row
+    for (int i=0; i<quotas->stars[row]; i++){
+        while (1) {
+            int q2 = rngRange(&rng, 0, cols);
+            Quadrant *quad = getQuadrant(world, row, q2);
+            // Leave a free sector for everything, including the player's starting spot
+            int used = quad->numKlingons + quad->numStarbases + quad->numStars + (row == startQ1 && q2 == startQ2);
+            if (used < QS_SIZE*QS_SIZE){
+                quad->numStars++;
+                break;
+            }
+        }
+    }
+    TRACE_END(t, "generateRow");
+}
+
+// Sets up a new game in place. The buffers of the world's last game are reused if they're big
+// enough, so a recycled world doesn't go back to the allocator. Start from a zeroed World
+void worldInit(World *world, const WorldConfig *config){
+    int rows = config->rows, cols = config->cols;
+    int startQ1 = rows / 2, startQ2 = (cols / 2 + 1 < cols) ? cols / 2 + 1 : cols - 1;
+    size_t numQuads = (size_t) rows * cols;
+
+    // Buffers kept from the last game
+    if (world->tmpl) clearOverlay(world);
+    else freeMaps(world);
+    Quadrant *quadrant = world->quadrant;
+    uint16_t *archive = world->archive;
+    uint64_t *scanned = world->scanned;
+    int *sbDist = world->sbDist, *sbNearest = world->sbNearest, *maps = world->maps, capMaps = world->capMaps;
+    Event *events = world->events;
+    int capEvents = world->capEvents;
+    size_t capQuads = world->capQuads;
+    Overlay **overlay = world->overlay;
+    int capOverlay = world->capOverlay;
+    Tactics *tactics = world->tactics;
+    if (tactics) tactics->valid = false;
+
+    // Initialize World & Player
+    *world = (World) {
+            .config = *config,
+            .seed = config->seed ? config->seed : newSeed(),
+            .start = {startQ1, startQ2},
+            .date = START_DATE,
+            .daysRem = config->days,
+            .numKlingons = 0,
+            .numStarbases = 0,
+            .gen = {1, 1, 1, 1}, // Everything derived starts out stale
+            .gameOver = false,
+            .player = {
+                    .energy = config->energy,
+                    .shield = 0,
+                    .photon = PLAYER_TORPEDOES,
+                    .pos = {startQ1, startQ2, 3, 0}
+            },
+            .quadrant = quadrant,
+            .archive = archive,
+            .scanned = scanned,
+            .sbDist = sbDist,
+            .sbNearest = sbNearest,
+            .maps = maps,
+            .capMaps = capMaps,
+            .events = events,
+            .capEvents = capEvents,
+            .capQuads = capQuads,
+            .overlay = overlay,
+            .capOverlay = capOverlay,
+            .tactics = tactics
+    };
+    if (galaxyTemplate) {
+        templateWorld(world, galaxyTemplate);
+        return;
+    }
+
+    // Only the counts of every quadrant are decided here. Sector maps are built
+    // on first touch from the seed, see touchQuadrant()
+    if (numQuads > world->capQuads) {
+        free(world->quadrant);
+        free(world->archive);
+        free(world->scanned);
+        free(world->sbDist);
+        free(world->sbNearest);
+        world->quadrant = malloc(sizeof(Quadrant) * numQuads);
+        world->archive = malloc(sizeof(uint16_t) * numQuads);
+        world->scanned = malloc(sizeof(uint64_t) * ((numQuads + 63) / 64));
+        world->sbDist = malloc(sizeof(int) * numQuads);
+        world->sbNearest = malloc(sizeof(int) * numQuads);
+        world->capQuads = numQuads;
+    }
+    int *cap = calloc(rows, sizeof(int));
+    RowQuotas quotas = {world, malloc(sizeof(int) * rows), malloc(sizeof(int) * rows), malloc(sizeof(int) * rows)};
+    if (!world->quadrant || !world->archive || !world->scanned || !world->sbDist || !world->sbNearest || !cap
+        || !quotas.starbases || !quotas.klingons || !quotas.stars) {
+        fprintf(stderr, "NOT ENOUGH MEMORY FOR A %dx%d GALAXY\n", rows, cols);
+        exit(1);
+    }
+    memset(world->quadrant, 0, sizeof(Quadrant) * numQuads);
+    memset(world->archive, 0, sizeof(uint16_t) * numQuads);
+    memset(world->scanned, 0, sizeof(uint64_t) * ((numQuads + 63) / 64));
+
+    // Decide how many of each entity every row gets, so rows can then be filled independently.
+    // Starbases & all but the first klingon stay out of the starting row & column, and the
+    // klingon capacity assumes every starbase of the row takes a quadrant of its own
+    Rng rng;
+    rngInit(&rng, world->seed, RNG_QUOTAS);
+    for (int r=0; r<rows; r++) cap[r] = (r == startQ1) ? 0 : (cols - 1) * MAX_QB;
+    splitQuota(config->numStarbases, cap, quotas.starbases, rows, &rng);
+    for (int r=0; r<rows; r++) cap[r] = (r == startQ1) ? 0 : (cols - 1 - quotas.starbases[r]) * MAX_QK;
+    splitQuota(config->numKlingons > 0 ? config->numKlingons - 1 : 0, cap, quotas.klingons, rows, &rng);
+    for (int r=0; r<rows; r++) {
+        cap[r] = cols*QS_SIZE*QS_SIZE - quotas.starbases[r] - quotas.klingons[r] - (r == startQ1) * 2;
+    }
+    splitQuota(config->numStars, cap, quotas.stars, rows, &rng);
+
+    // Only Spawn 1 Klingon in The First Quadrant
+    if (config->numKlingons > 0) getQuadrant(world, startQ1, startQ2)->numKlingons = 1;
+
+    runTasks(generateRow, &quotas, rows, config->threads);
+    free(cap);
+    free(quotas.starbases);
+    free(quotas.klingons);
+    free(quotas.stars);
+
+    world->numKlingons = config->numKlingons;
+    world->numStarbases = config->numStarbases;
+    buildStarbaseField(world);
+    touchQuadrant(world, startQ1, startQ2);
+
+    // No klingon starts out with a starbase, see generateRow(). Raids start once -T moves them in
+    if (config->tick) scheduleEvent(world, eventTick, 0, 1);
+}
+
+// Times worldInit on one thread & on config->threads threads, and checks they agree
+void benchGeneration(const WorldConfig *config) {
+    WorldConfig single = *config, multi = *config;
+    if (!single.seed) single.seed = multi.seed = newSeed();
+    single.threads = 1;
+    int numQuads = config->rows * config->cols;
+
+    struct timespec t0, t1, t2;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    World a = {0}, b = {0};
+    worldInit(&a, &single);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    worldInit(&b, &multi);
+    clock_gettime(CLOCK_MONOTONIC, &t2);
+
+    bool same = true;
+    for (int q=0; q<numQuads && same; q++) {
+        same = a.quadrant[q].numKlingons == b.quadrant[q].numKlingons
+               && a.quadrant[q].numStarbases == b.quadrant[q].numStarbases
+               && a.quadrant[q].numStars == b.quadrant[q].numStars;
+    }
+    double one = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    double many = (t2.tv_sec - t1.tv_sec) + (t2.tv_nsec - t1.tv_nsec) / 1e9;
+    printf("GALAXY %dx%d, SEED %llu, %d CORES AVAILABLE\n", config->rows, config->cols, single.seed, numCores());
+    printf("  1 THREAD:    %.3lf S\n", one);
+    printf("  %d THREADS: %*.3lf S  (%.2lfX)\n", multi.threads, multi.threads < 10 ? 4 : 3, many, one / many);
+    printf("  RESULTS %s\n", same ? "IDENTICAL" : "DIFFER");
+    freeWorld(&a);
+    freeWorld(&b);
+}
+
+// Times TICK_BENCH galaxy ticks on 1 thread & on config->threads threads, and checks they agree
+void benchTick(const WorldConfig *config) {
+    WorldConfig single = *config, multi = *config;
+    if (!single.seed) single.seed = multi.seed = newSeed();
+    single.threads = 1;
+    int numQuads = config->rows * config->cols;
+    World a = {0}, b = {0};
+    worldInit(&a, &single);
+    worldInit(&b, &multi);
+
+    struct timespec t0, t1, t2;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int i=1; i<=TICK_BENCH; i++) {
+        a.clock = i;
+        galaxyTick(&a);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    for (int i=1; i<=TICK_BENCH; i++) {
+        b.clock = i;
+        galaxyTick(&b);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t2);
+
+    bool same = true;
+    for (int q=0; q<numQuads && same; q++) same = a.quadrant[q].numKlingons == b.quadrant[q].numKlingons;
+    double one = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    double many = (t2.tv_sec - t1.tv_sec) + (t2.tv_nsec - t1.tv_nsec) / 1e9;
+    printf("%d TICKS OF %d QUADRANTS (SHARDED OVER THREADS FROM %d QUADRANTS)\n", TICK_BENCH, numQuads, TICK_TASKS);
+    printf("  1 THREAD:    %.0lf TICKS/S, %.1lf NS PER QUADRANT\n", TICK_BENCH / one, one * 1e9 / TICK_BENCH / numQuads);
+    printf("  %d THREADS: %*.0lf TICKS/S, %.1lf NS PER QUADRANT  (%.2lfX)\n", multi.threads, multi.threads < 10 ? 4 : 3,
+           TICK_BENCH / many, many * 1e9 / TICK_BENCH / numQuads, one / many);
+    printf("  RESULTS %s\n", same ? "IDENTICAL" : "DIFFER");
+    freeWorld(&a);
+    freeWorld(&b);
+}
+
+// Plays one command: fight whatever is in the quadrant, otherwise head for the nearest klingons.
+// Ends the game if the ship is stranded
+void autopilot(World *world) {
+    double course, warpFactor;
+    if (autopilotFight(world)) return;
+    if (!autopilotCourse(world, &course, &warpFactor)) {
+        world->gameOver = true; // Nothing left to hunt
+        return;
+    }
+    double clock = world->clock;
+    SPAN(statNavigate, "navigate", navigate(world, course, warpFactor));
+    if (world->clock == clock) world->gameOver = true; // Not enough energy to move
+}
+
+// Fights whatever is in the ship's quadrant, if it's armed. False if there's nothing to fight
+bool autopilotFight(World *world) {
+    Player *pl = &world->player;
+    Quadrant *quad = getQuadrant(world, pl->pos[0], pl->pos[1]);
+    bool armed = (pl->photon > 0 && pl->damage[tor] >= 0) || (pl->energy > 0 && pl->damage[pha] >= 0);
+
+    if (quad->numKlingons > 0 && armed) {
+        if (pl->shield < 300 && pl->damage[she] >= 0 && pl->energy > 300 - pl->shield) {
+            SPAN(statShields, "setShields", setShields(world, 300));
+        } else if (pl->photon > 0 && pl->damage[tor] >= 0) {
+            Klingon *target = getNearbyEntity(world, 0, 'k');
+            double course, dist;
+            calcDirection(pl->pos[2], pl->pos[3], target->pos[2], target->pos[3], &course, &dist);
+            SPAN(statTorpedo, "fireTorpedo", fireTorpedo(world, course));
+        } else {
+            SPAN(statPhasers, "firePhasers", firePhasers(world, pl->energy < 400 ? pl->energy : 400));
+        }
+        return true;
+    }
+    return false;
+}
+
+// Picks a course & warp factor for the closest quadrant with klingons. False if there are none
+bool autopilotCourse(World *world, double *course, double *warpFactor) {
+    Player *pl = &world->player;
+
+    // Search rings of quadrants around the ship for the closest one with klingons
+    int rows = world->config.rows, cols = world->config.cols;
+    int maxRing = rows > cols ? rows : cols;
+    for (int ring=1; ring<maxRing; ring++) {
+        for (int d1=-ring; d1<=ring; d1++) {
+            for (int d2=-ring; d2<=ring; d2++) {
+                if (abs(d1) != ring && abs(d2) != ring) continue;
+                Quadrant *target = getQuadrant(world, pl->pos[0]+d1, pl->pos[1]+d2);
+                if (!target) continue;
+                // Other ships of a galaxy change its quadrants under their locks, so a ship reads the copies of the counts
+                int q = (pl->pos[0]+d1)*cols + pl->pos[1]+d2;
+                if (world->galaxy ? !atomic_load_explicit(&world->galaxy->klingons[q], memory_order_relaxed)
+                                  : !target->numKlingons) continue;
+
+                // Aim for the middle of the quadrant, see nearestStarbase() for the warp factor
+                int fromRow = pl->pos[0]*QS_SIZE + pl->pos[2], fromCol = pl->pos[1]*QS_SIZE + pl->pos[3];
+                int toRow = (pl->pos[0]+d1)*QS_SIZE + QS_SIZE/2, toCol = (pl->pos[1]+d2)*QS_SIZE + QS_SIZE/2;
+                double dist;
+                calcDirection(fromRow, fromCol, toRow, toCol, course, &dist);
+                int steps = abs(toRow - fromRow) > abs(toCol - fromCol) ? abs(toRow - fromRow) : abs(toCol - fromCol);
+                *warpFactor = (steps / QS_SIZE) + (steps % QS_SIZE) / 10.0;
+                if (*warpFactor > 8) *warpFactor = 8;
+                if (pl->damage[warp] < 0 && *warpFactor > 0.2) *warpFactor = 0.2;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Lets the autopilot play a game out, or maxTurns commands of it. Returns the commands played
+int autopilotGame(World *world, int maxTurns) {
+    int turn = 0;
+    if (trajectory) trajectory->step = 0;
+    while (!world->gameOver && world->daysRem > 0 && world->numKlingons > 0 && turn++ < maxTurns) {
+        int klingons = world->numKlingons;
+        cmdSRS(world); // Looks at the short range scan first, as a player would. It takes no time
+        if (trajectory) trajectoryObserve(world);
+        SPAN(statAutopilot, "TURN", autopilot(world));
+        if (trajectory) trajectoryStep(world, klingons - world->numKlingons);
+    }
+    if (trajectory && trajectory->rows && !trajectory->columns[trajDone][trajectory->rows - 1]) {
+        trajectory->columns[trajDone][trajectory->rows - 1] = 4; // Cut off
+    }
+    return turn;
+}
+
+// Simulator thread: plays games until sim->games have been handed out
+void *simulateWorker(void *arg) {
+    Simulation *sim = arg;
+    int maxTurns = 1000;
+    traceThreadName("SIM");
+    if (dataset) trajectory = trajectoryOpen();
+
+    while (atomic_fetch_add(&sim->next, 1) < sim->games) {
+        World *world = poolTake(&sim->pool);
+        seedDice(world->seed);
+        journalSeed(world);
+
+        int turn = autopilotGame(world, maxTurns);
+        journalEnd(world);
+        size_t bytes = worldBytes(world);
+
+        pthread_mutex_lock(&sim->lock);
+        sim->commands += turn;
+        sim->worldBytes += bytes;
+        if (bytes > sim->maxWorldBytes) sim->maxWorldBytes = bytes;
+        if (world->numKlingons == 0) sim->won++;
+        else if (world->player.shield < 0 || world->gameOver) sim->lost++;
+        else sim->outOfTime++;
+
+        Counters *counters = &sim->counters;
+        counters->entityScans += world->counters.entityScans;
+        counters->slotsScanned += world->counters.slotsScanned;
+        counters->slotsSaved += world->counters.slotsSaved;
+        counters->archiveScans += world->counters.archiveScans;
+        counters->archiveBytes += world->counters.archiveBytes;
+        counters->condSkipped += world->counters.condSkipped;
+        counters->boardSkipped += world->counters.boardSkipped;
+        counters->archiveSkipped += world->counters.archiveSkipped;
+        counters->events += world->counters.events;
+        pthread_mutex_unlock(&sim->lock);
+        poolRecycle(&sim->pool, world);
+        if (journal && journalFailed()) break; // The games after it couldn't be recovered
+    }
+    trajectoryClose(trajectory);
+    trajectory = NULL;
+    traceFlushThread();
+    return NULL;
+}
+
+// Lets the autopilot play opts->simGames games on config.threads threads (their threads have no
+// output, so the game's is dropped), then reports how they went & how much work the entity lookups did. Every game is decided
+// by its seed, so the totals don't depend on the thread count
+void simulateGames(const Options *opts) {
+    int threads = opts->config.threads;
+    Simulation sim = {.games = opts->simGames};
+    pthread_mutex_init(&sim.lock, NULL);
+
+    if (opts->datasetFile && !datasetOpen(opts->datasetFile)) {
+        fprintf(stderr, "CAN'T WRITE THE DATASET TO %s\n", opts->datasetFile);
+        exit(1);
+    }
+
+    // Galaxies are generated ahead while the autopilot plays
+    poolInit(&sim.pool, &opts->config, threads + 1, threads);
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    pthread_t workers[threads];
+    int started = 0;
+    for (int i=1; i<threads; i++) {
+        if (pthread_create(&workers[started], NULL, simulateWorker, &sim) == 0) started++;
+    }
+    simulateWorker(&sim);
+    for (int i=0; i<started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    poolClose(&sim.pool);
+    pthread_mutex_destroy(&sim.lock);
+
+    Counters counters = sim.counters;
+    long long commands = sim.commands;
+    double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    printf("%d GAMES ON A %dx%d GALAXY, %d THREADS, %lld COMMANDS IN %.3lf S (%.0lf COMMANDS/S)\n",
+           opts->simGames, opts->config.rows, opts->config.cols, threads, commands, secs, commands / secs);
+    printf("  WON %d, LOST %d, OUT OF TIME %d\n", sim.won, sim.lost, sim.outOfTime);
+    printf("  ENTITY LOOKUPS %llu, SLOTS SCANNED %llu, DEAD OR EMPTY SLOTS SKIPPED %llu\n",
+           counters.entityScans, counters.slotsScanned, counters.slotsSaved);
+    printf("  QUADRANTS ARCHIVED %llu, BYTES WRITTEN %llu (%llu COPYING WHOLE QUADRANTS)\n",
+           counters.archiveScans, counters.archiveBytes, counters.archiveScans * QUADRANT_COPY);
+    printf("  UNCHANGED, SO SKIPPED: %llu CONDITION UPDATES, %llu SRS REDRAWS, %llu ARCHIVE WRITES\n",
+           counters.condSkipped, counters.boardSkipped, counters.archiveSkipped);
+    printf("  EVENTS %llu (REPAIRS, RESUPPLIES & RAIDS)\n", counters.events);
+    printf("  GAME MEMORY %.0lf BYTES ON AVERAGE, %zu AT MOST\n", (double) sim.worldBytes / opts->simGames, sim.maxWorldBytes);
+    if (galaxyTemplate) {
+        printf("  TEMPLATE %s, %llu BYTES MAPPED ONCE & SHARED BY EVERY GAME\n", opts->templateFile,
+               (unsigned long long) galaxyTemplate->size);
+    }
+    if (dataset) {
+        long long rows = atomic_load(&dataset->rows), bytes = atomic_load(&dataset->end);
+        printf("  DATASET %lld ROWS IN %lld CHUNKS, %lld BYTES (%.1lf PER ROW, %lld RAW), %.3lf S SPENT WRITING\n", rows,
+               atomic_load(&dataset->chunks), bytes, rows ? (double) bytes / rows : 0.0, atomic_load(&dataset->rawBytes),
+               atomic_load(&dataset->writeNanos) / 1e9);
+        if (atomic_load(&dataset->error)) {
+            printf("  DATASET WRITE FAILED (%s), ROWS FROM THE LOST CHUNK ON DROPPED\n", strerror(atomic_load(&dataset->error)));
+        }
+        datasetClose();
+    }
+    if (journal) {
+        if (!journalWait(journal->appended)) printf("  JOURNAL FAILED (%s), GAMES STOPPED\n", strerror(journalFailed()));
+        printf("  JOURNALED %llu RECORDS IN %llu COMMITS (%.1lf PER COMMIT), %s\n", journal->records, journal->commits,
+               journal->commits ? (double) journal->records / journal->commits : 0.0,
+               journal->sync ? "EVERY COMMAND WAITING ON ITS COMMIT" : "COMMANDS NOT WAITING");
+    }
+}
+
+bool datasetOpen(const char *path) {
+    dataset = calloc(1, sizeof(Dataset));
+    if (!dataset) return false;
+    dataset->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (dataset->fd < 0) {
+        free(dataset);
+        dataset = NULL;
+        return false;
+    }
+    return true;
+}
+
+void datasetClose() {
+    close(dataset->fd);
+    free(dataset);
+    dataset = NULL;
+}
+
+// Column buffers for the calling thread, NULL if there's no memory for them
+Trajectory *trajectoryOpen() {
+    Trajectory *t = calloc(1, sizeof(Trajectory));
+    if (!t) return NULL;
+    size_t raw = 0;
+    for (int c=0; c<numTrajColumns; c++) {
+        t->columns[c] = malloc((size_t) trajWidth[c] * TRAJ_ROWS);
+        if (!t->columns[c]) {
+            trajectoryClose(t);
+            return NULL;
+        }
+        raw += ALIGN8((size_t) trajWidth[c] * TRAJ_ROWS);
+    }
+#ifdef ZLIB
+    t->outCap = compressBound(raw);
+    t->packed = malloc(raw);
+    t->out = malloc(t->outCap);
+    if (!t->packed || !t->out) {
+        trajectoryClose(t);
+        return NULL;
+    }
+#endif
+    (void) raw;
+    return t;
+}
+
+// Writes the rows left & frees the buffers
+void trajectoryClose(Trajectory *t) {
+    if (!t) return;
+    if (t->rows && t->columns[numTrajColumns - 1]) trajectoryWrite(t, t->rows);
+    for (int c=0; c<numTrajColumns; c++) free(t->columns[c]);
+    free(t->packed);
+    free(t->out);
+    free(t);
+}
+
+// Appends the first rows of the thread's columns to the dataset as a chunk. Its room in the file
+// is reserved up front, so threads write their chunks side by side without a lock
+void trajectoryWrite(Trajectory *t, int rows) {
+    if (atomic_load(&dataset->error)) return; // The reader stops at the lost chunk anyway
+    long long t0 = traceNow();
+    static const unsigned char zeros[8];
+    TrajChunk head = {.magic = TRAJ_MAGIC, .rows = (uint32_t) rows};
+    struct iovec iov[1 + 2 * numTrajColumns];
+    int n = 1;
+    for (int c=0; c<numTrajColumns; c++) {
+        size_t len = (size_t) trajWidth[c] * rows;
+        iov[n++] = (struct iovec) {t->columns[c], len};
+        if (ALIGN8(len) > len) iov[n++] = (struct iovec) {(void *) zeros, ALIGN8(len) - len};
+        head.raw += ALIGN8(len);
+    }
+    head.stored = head.raw;
+
+#ifdef ZLIB
+    unsigned char *at = t->packed;
+    for (int i=1; i<n; i++) {
+        memcpy(at, iov[i].iov_base, iov[i].iov_len);
+        at += iov[i].iov_len;
+    }
+    uLongf outLen = t->outCap;
+    if (compress2(t->out, &outLen, t->packed, head.raw, Z_BEST_SPEED) == Z_OK && ALIGN8(outLen) < head.raw) {
+        memset(t->out + outLen, 0, ALIGN8(outLen) - outLen);
+        head.stored = ALIGN8(outLen);
+        head.deflated = 1;
+        iov[1] = (struct iovec) {t->out, head.stored};
+        n = 2;
+    }
+#endif
+    iov[0] = (struct iovec) {&head, sizeof(head)};
+    long long off = atomic_fetch_add(&dataset->end, (long long) (sizeof(head) + head.stored));
+    for (int i=0; i<n;) {
+        ssize_t w = pwritev(dataset->fd, iov + i, n - i, off);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) {
+            atomic_store(&dataset->error, w < 0 ? errno : EIO);
+            return;
+        }
+        off += w;
+        for (; i < n && (size_t) w >= iov[i].iov_len; i++) w -= (ssize_t) iov[i].iov_len;
+        if (i < n) iov[i] = (struct iovec) {(char *) iov[i].iov_base + w, iov[i].iov_len - (size_t) w};
+    }
+
+    atomic_fetch_add(&dataset->rows, rows);
+    atomic_fetch_add(&dataset->chunks, 1);
+    atomic_fetch_add(&dataset->rawBytes, head.raw);
+    atomic_fetch_add(&dataset->writeNanos, traceNow() - t0);
+}
+
+// Starts a row with what the autopilot sees before its step. A full chunk goes out first
+void trajectoryObserve(World *world) {
+    Trajectory *t = trajectory;
+    if (t->rows == TRAJ_ROWS) {
+        trajectoryWrite(t, t->rows);
+        t->rows = 0;
+    }
+    int r = t->rows;
+    Player *pl = &world->player;
+    uint64_t seed = world->seed;
+    uint32_t step = (uint32_t) t->step++, klingons = (uint32_t) world->numKlingons;
+    uint16_t counts[9], pos[4] = {(uint16_t) pl->pos[0], (uint16_t) pl->pos[1], (uint16_t) pl->pos[2], (uint16_t) pl->pos[3]};
+    int32_t energy = pl->energy, shield = pl->shield;
+    uint8_t photon = (uint8_t) pl->photon, condition = (uint8_t) pl->condition, command = 0;
+    float damage[8], clock = (float) world->clock, args[2] = {0, 0};
+    for (int i=0; i<8; i++) damage[i] = (float) pl->damage[i];
+    for (int i=0; i<9; i++) {
+        Quadrant *quad = getQuadrant(world, pl->pos[0] + i / 3 - 1, pl->pos[1] + i % 3 - 1);
+        counts[i] = quad ? packCounts(quad) : 0xffff;
+    }
+    const void *values[numTrajColumns] = {&seed, &step, &energy, &shield, &photon, pos, &condition, damage, counts,
+                                          &klingons, &clock, &command, args, NULL, NULL};
+    for (int c=0; c<trajReward; c++) memcpy(t->columns[c] + (size_t) trajWidth[c] * r, values[c], trajWidth[c]);
+    t->rows++;
+}
+
+// The command the autopilot's step chose, from journalCommand()
+void trajectoryAction(int type, double a, double b) {
+    Trajectory *t = trajectory;
+    if (!t->rows) return;
+    int r = t->rows - 1;
+    float args[2] = {(float) a, (float) b};
+    t->columns[trajCommand][r] = (unsigned char) type;
+    memcpy(t->columns[trajArgs] + sizeof(args) * r, args, sizeof(args));
+}
+
+// Ends the row of the step: its reward & whether it ended the game
+void trajectoryStep(World *world, int destroyed) {
+    Trajectory *t = trajectory;
+    int r = t->rows - 1;
+    float reward = (float) destroyed;
+    uint8_t done = world->numKlingons == 0 ? 1 : (world->player.shield < 0 || world->gameOver) ? 2
+                   : world->daysRem <= 0 ? 3 : 0;
+    memcpy(t->columns[trajReward] + sizeof(reward) * r, &reward, sizeof(reward));
+    t->columns[trajDone][r] = done;
+}
+
+// Maps a trajectory dataset & sums it up: games & how they ended, the commands chosen, the
+// reward. Raw chunks' columns are used where they lie in the mapping, deflated ones are inflated
+bool readDataset(const char *path) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "CAN'T READ THE DATASET %s\n", path);
+        return false;
+    }
+    size_t size = (size_t) st.st_size;
+    const unsigned char *data = size ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "CAN'T MAP THE DATASET %s\n", path);
+        return false;
+    }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    long long rows = 0, chunks = 0, deflated = 0, ends[5] = {0}, commands[journalLRS + 1] = {0};
+    double reward = 0, energy = 0;
+    unsigned char *inflated = NULL;
+    size_t off = 0;
+    bool ok = true;
+    while (ok && off + sizeof(TrajChunk) <= size) {
+        TrajChunk head;
+        memcpy(&head, data + off, sizeof(head));
+        if (head.magic != TRAJ_MAGIC || head.stored > size - off - sizeof(head) || head.rows > TRAJ_ROWS) break;
+        const unsigned char *columns = data + off + sizeof(head);
+        if (head.deflated) {
+#ifdef ZLIB
+            uLongf len = head.raw;
+            unsigned char *buf = realloc(inflated, head.raw);
+            ok = buf && uncompress(buf, &len, columns, head.stored) == Z_OK && len == head.raw;
+            inflated = buf;
+            columns = inflated;
+            deflated++;
+#else
+            fprintf(stderr, "DEFLATED CHUNKS NEED A -DZLIB BUILD\n"); // Not torn, so no summary that says so
+            munmap((void *) data, size);
+            return false;
+#endif
+            if (!ok) break;
+        }
+
+        const unsigned char *column[numTrajColumns];
+        for (int c=0; c<numTrajColumns; c++) {
+            column[c] = columns;
+            columns += ALIGN8((size_t) trajWidth[c] * head.rows);
+        }
+        const int32_t *energies = (const int32_t *) column[trajEnergy];
+        const float *rewards = (const float *) column[trajReward];
+        for (uint32_t r=0; r<head.rows; r++) {
+            if (column[trajDone][r] < 5) ends[column[trajDone][r]]++;
+            if (column[trajCommand][r] <= journalLRS) commands[column[trajCommand][r]]++;
+            reward += rewards[r];
+            energy += energies[r];
+        }
+        rows += head.rows;
+        chunks++;
+        off += sizeof(head) + head.stored;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+    printf("DATASET %s: %lld CHUNKS (%lld DEFLATED), %lld ROWS, %zu BYTES, %zu TORN BYTES DROPPED\n", path, chunks,
+           deflated, rows, off, size - off);
+    printf("  GAMES %lld: WON %lld, LOST %lld, OUT OF TIME %lld, CUT OFF %lld\n", ends[1] + ends[2] + ends[3] + ends[4],
+           ends[1], ends[2], ends[3], ends[4]);
+    printf("  COMMANDS: NAV %lld, PHA %lld, TOR %lld, SHE %lld\n", commands[journalNAV], commands[journalPHA],
+           commands[journalTOR], commands[journalSHE]);
+    printf("  REWARD %.0lf (KLINGONS DESTROYED), MEAN ENERGY %.1lf\n", reward, rows ? energy / rows : 0.0);
+    printf("  READ IN %.3lf S (%.0lf ROWS/S)\n", secs, secs > 0 ? rows / secs : 0.0);
+    free(inflated);
+    if (data) munmap((void *) data, size);
+    return ok;
+}
+
+// Make sure every entity fits, so the random placement in worldInit always finishes.
+// Starbases & all but the first klingon stay out of the starting row & column
+bool configValid(const WorldConfig *config) {
+    long quads = (long) config->rows * config->cols;
+    long open = (long) (config->rows - 1) * (config->cols - 1);
+    return config->rows >= 2 && config->cols >= 2 && config->numStarbases >= 0 && config->numKlingons >= 0
+           && config->numStars >= 0 && config->numStarbases <= open
+           && config->numKlingons <= 1 + MAX_QK * (open - config->numStarbases)
+           && config->numStars <= quads * QS_SIZE * QS_SIZE / 2 && config->days >= 1 && config->threads >= 1
+           && config->energy >= 1 && config->fire >= 0 && config->phasers >= 0;
+}
+
+// Half the width of the 95% Wilson score interval of a win rate. Unlike the normal
+// approximation it stays honest for the rates near 0 the autopilot mostly plays at
+double wilsonHalfWidth(int wins, int games) {
+    double z = 1.96, p = (double) wins / games, n = games;
+    return z * sqrt(p * (1 - p) / n + z * z / (4 * n * n)) / (1 + z * z / n);
+}
+
+// Sweep task: plays one game of the batch
+void sweepGame(void *ctx, int task) {
+    Sweep *sweep = ctx;
+    SweepCell *cell = &sweep->cells[sweep->batch[task / sweep->batchGames]];
+    WorldConfig config = cell->config;
+    config.seed = sweep->seed + cell->games + task % sweep->batchGames;
+    config.threads = 1;
+
+    World world = {0};
+    worldInit(&world, &config);
+    seedDice(world.seed);
+    int turns = autopilotGame(&world, 1000);
+    if (world.numKlingons == 0) atomic_fetch_add(&cell->won, 1);
+    else if (world.player.shield < 0 || world.gameOver) atomic_fetch_add(&cell->lost, 1);
+    else atomic_fetch_add(&cell->outOfTime, 1);
+    atomic_fetch_add(&cell->commands, turns);
+    freeWorld(&world);
+}
+
+// Lets the autopilot play every cell of a parameter grid, GRID being NAME=FROM:TO:STEP (or just
+// NAME=VALUE) for up to SWEEP_AXES of klingons, starbases, stars, days, energy, fire & phasers,
+// joined by commas; the other parameters come from the options. Open cells play SWEEP_BATCH
+// games at a time in parallel, & a cell closes once its win rate is known to SWEEP_CI or it has
+// played -S games (1000 without). Batches end before cells are checked, so the results don't
+// depend on the thread count
+bool sweepParameters(const Options *opts) {
+    static const struct {const char *name; size_t offset;} params[] = {
+            {"klingons", offsetof(WorldConfig, numKlingons)}, {"starbases", offsetof(WorldConfig, numStarbases)},
+            {"stars", offsetof(WorldConfig, numStars)}, {"days", offsetof(WorldConfig, days)},
+            {"energy", offsetof(WorldConfig, energy)}, {"fire", offsetof(WorldConfig, fire)},
+            {"phasers", offsetof(WorldConfig, phasers)}
+    };
+    int numParams = sizeof(params) / sizeof(params[0]);
+    int axis[SWEEP_AXES], from[SWEEP_AXES], to[SWEEP_AXES], step[SWEEP_AXES], size[SWEEP_AXES], numAxes = 0;
+    int maxGames = opts->simGames ? opts->simGames : 1000;
+
+    // Parse the grid
+    long numCells = 1;
+    bool ok = true;
+    for (const char *at = opts->sweep; ok && *at; ) {
+        char name[16];
+        int a = numAxes, n = 0, p = 0;
+        ok = numAxes < SWEEP_AXES && sscanf(at, "%15[a-z]=%n", name, &n) == 1 && n;
+        while (ok && p < numParams && strcmp(params[p].name, name)) p++;
+        ok = ok && p < numParams;
+        if (!ok) break;
+        at += n;
+        axis[a] = p;
+        step[a] = 1;
+        if (sscanf(at, "%d:%d:%d%n", &from[a], &to[a], &step[a], &n) != 3) {
+            ok = sscanf(at, "%d%n", &from[a], &n) == 1;
+            to[a] = from[a];
+        }
+        ok = ok && step[a] >= 1 && to[a] >= from[a] && (at[n] == ',' || !at[n]);
+        at += n + (at[n] == ',');
+        size[a] = ok ? (to[a] - from[a]) / step[a] + 1 : 1;
+        numCells *= size[a];
+        numAxes++;
+    }
+    if (!ok || !numAxes || numCells > 100000) {
+        fprintf(stderr, "INVALID SWEEP, E.G. -P klingons=10:40:10,energy=2000:4000:500\n");
+        return false;
+    }
+
+    Sweep sweep = {.cells = calloc(numCells, sizeof(SweepCell)), .numCells = (int) numCells,
+                   .batch = malloc(sizeof(int) * numCells)};
+    if (!sweep.cells || !sweep.batch) {
+        fprintf(stderr, "NOT ENOUGH MEMORY FOR %ld CELLS\n", numCells);
+        return false;
+    }
+    sweep.seed = opts->config.seed ? opts->config.seed : newSeed();
+    for (int c=0; c<sweep.numCells; c++) {
+        SweepCell *cell = &sweep.cells[c];
+        cell->config = opts->config;
+        for (int a=numAxes-1, i=c; a>=0; i/=size[a], a--) {
+            *(int *) ((char *) &cell->config + params[axis[a]].offset) = from[a] + i % size[a] * step[a];
+        }
+        if (!configValid(&cell->config)) {
+            fprintf(stderr, "INVALID GALAXY CONFIGURATION IN CELL %d OF THE SWEEP\n", c + 1);
+            return false;
+        }
+        cell->open = true;
+    }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    long long played = 0;
+    for (int games=0; games<maxGames; games+=sweep.batchGames) {
+        sweep.numBatch = 0;
+        for (int c=0; c<sweep.numCells; c++) {
+            if (sweep.cells[c].open) sweep.batch[sweep.numBatch++] = c;
+        }
+        if (!sweep.numBatch) break;
+        sweep.batchGames = maxGames - games < SWEEP_BATCH ? maxGames - games : SWEEP_BATCH;
+        runTasks(sweepGame, &sweep, sweep.numBatch * sweep.batchGames, opts->config.threads);
+        played += (long long) sweep.numBatch * sweep.batchGames;
+
+        for (int b=0; b<sweep.numBatch; b++) {
+            SweepCell *cell = &sweep.cells[sweep.batch[b]];
+            cell->games += sweep.batchGames;
+            if (wilsonHalfWidth(atomic_load(&cell->won), cell->games) <= SWEEP_CI) cell->open = false;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+    for (int a=0; a<numAxes; a++) printf("%9s ", params[axis[a]].name);
+    printf("%6s %8s %7s %7s %8s %9s\n", "GAMES", "WON %", "+-", "LOST %", "TIME %", "CMDS/GAME");
+    for (int c=0; c<sweep.numCells; c++) {
+        SweepCell *cell = &sweep.cells[c];
+        for (int a=0; a<numAxes; a++) printf("%9d ", *(int *) ((char *) &cell->config + params[axis[a]].offset));
+        int won = atomic_load(&cell->won), n = cell->games;
+        printf("%6d %8.2lf %7.2lf %7.2lf %8.2lf %9.1lf\n", n, 100.0 * won / n, 100 * wilsonHalfWidth(won, n),
+               100.0 * atomic_load(&cell->lost) / n, 100.0 * atomic_load(&cell->outOfTime) / n,
+               (double) atomic_load(&cell->commands) / n);
+    }
+    long long fixed = (long long) maxGames * sweep.numCells;
+    printf("%d CELLS, %lld GAMES IN %.3lf S ON %d THREADS (%.0lf GAMES/S), %lld FOR %d GAMES A CELL (%.1lf%% SAVED)\n",
+           sweep.numCells, played, secs, opts->config.threads, played / secs, fixed, maxGames,
+           100.0 * (fixed - played) / fixed);
+    free(sweep.cells);
+    free(sweep.batch);
+    return true;
+}
+
+// Locks the quadrants of a rectangle (clipped to the galaxy) in index order, so ships locking
+// overlapping rectangles can't deadlock
+void lockQuadrants(Galaxy *g, int top, int left, int bottom, int right) {
+    int rows = g->world.config.rows, cols = g->world.config.cols;
+    int taken = 0, waited = 0;
+    for (int q1=top>0 ? top : 0; q1<=bottom && q1<rows; q1++) {
+        for (int q2=left>0 ? left : 0; q2<=right && q2<cols; q2++) {
+            pthread_mutex_t *lock = &g->locks[q1*cols + q2];
+            if (pthread_mutex_trylock(lock)) {
+                waited++;
+                pthread_mutex_lock(lock);
+            }
+            atomic_store_explicit(&g->holders[q1*cols + q2], shipThread, memory_order_relaxed);
+            taken++;
+        }
+    }
+    atomic_fetch_add_explicit(&g->locked, taken, memory_order_relaxed);
+    if (waited) atomic_fetch_add_explicit(&g->contended, waited, memory_order_relaxed);
+}
+
+void unlockQuadrants(Galaxy *g, int top, int left, int bottom, int right) {
+    int rows = g->world.config.rows, cols = g->world.config.cols;
+    for (int q1=top>0 ? top : 0; q1<=bottom && q1<rows; q1++) {
+        for (int q2=left>0 ? left : 0; q2<=right && q2<cols; q2++) {
+            atomic_store_explicit(&g->holders[q1*cols + q2], 0, memory_order_relaxed);
+            pthread_mutex_unlock(&g->locks[q1*cols + q2]);
+        }
+    }
+}
+
+// Plays one autopilot command for a ship of the galaxy. Fighting only touches the ship's own
+// quadrant, a move locks the quadrants its course crosses, see navTrack(). Picking a course
+// reads the galaxy's copies of the counts of other quadrants: a stale one only sends the ship
+// somewhere just cleared
+void shipTurn(Galaxy *g, World *ship) {
+    Player *pl = &ship->player;
+    int q1 = pl->pos[0], q2 = pl->pos[1];
+    double course, warpFactor;
+    ship->numKlingons = atomic_load(&g->numKlingons);
+    ship->gen.quadrants++; // Other ships may have changed anything since this ship's last turn
+
+    lockQuadrants(g, q1, q2, q1, q2);
+    bool move = false;
+    if (!autopilotFight(ship)) {
+        move = autopilotCourse(ship, &course, &warpFactor);
+        if (!move) ship->gameOver = true; // Nothing left to hunt
+    }
+    if (ship->gameOver) touchQuadrant(ship, q1, q2)->sector[pl->pos[2]][pl->pos[3]] = ' ';
+    unlockQuadrants(g, q1, q2, q1, q2);
+    if (!move) return;
+
+    // The quadrants the move can touch: its course run as if the way were clear, which only
+    // needs the ship's own position. Anything in the way only stops it short of the last ones
+    Track clear;
+    navTrack(ship, course, warpFactor, true, &clear);
+    int top = q1, left = q2, bottom = q1, right = q2;
+    for (int i=0; i<clear.length; i++) {
+        if (clear.path[i][0] < top) top = clear.path[i][0];
+        if (clear.path[i][0] > bottom) bottom = clear.path[i][0];
+        if (clear.path[i][1] < left) left = clear.path[i][1];
+        if (clear.path[i][1] > right) right = clear.path[i][1];
+    }
+
+    lockQuadrants(g, top, left, bottom, right);
+    double clock = ship->clock;
+    SPAN(statNavigate, "navigate", navigate(ship, course, warpFactor));
+    if (ship->clock == clock) ship->gameOver = true; // Not enough energy to move
+    if (ship->gameOver) touchQuadrant(ship, pl->pos[0], pl->pos[1])->sector[pl->pos[2]][pl->pos[3]] = ' ';
+    unlockQuadrants(g, top, left, bottom, right);
+}
+
+// Galaxy thread: takes the next thread number t & plays ships t, t+threads, ... a turn each at
+// a time until they're all done
+void *shipWorker(void *arg) {
+    Galaxy *g = arg;
+    int t = atomic_fetch_add(&g->nextThread, 1), maxTurns = 1000;
+    if (t >= g->threads) return NULL;
+    traceThreadName("SHIP");
+    seedDice(g->world.seed + t);
+    shipThread = t + 1;
+
+    int numShips = (g->numShips - t + g->threads - 1) / g->threads;
+    int *turns = calloc(numShips, sizeof(int));
+    if (!turns) return NULL;
+    for (int playing=numShips; playing>0;) {
+        playing = 0;
+        for (int i=0; i<numShips; i++) {
+            World *ship = &g->ships[t + i * g->threads];
+            if (ship->gameOver || ship->daysRem <= 0 || atomic_load(&g->numKlingons) <= 0 || turns[i] >= maxTurns) {
+                continue;
+            }
+            turns[i]++;
+            SPAN(statAutopilot, "TURN", shipTurn(g, ship));
+            playing++;
+        }
+    }
+
+    pthread_mutex_lock(&g->lock);
+    for (int i=0; i<numShips; i++) {
+        World *ship = &g->ships[t + i * g->threads];
+        g->commands += turns[i];
+        if (atomic_load(&g->numKlingons) == 0 && ship->player.shield >= 0) g->won++;
+        else if (ship->player.shield < 0 || ship->gameOver) g->lost++;
+        else g->outOfTime++;
+
+        Counters *counters = &g->counters;
+        counters->entityScans += ship->counters.entityScans;
+        counters->slotsScanned += ship->counters.slotsScanned;
+        counters->slotsSaved += ship->counters.slotsSaved;
+        counters->archiveScans += ship->counters.archiveScans;
+        counters->archiveBytes += ship->counters.archiveBytes;
+        counters->events += ship->counters.events;
+    }
+    pthread_mutex_unlock(&g->lock);
+    shipThread = 0;
+    free(turns);
+    traceFlushThread();
+    return NULL;
+}
+
+// Generates one galaxy, spreads opts->ships autopilot ships over it & has them play it out
+// together on config.threads threads, then reports
+void playGalaxy(const Options *opts) {
+    int numShips = opts->ships, cols = opts->config.cols;
+    int numQuads = opts->config.rows * cols;
+    Galaxy *g = calloc(1, sizeof(Galaxy));
+    if (g) g->locks = malloc(sizeof(pthread_mutex_t) * numQuads);
+    if (g) g->holders = calloc(numQuads, sizeof(atomic_int));
+    if (g) g->klingons = calloc(numQuads, sizeof(atomic_int));
+    if (g) g->ships = calloc(numShips, sizeof(World));
+    if (!g || !g->locks || !g->holders || !g->klingons || !g->ships) {
+        fprintf(stderr, "NOT ENOUGH MEMORY FOR %d SHIPS\n", numShips);
+        exit(1);
+    }
+    worldInit(&g->world, &opts->config);
+    for (int q=0; q<numQuads; q++) {
+        pthread_mutex_init(&g->locks[q], NULL);
+        atomic_init(&g->klingons[q], quadrantAt(&g->world, q)->numKlingons);
+    }
+    pthread_mutex_init(&g->mapsLock, NULL);
+    pthread_mutex_init(&g->fieldLock, NULL);
+    pthread_mutex_init(&g->lock, NULL);
+    atomic_init(&g->numKlingons, g->world.numKlingons);
+    g->numShips = numShips;
+    g->threads = opts->config.threads < numShips ? opts->config.threads : numShips;
+
+    // Ship i starts in the first free sector of the i'th of numShips evenly spaced quadrants
+    for (int i=0; i<numShips; i++) {
+        World *ship = &g->ships[i];
+        *ship = g->world;
+        ship->galaxy = g;
+        ship->maps = NULL;
+        ship->numMaps = ship->capMaps = 0;
+        ship->events = NULL;
+        ship->numEvents = ship->capEvents = 0; // No one ship owns the raids, so they're left out
+        ship->archive = calloc(numQuads, sizeof(uint16_t));
+        ship->scanned = calloc((numQuads + 63) / 64, sizeof(uint64_t));
+        if (!ship->archive || !ship->scanned) {
+            fprintf(stderr, "NOT ENOUGH MEMORY FOR %d SHIPS\n", numShips);
+            exit(1);
+        }
+        int q = (int) ((long long) i * numQuads / numShips), s = QS_SIZE * QS_SIZE;
+        SectorMap *map;
+        for (q--; s == QS_SIZE * QS_SIZE; ) { // Full quadrants pass the ship on to the next
+            q = (q + 1) % numQuads;
+            map = touchQuadrant(ship, q / cols, q % cols);
+            for (s=0; s<QS_SIZE*QS_SIZE && map->sector[s / QS_SIZE][s % QS_SIZE] != ' '; s++);
+        }
+        map->sector[s / QS_SIZE][s % QS_SIZE] = 'E';
+        map->mutated = true;
+        ship->player.pos[0] = q / cols;
+        ship->player.pos[1] = q % cols;
+        ship->player.pos[2] = s / QS_SIZE;
+        ship->player.pos[3] = s % QS_SIZE;
+    }
+
+    // Thread numbers that fail to start are played on this thread afterwards
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    pthread_t workers[g->threads];
+    int started = 0;
+    for (int i=1; i<g->threads; i++) {
+        if (pthread_create(&workers[started], NULL, shipWorker, g) == 0) started++;
+    }
+    do shipWorker(g); while (atomic_load(&g->nextThread) < g->threads);
+    for (int i=0; i<started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    long long locked = atomic_load(&g->locked), contended = atomic_load(&g->contended);
+    printf("%d SHIPS ON A %dx%d GALAXY, %d THREADS, %lld COMMANDS IN %.3lf S (%.0lf COMMANDS/S)\n",
+           numShips, opts->config.rows, cols, g->threads, g->commands, secs, g->commands / secs);
+    printf("  WON %d, LOST %d, OUT OF TIME %d, %d OF %d KLINGONS LEFT\n", g->won, g->lost, g->outOfTime,
+           atomic_load(&g->numKlingons), opts->config.numKlingons);
+    printf("  QUADRANT LOCKS %lld (%.1lf PER COMMAND), %lld HAD TO WAIT (%.2lf%%)\n", locked,
+           g->commands ? (double) locked / g->commands : 0.0, contended, locked ? 100.0 * contended / locked : 0.0);
+    printf("  SECTOR MAPS TOUCHED WITHOUT THEIR QUADRANT'S LOCK %lld\n", atomic_load(&g->unlocked));
+    printf("  ENTITY LOOKUPS %llu, SLOTS SCANNED %llu, EVENTS %llu\n", g->counters.entityScans,
+           g->counters.slotsScanned, g->counters.events);
+
+    for (int i=0; i<numShips; i++) {
+        free(g->ships[i].archive);
+        free(g->ships[i].scanned);
+        free(g->ships[i].events);
+    }
+    for (int q=0; q<numQuads; q++) pthread_mutex_destroy(&g->locks[q]);
+    pthread_mutex_destroy(&g->mapsLock);
+    pthread_mutex_destroy(&g->fieldLock);
+    pthread_mutex_destroy(&g->lock);
+    freeWorld(&g->world);
+    free(g->ships);
+    free(g->locks);
+    free(g->holders);
+    free(g->klingons);
+    free(g);
+}
+
+// Appends to the n chars in buf. Returns the new length, which stays below cap however much is cut
+int appendf(char *buf, size_t cap, int n, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int m = vsnprintf(buf + n, cap - n, format, args);
+    va_end(args);
+    return m < 0 ? n : n + m < (int) cap ? n + m : (int) cap - 1;
+}
+
+// Writes a line protocol line: code, extra (if any), then what the ship can see. That's the
+// ship's state, the short range scan as 64 sectors row by row ('.' for empty space) & the long
+// range scan's KLINGONS:STARBASES:STARS for the 3x3 quadrants around it ("***" beyond the
+// galaxy), or "-" for a scan or damage report whose device is out, as the player would be told.
+// Returns its length
+int protocolObserve(World *world, const char *code, const char *extra, char *buf, size_t cap) {
+    Player *pl = &world->player;
+    int q1 = pl->pos[0], q2 = pl->pos[1];
+    updateCond(world);
+    const char *cond = pl->condition == docked ? "DOCKED" : pl->condition == red ? "RED"
+                       : pl->condition == yellow ? "YELLOW" : "GREEN";
+    int n = appendf(buf, cap, 0, "%s%s%s date=%.1lf days=%d klingons=%d starbases=%d energy=%d shield=%d torpedoes=%d"
+                    " quadrant=%d,%d sector=%d,%d condition=%s", code, *extra ? " " : "", extra,
+                    START_DATE + world->clock, world->daysRem, world->numKlingons, world->numStarbases, pl->energy,
+                    pl->shield, pl->photon, q1+1, q2+1, pl->pos[2]+1, pl->pos[3]+1, cond);
+
+    n = appendf(buf, cap, n, " damage=");
+    for (int i=0; i<8 && pl->damage[libComp] >= 0; i++) {
+        n = appendf(buf, cap, n, "%s%.2lf", i ? "," : "", pl->damage[i]);
+    }
+    if (pl->damage[libComp] < 0) n = appendf(buf, cap, n, "-");
+
+    n = appendf(buf, cap, n, " srs=");
+    if (pl->damage[srs] < 0) {
+        n = appendf(buf, cap, n, "-");
+    } else {
+        SectorMap *map = touchQuadrant(world, q1, q2);
+        for (int s=0; s<QS_SIZE*QS_SIZE && n+1 < (int) cap; s++) {
+            char c = map->sector[s / QS_SIZE][s % QS_SIZE];
+            if (s / QS_SIZE == pl->pos[2] && s % QS_SIZE == pl->pos[3]) c = 'E';
+            buf[n++] = c == ' ' ? '.' : c;
+        }
+        buf[n] = '\0';
+    }
+
+    n = appendf(buf, cap, n, " lrs=");
+    for (int i=0; i<9 && pl->damage[lrs] >= 0; i++) {
+        Quadrant *quad = getQuadrant(world, q1 - 1 + i / 3, q2 - 1 + i % 3);
+        if (quad) n = appendf(buf, cap, n, "%s%d:%d:%d", i ? "," : "", quad->numKlingons, quad->numStarbases, quad->numStars);
+        else n = appendf(buf, cap, n, "%s***", i ? "," : "");
+    }
+    if (pl->damage[lrs] < 0) n = appendf(buf, cap, n, "-");
+    n = appendf(buf, cap, n, "\n");
+    buf[n - 1] = '\n'; // A line cut short still ends
+    return n;
+}
+
+// The line protocol's result code for a preview's reason to turn a command down
+const char *protocolRefusal(const char *refused) {
+    static const char *const codes[][2] = {
+            {"INCORRECT COURSE DATA", "COURSE"},
+            {"THE ENGINES WON'T TAKE IT", "WARP"},
+            {"WARP ENGINES ARE DAMAGED", "DAMAGED"},
+            {"INSUFFICIENT ENERGY", "ENERGY"},
+            {"ALL PHOTON TORPEDOES EXPENDED", "EXPENDED"},
+            {"PHOTON TUBES ARE NOT OPERATIONAL", "DAMAGED"}
+    };
+    for (size_t i=0; i<sizeof(codes) / sizeof(codes[0]); i++) {
+        if (!strcmp(refused, codes[i][0])) return codes[i][1];
+    }
+    return "ERROR";
+}
+
+// Plays one line protocol command: NAV COURSE WARP, PHA UNITS, TOR COURSE, SHE UNITS or XXX, or
+// PRE NAV COURSE WARP / PRE TOR COURSE, which don't take the turn & put where the track stops,
+// the cost & the klingon fire to expect in extra. Returns the result code: OK, ERROR for a line
+// that isn't a command, or why the command was turned down, in which case nothing happened
+const char *protocolCommand(World *world, const char *line, char *extra, size_t cap) {
+    Player *pl = &world->player;
+    Quadrant *quad = getQuadrant(world, pl->pos[0], pl->pos[1]);
+    char cmd[4] = "", what[4] = "";
+    double a = 0, b = 0;
+    int args = sscanf(line, "%3s %lf %lf", cmd, &a, &b);
+    for (int i=0; cmd[i]; i++) cmd[i] = (char) toupper(cmd[i]);
+    extra[0] = '\0';
+    Preview preview;
+
+    if (!strcmp(cmd, "NAV") && args == 3) {
+        previewNav(world, a, b, &preview);
+        if (preview.refused) return protocolRefusal(preview.refused);
+        SPAN(statNavigate, "navigate", navigate(world, a, b));
+
+    } else if (!strcmp(cmd, "TOR") && args == 2) {
+        previewTor(world, a, &preview);
+        if (preview.refused) return protocolRefusal(preview.refused);
+        SPAN(statTorpedo, "fireTorpedo", fireTorpedo(world, a));
+
+    } else if (!strcmp(cmd, "PHA") && args == 2) {
+        if (pl->damage[pha] < 0) return "DAMAGED";
+        if (quad->numKlingons <= 0) return "NOTARGET";
+        if (a < 1 || a > pl->energy) return "ENERGY";
+        SPAN(statPhasers, "firePhasers", firePhasers(world, (int) a));
+
+    } else if (!strcmp(cmd, "SHE") && args == 2) {
+        if (pl->damage[she] < 0) return "DAMAGED";
+        if ((int) a == pl->shield || a < 1) return "UNCHANGED";
+        if (a > pl->energy + pl->shield) return "ENERGY";
+        SPAN(statShields, "setShields", setShields(world, (int) a));
+
+    } else if (!strcmp(cmd, "XXX") && args == 1) {
+        cmdXXX(world);
+
+    } else if (!strcmp(cmd, "PRE")) {
+        args = sscanf(line, "%*s %3s %lf %lf", what, &a, &b);
+        for (int i=0; what[i]; i++) what[i] = (char) toupper(what[i]);
+        if (!strcmp(what, "NAV") && args == 3) previewNav(world, a, b, &preview);
+        else if (!strcmp(what, "TOR") && args == 2) previewTor(world, a, &preview);
+        else return "ERROR";
+        if (preview.refused) return protocolRefusal(preview.refused);
+        Track *track = &preview.track;
+        snprintf(extra, cap, "stop=%c at=%d,%d,%d,%d cost=%d,%d,%.1lf fire=%.0lf,%.0lf docks=%d",
+                 track->stop == ' ' ? '-' : track->stop, track->pos[0]+1, track->pos[1]+1, track->pos[2]+1,
+                 track->pos[3]+1, preview.energy, preview.torpedoes, preview.days, preview.fire, preview.maxFire,
+                 preview.docks);
+
+    } else {
+        return "ERROR";
+    }
+    return "OK";
+}
+
+// How a line protocol game ended, NULL while it's still on. Games cut off after PROTOCOL_MOVES
+// commands count as out of time, as the simulator's do
+const char *protocolOutcome(World *world, int moves) {
+    if (world->numKlingons == 0) return "WON";
+    if (world->player.shield < 0 || world->gameOver) return "LOST";
+    if (world->daysRem <= 0 || moves >= PROTOCOL_MOVES) return "TIME";
+    return NULL;
+}
+
+// -L: plays over the line protocol on stdin & stdout, one line each way a command, until stdin
+// closes. A game opens with START & the first observation & closes with END & its outcome (WON,
+// LOST or TIME), then the next one starts, its seed following on as the player's games' do
+void playProtocol(const Options *opts) {
+    traceThreadName("GAME");
+    WorldPool pool;
+    poolInit(&pool, &opts->config, POOL_PREFETCH, 1);
+    char line[PROTOCOL_LINE], reply[PROTOCOL_LINE], extra[PROTOCOL_LINE];
+
+    for (bool playing=true; playing; ) {
+        World *world = poolTake(&pool);
+        seedDice(world->seed);
+        journalSeed(world);
+        protocolObserve(world, "START", "", reply, sizeof(reply));
+        fputs(reply, stdout);
+        fflush(stdout);
+
+        const char *outcome = NULL;
+        for (int moves=1; !outcome; moves++) {
+            if (!fgets(line, sizeof(line), stdin)) {
+                playing = false;
+                break;
+            }
+            const char *code = protocolCommand(world, line, extra, sizeof(extra));
+            outcome = protocolOutcome(world, moves);
+            if (outcome) protocolObserve(world, "END", outcome, reply, sizeof(reply));
+            else protocolObserve(world, code, extra, reply, sizeof(reply));
+            fputs(reply, stdout);
+            fflush(stdout);
+        }
+        journalEnd(world);
+        poolRecycle(&pool, world);
+    }
+    poolClose(&pool);
+}
+
+long long monotonicNanos() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+// Runs the bot's command through /bin/sh with its stdin & stdout on pipes of the harness's. The
+// harness's ends are close-on-exec, so a bot only holds its own & sees EOF when the harness closes
+bool startBot(Bot *bot) {
+    int toBot[2], fromBot[2];
+    if (pipe(toBot)) return false;
+    if (pipe(fromBot)) {
+        close(toBot[0]);
+        close(toBot[1]);
+        return false;
+    }
+    fcntl(toBot[1], F_SETFD, FD_CLOEXEC);
+    fcntl(toBot[1], F_SETFL, O_NONBLOCK); // A bot that doesn't read can't stall the harness
+    fcntl(fromBot[0], F_SETFD, FD_CLOEXEC);
+    bot->pid = fork();
+    if (bot->pid == 0) {
+        dup2(toBot[0], STDIN_FILENO);
+        dup2(fromBot[1], STDOUT_FILENO);
+        execl("/bin/sh", "sh", "-c", bot->command, (char *) NULL);
+        _exit(127);
+    }
+    close(toBot[0]);
+    close(fromBot[1]);
+    if (bot->pid < 0) {
+        close(toBot[1]);
+        close(fromBot[0]);
+        return false;
+    }
+    bot->in = toBot[1];
+    bot->out = fromBot[0];
+    return true;
+}
+
+// Sends the bot a line protocol line & starts the clock on its next move. A bot that's let its
+// stdin fill up has sent commands without reading the replies
+void botSend(Harness *h, Bot *bot, const char *code, const char *extra) {
+    char buf[PROTOCOL_LINE];
+    int n = protocolObserve(&bot->world, code, extra, buf, sizeof(buf));
+    for (int sent=0, w; sent < n; sent += w) {
+        w = (int) write(bot->in, buf + sent, n - sent);
+        if (w < 0 && errno == EINTR) w = 0;
+        else if (w < 0) {
+            botForfeit(bot, errno == EAGAIN ? "NOT READING" : "QUIT");
+            return;
+        }
+    }
+    bot->sent = monotonicNanos();
+    bot->deadline = bot->sent + h->limit;
+}
+
+// Stops a bot that broke the rules or quit, it loses the games it had left
+void botForfeit(Bot *bot, const char *why) {
+    bot->forfeit = why;
+    bot->done = true;
+    kill(bot->pid, SIGKILL);
+    close(bot->in);
+    bot->in = -1;
+}
+
+// Deals the bot its next game, or closes its stdin once it's played them all
+void botNextGame(Harness *h, Bot *bot) {
+    if (bot->game == h->games) {
+        bot->done = true;
+        close(bot->in);
+        bot->in = -1;
+        return;
+    }
+    WorldConfig config = h->config;
+    config.seed += bot->game++;
+    worldInit(&bot->world, &config);
+    seedDice(bot->world.seed);
+    bot->dice = dice;
+    bot->moves = 0;
+    botSend(h, bot, "START", "");
+}
+
+// Plays a command the bot sent, then answers it
+void botLine(Harness *h, Bot *bot, const char *line, long long now) {
+    if (now > bot->deadline) {
+        botForfeit(bot, "TIMED OUT");
+        return;
+    }
+    long long took = now > bot->sent ? now - bot->sent : 0; // Sent ahead, before the reply it's answering
+    bot->thinking += took;
+    if (took > bot->slowest) bot->slowest = took;
+    bot->totalMoves++;
+
+    char extra[PROTOCOL_LINE];
+    World *world = &bot->world;
+    dice = bot->dice;
+    const char *code = protocolCommand(world, line, extra, sizeof(extra));
+    bot->dice = dice;
+    const char *outcome = protocolOutcome(world, ++bot->moves);
+    if (!outcome) {
+        botSend(h, bot, code, extra);
+        return;
+    }
+    if (outcome[0] == 'W') bot->won++;
+    else if (outcome[0] == 'L') bot->lost++;
+    else bot->outOfTime++;
+    botSend(h, bot, "END", outcome);
+    if (!bot->done) botNextGame(h, bot);
+}
+
+// Reads what the bot's written & plays every whole line of it
+void botRead(Harness *h, Bot *bot, long long now) {
+    int n = (int) read(bot->out, bot->line + bot->length, sizeof(bot->line) - 1 - bot->length);
+    if (n < 0 && errno == EINTR) return;
+    if (n <= 0) {
+        botForfeit(bot, "QUIT");
+        return;
+    }
+    bot->length += n;
+    bot->line[bot->length] = '\0';
+
+    // A line too long for the buffer is played as far as it goes, & turned down
+    char *start = bot->line, *end;
+    while (!bot->done && ((end = strchr(start, '\n')) || bot->length == sizeof(bot->line) - 1)) {
+        if (end) *end = '\0';
+        botLine(h, bot, start, now);
+        if (!end) {
+            start = bot->line + bot->length;
+            break;
+        }
+        start = end + 1;
+    }
+    bot->length -= (int) (start - bot->line);
+    memmove(bot->line, start, bot->length);
+}
+
+// -X: plays opts->simGames games (at least 1) with every bot, each on the same seeds (or the
+// -G template), then reports. The bots are processes of their own talking the line protocol
+// over pipes, & the harness polls their stdouts together: they all think at once while it
+// plays whichever commands are in. A bot that takes longer than opts->moveMillis over a move,
+// or quits, is stopped & forfeits the games it had left
+bool playBots(const Options *opts) {
+    Harness h = {.config = opts->config, .games = opts->simGames ? opts->simGames : 1,
+                 .limit = opts->moveMillis * 1000000LL, .numBots = opts->numBots};
+    if (!h.config.seed) h.config.seed = newSeed();
+    h.bots = calloc(h.numBots, sizeof(Bot));
+    if (!h.bots) return false;
+    signal(SIGPIPE, SIG_IGN); // A bot that's gone shows up as a failed write instead
+    traceThreadName("HARNESS");
+
+    long long t0 = monotonicNanos();
+    for (int i=0; i<h.numBots; i++) {
+        Bot *bot = &h.bots[i];
+        bot->command = opts->bots[i];
+        if (!startBot(bot)) {
+            fprintf(stderr, "CAN'T START BOT %s\n", bot->command);
+            bot->forfeit = "DIDN'T START";
+            bot->done = true;
+            continue;
+        }
+        botNextGame(&h, bot);
+    }
+
+    struct pollfd fds[MAX_BOTS];
+    int polled[MAX_BOTS];
+    while (true) {
+        int n = 0;
+        long long now = monotonicNanos(), wait = -1;
+        for (int i=0; i<h.numBots; i++) {
+            if (h.bots[i].done) continue;
+            fds[n] = (struct pollfd) {.fd = h.bots[i].out, .events = POLLIN};
+            polled[n++] = i;
+            long long left = h.bots[i].deadline - now;
+            if (wait < 0 || left < wait) wait = left > 0 ? left : 0;
+        }
+        if (!n) break;
+        if (poll(fds, n, (int) ((wait + 999999) / 1000000)) < 0 && errno != EINTR) {
+            perror("poll");
+            return false;
+        }
+        now = monotonicNanos();
+        for (int k=0; k<n; k++) {
+            Bot *bot = &h.bots[polled[k]];
+            if (fds[k].revents) botRead(&h, bot, now);
+            else if (now > bot->deadline) botForfeit(bot, "TIMED OUT");
+        }
+    }
+    double secs = (monotonicNanos() - t0) / 1e9;
+
+    long long moves = 0;
+    for (int i=0; i<h.numBots; i++) moves += h.bots[i].totalMoves;
+    printf("%d BOTS, %d GAMES EACH ON A %dx%d GALAXY, %d MS A MOVE, %lld MOVES IN %.3lf S (%.0lf MOVES/S)\n",
+           h.numBots, h.games, h.config.rows, h.config.cols, opts->moveMillis, moves, secs, moves / secs);
+    if (galaxyTemplate) printf("  EVERY GAME ON THE TEMPLATE %s\n", opts->templateFile);
+    else printf("  SEEDS %llu TO %llu\n", h.config.seed, h.config.seed + h.games - 1);
+    for (int i=0; i<h.numBots; i++) {
+        Bot *bot = &h.bots[i];
+        printf("  BOT %d: %s\n", i+1, bot->command);
+        printf("    WON %d, LOST %d, OUT OF TIME %d", bot->won, bot->lost, bot->outOfTime);
+        if (bot->forfeit) printf(", FORFEITED %d (%s)", h.games - bot->won - bot->lost - bot->outOfTime, bot->forfeit);
+        printf("\n    %lld MOVES, %.0lf MOVES/S OF ITS THINKING TIME, SLOWEST MOVE %.3lf MS\n", bot->totalMoves,
+               bot->thinking ? bot->totalMoves / (bot->thinking / 1e9) : 0.0, bot->slowest / 1e6);
+
+        if (bot->pid > 0) {
+            close(bot->out);
+            if (bot->in >= 0) close(bot->in);
+            if (!bot->forfeit && waitpid(bot->pid, NULL, WNOHANG) == 0) kill(bot->pid, SIGKILL); // Done, but still running
+            waitpid(bot->pid, NULL, 0);
+        }
+        freeWorld(&bot->world);
+    }
+    free(h.bots);
+    return true;
+}
+
+// Creates the feed the game thread publishes to, /dev/shm/NAME. It's unlinked again on exit
+bool feedOpen(const char *name, const WorldConfig *config) {
+    char *path = feedPath;
+    snprintf(path, sizeof(feedPath), "/%s", name);
+    size_t size = sizeof(Feed) + (size_t) config->rows * config->cols * sizeof(uint16_t);
+    int fd = shm_open(path, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0) return false;
+    Feed *f = ftruncate(fd, (off_t) size) ? MAP_FAILED : mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (f == MAP_FAILED) {
+        shm_unlink(path);
+        return false;
+    }
+    // The mapping starts zeroed, so seq starts even
+    f->size = (uint32_t) size;
+    f->rows = config->rows;
+    f->cols = config->cols;
+    atomic_thread_fence(memory_order_release);
+    f->magic = FEED_MAGIC;
+    feed = f;
+    feedSeed = 0;
+    atexit(feedClose);
+    return true;
+}
+
+// Publishes the world after a command. The quadrant counts only get copied again if the galaxy
+// is new or something in it was destroyed
+void feedPublish(World *world) {
+    Feed *f = feed;
+    if (!f) return;
+    FeedState *s = &f->state;
+    Player *pl = &world->player;
+    SectorMap *map = touchQuadrant(world, pl->pos[0], pl->pos[1]);
+
+    feedBegin(f);
+    if (feedSeed != world->seed || feedQuadGen != world->gen.quadrants) {
+        int numQuads = world->config.rows * world->config.cols;
+        for (int q=0; q<numQuads; q++) f->quads[q] = packCounts(quadrantAt(world, q));
+        feedSeed = world->seed;
+        feedQuadGen = world->gen.quadrants;
+    }
+    s->seed = world->seed;
+    s->date = world->date;
+    s->daysRem = world->daysRem;
+    s->numKlingons = world->numKlingons;
+    s->numStarbases = world->numStarbases;
+    memcpy(s->pos, pl->pos, sizeof(s->pos));
+    s->energy = pl->energy;
+    s->shield = pl->shield;
+    s->photon = pl->photon;
+    s->condition = pl->condition;
+    s->gameOver = world->gameOver;
+    memcpy(s->sector, map->sector, sizeof(s->sector));
+    s->sector[pl->pos[2]][pl->pos[3]] = 'E';
+    feedEnd(f);
+}
+
+// atexit() hook: tells the viewers the game's over & removes the feed's name
+void feedClose() {
+    Feed *f = feed;
+    if (!f) return;
+    feedBegin(f);
+    f->state.closed = true;
+    feedEnd(f);
+    feed = NULL;
+    munmap(f, f->size);
+    shm_unlink(feedPath);
+}
+
+// Sample viewer: shows the game published at NAME 4 times a second, until the game exits
+int watchFeed(const char *name) {
+    char path[STR_SIZE + 2];
+    snprintf(path, sizeof(path), "/%s", name);
+    int fd = shm_open(path, O_RDONLY, 0);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) || (size_t) st.st_size < sizeof(Feed)) {
+        fprintf(stderr, "NO GAME PUBLISHED AT %s\n", name);
+        if (fd >= 0) close(fd);
+        return 1;
+    }
+    const Feed *f = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (f == MAP_FAILED || f->magic != FEED_MAGIC || f->size != (size_t) st.st_size) {
+        fprintf(stderr, "NO GAME PUBLISHED AT %s\n", name);
+        return 1;
+    }
+    atomic_thread_fence(memory_order_acquire);
+
+    int rows = f->rows, cols = f->cols;
+    uint16_t *quads = malloc((size_t) rows * cols * sizeof(uint16_t));
+    if (!quads) return 1;
+    const char *condNames[] = {"GREEN", "YELLOW", "RED", "DOCKED"};
+    FeedState s;
+    do {
+        // Copy a consistent snapshot, retrying while the game writes
+        uint64_t seq;
+        while (true) {
+            seq = atomic_load_explicit(&f->seq, memory_order_acquire);
+            if (seq & 1) continue;
+            memcpy(&s, &f->state, sizeof(s));
+            memcpy(quads, f->quads, (size_t) rows * cols * sizeof(uint16_t));
+            atomic_thread_fence(memory_order_acquire);
+            if (atomic_load_explicit(&f->seq, memory_order_relaxed) == seq) break;
+        }
+
+        printf("\033[H\033[2J");
+        printf("GAME %s  SEED %llu  STARDATE %d (%d LEFT)  CONDITION %s%s\n", name, s.seed, s.date, s.daysRem,
+               condNames[s.condition], s.closed ? "  (GAME OVER)" : s.gameOver ? "  (MISSION ENDED)" : "");
+        printf("QUADRANT %d,%d SECTOR %d,%d  ENERGY %d  SHIELDS %d  TORPEDOES %d  KLINGONS %d  STARBASES %d\n\n",
+               s.pos[0]+1, s.pos[1]+1, s.pos[2]+1, s.pos[3]+1, s.energy, s.shield, s.photon, s.numKlingons,
+               s.numStarbases);
+
+        // Galaxy map, up to 16x16 quadrants around the ship, with the ship's quadrant in brackets
+        int r0 = s.pos[0] - 8, c0 = s.pos[1] - 8;
+        if (r0 > rows - 16) r0 = rows - 16;
+        if (c0 > cols - 16) c0 = cols - 16;
+        if (r0 < 0) r0 = 0;
+        if (c0 < 0) c0 = 0;
+        for (int r=r0; r<rows && r<r0+16; r++) {
+            for (int c=c0; c<cols && c<c0+16; c++) {
+                uint16_t q = quads[r*cols + c];
+                bool ship = r == s.pos[0] && c == s.pos[1];
+                printf("%c%d%d%d%c", ship ? '[' : ' ', q >> 12, q >> 8 & 0xf, q & 0xff, ship ? ']' : ' ');
+            }
+            printf("\n");
+        }
+
+        // The ship's quadrant & what happened lately
+        printf("\n");
+        for (int s1=0; s1<QS_SIZE; s1++) {
+            printf("   ");
+            for (int s2=0; s2<QS_SIZE; s2++) printf(" %c", s.sector[s1][s2] == ' ' ? '.' : s.sector[s1][s2]);
+            int e = (int) s.numEvents - QS_SIZE + s1;
+            if (e >= 0) printf("      %s", s.event[e % FEED_EVENTS]);
+            printf("\n");
+        }
+        fflush(stdout);
+
+        struct timespec pause = {0, 250000000};
+        if (!s.closed) nanosleep(&pause, NULL);
+    } while (!s.closed);
+
+    free(quads);
+    munmap((void *) f, f->size);
+    return 0;
+}
+
+// Client side of -z: decompresses stdin to stdout as it arrives
+int inflateStream() {
+#ifdef ZLIB
+    z_stream z = {0};
+    unsigned char in[OUT_ZBUF], out[4 * OUT_ZBUF];
+    if (inflateInit2(&z, OUT_ZWINDOW) != Z_OK) return 1;
+    int ret = Z_OK;
+    ssize_t n;
+    while (ret != Z_STREAM_END && (n = read(STDIN_FILENO, in, sizeof(in))) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        z.next_in = in;
+        z.avail_in = (uInt) n;
+        do {
+            z.next_out = out;
+            z.avail_out = sizeof(out);
+            ret = inflate(&z, Z_NO_FLUSH);
+            if (ret == Z_NEED_DICT) {
+                inflateSetDictionary(&z, (const Bytef *) outputDictionary, sizeof(outputDictionary) - 1);
+                ret = inflate(&z, Z_NO_FLUSH);
+            }
+            if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+                fprintf(stderr, "CORRUPT GAME STREAM\n");
+                inflateEnd(&z);
+                return 1;
+            }
+            fwrite(out, 1, sizeof(out) - z.avail_out, stdout);
+        } while (z.avail_out == 0);
+        fflush(stdout);
+    }
+    inflateEnd(&z);
+    return 0;
+#else
+    fprintf(stderr, "DECOMPRESSION NEEDS A -DZLIB BUILD\n");
+    return 1;
+#endif
+}
+
+// Opens the journal for writing & starts its committer. A recovered journal is appended to after
+// its last whole record, otherwise the file starts over
+bool journalOpen(const char *path, const Options *opts, const Recovery *rec) {
+    int fd = open(path, O_WRONLY | O_CREAT | (rec->data ? 0 : O_TRUNC), 0644);
+    if (fd < 0) return false;
+    if (rec->data && (ftruncate(fd, (off_t) rec->valid) || lseek(fd, 0, SEEK_END) < 0)) {
+        close(fd);
+        return false;
+    }
+    Journal *j = calloc(1, sizeof(Journal));
+    if (!j) {
+        close(fd);
+        return false;
+    }
+    j->fd = fd;
+    j->sync = !opts->journalAsync;
+    j->cap = j->spareCap = JOURNAL_BATCH * 2;
+    j->buf = malloc(j->cap);
+    j->spare = malloc(j->cap);
+    j->nextSession = rec->maxSession + 1;
+    pthread_mutex_init(&j->lock, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&j->work, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_cond_init(&j->durable, NULL);
+    if (!j->buf || !j->spare || pthread_create(&j->committer, NULL, journalCommitter, j)) {
+        free(j->buf);
+        free(j->spare);
+        free(j);
+        close(fd);
+        return false;
+    }
+    journal = j;
+    atexit(journalClose);
+    return true;
+}
+
+// Committer thread: writes & fsyncs the pending records in groups, until the journal is closed
+void *journalCommitter(void *arg) {
+    Journal *j = arg;
+    traceThreadName("JOURNAL");
+    pthread_mutex_lock(&j->lock);
+    while (true) {
+        while (!j->used && !j->closing) pthread_cond_wait(&j->work, &j->lock);
+        if (!j->used) break;
+
+        // Gather more records for the window, unless there's no one left to wait for
+        struct timespec deadline = {j->first / 1000000000LL, j->first % 1000000000LL};
+        deadline.tv_nsec += JOURNAL_WINDOW;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        while (!j->closing && j->used < JOURNAL_BATCH && j->waiting < j->active
+               && pthread_cond_timedwait(&j->work, &j->lock, &deadline) != ETIMEDOUT);
+
+        char *batch = j->buf;
+        size_t n = j->used;
+        unsigned long long lsn = j->appended;
+        size_t cap = j->cap;
+        j->buf = j->spare;
+        j->cap = j->spareCap;
+        j->spare = batch;
+        j->spareCap = cap;
+        j->used = 0;
+        pthread_mutex_unlock(&j->lock);
+
+        // Once a batch is lost nothing after it can be replayed, so the rest are dropped
+        int error = j->error;
+        TRACE_BEGIN(t);
+        for (size_t done=0; done<n && !error;) {
+            ssize_t w = write(j->fd, batch + done, n - done);
+            if (w < 0 && errno == EINTR) continue;
+            if (w < 0) error = errno;
+            else done += w;
+        }
+        if (!error && fdatasync(j->fd)) error = errno;
+        TRACE_END(t, "commit");
+
+        pthread_mutex_lock(&j->lock);
+        if (error) j->error = error; // Its sessions hear of it in journalWait & journalCommand
+        else {
+            j->committed = lsn;
+            j->commits++;
+        }
+        pthread_cond_broadcast(&j->durable);
+    }
+    pthread_mutex_unlock(&j->lock);
+    traceFlushThread();
+    return NULL;
+}
+
+// Appends a record for the calling thread's session. Returns the journal's length with it, to
+// pass to journalWait, which reports the journal failed if it couldn't be appended
+unsigned long long journalAppend(uint32_t type, const void *payload, size_t n) {
+    Journal *j = journal;
+    size_t size = (sizeof(JournalRecord) + n + 7) & ~(size_t) 7;
+    pthread_mutex_lock(&j->lock);
+    if (j->used + size > j->cap) {
+        // A burst (or a big snapshot) outgrew the window's buffer
+        size_t cap = j->cap;
+        while (j->used + size > cap) cap *= 2;
+        char *buf = realloc(j->buf, cap);
+        if (!buf) {
+            // A dropped record leaves a gap replay can't cross, so it fails the journal like a lost write
+            unsigned long long lsn = j->appended + size; // Never committed
+            j->error = ENOMEM;
+            pthread_cond_broadcast(&j->durable);
+            pthread_mutex_unlock(&j->lock);
+            return lsn;
+        }
+        j->buf = buf;
+        j->cap = cap;
+    }
+    JournalRecord *r = (JournalRecord *) (j->buf + j->used);
+    r->size = (uint32_t) size;
+    r->session = journalSession;
+    r->type = type;
+    memcpy(r + 1, payload, n);
+    memset((char *) (r + 1) + n, 0, size - sizeof(JournalRecord) - n);
+    r->check = fnv1a(&r->session, size - 2*sizeof(uint32_t), 2166136261u);
+
+    if (!j->used) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        j->first = now.tv_sec * 1000000000LL + now.tv_nsec;
+        pthread_cond_signal(&j->work);
+    }
+    j->used += size;
+    j->appended += size;
+    j->records++;
+    if (j->used >= JOURNAL_BATCH) pthread_cond_signal(&j->work);
+    unsigned long long lsn = j->appended;
+    pthread_mutex_unlock(&j->lock);
+    return lsn;
+}
+
+// Waits until the journal is durable up to lsn. False if it failed before getting there
+bool journalWait(unsigned long long lsn) {
+    Journal *j = journal;
+    pthread_mutex_lock(&j->lock);
+    j->waiting++;
+    if (j->waiting >= j->active) pthread_cond_signal(&j->work);
+    while (j->committed < lsn && !j->error) pthread_cond_wait(&j->durable, &j->lock);
+    j->waiting--;
+    bool durable = j->committed >= lsn;
+    pthread_mutex_unlock(&j->lock);
+    return durable;
+}
+
+// The errno the journal failed with, 0 if it hasn't
+int journalFailed() {
+    Journal *j = journal;
+    pthread_mutex_lock(&j->lock);
+    int error = j->error;
+    pthread_mutex_unlock(&j->lock);
+    return error;
+}
+
+// Starts a game in the calling thread's session
+void journalSeed(World *world) {
+    Journal *j = journal;
+    if (!j) return;
+    pthread_mutex_lock(&j->lock);
+    if (!journalSession) journalSession = j->nextSession++;
+    j->active++;
+    pthread_mutex_unlock(&j->lock);
+    unsigned long long seed = world->seed;
+    journalAppend(journalSeed_, &seed, sizeof(seed));
+    journalCommands = 0;
+}
+
+// Journals a command before it's applied, after a snapshot every JOURNAL_SNAP_EVERY commands.
+// False if the journal failed, then the command isn't applied & the game is over
+bool journalCommand(World *world, int type, double a, double b) {
+    if (trajectory) trajectoryAction(type, a, b);
+    if (!journal || !journalSession) return true;
+    if (++journalCommands > JOURNAL_SNAP_EVERY) {
+        journalSnapshot(world);
+        journalCommands = 1;
+    }
+    JournalArgs args = {a, b};
+    unsigned long long lsn = journalAppend(type, &args, sizeof(args));
+    if (journal->sync ? journalWait(lsn) : !journalFailed()) return true;
+    gamePrintf("\n*** THE JOURNAL FAILED (%s), THIS SESSION CAN'T GO ON ***\n\n", strerror(journalFailed()));
+    world->gameOver = true;
+    return false;
+}
+
+// The world's state as the payload of a snapshot, see JournalSnapshot. NULL if out of memory
+char *encodeSnapshot(World *world, size_t *bytes) {
+    int numQuads = world->config.rows * world->config.cols, words = (numQuads + 63) / 64;
+    size_t size = sizeof(JournalSnapshot) + sizeof(uint16_t) * 2 * numQuads + sizeof(uint64_t) * words;
+    uint32_t numMaps = 0;
+    for (int i=0; i<world->numMaps; i++) {
+        Quadrant *quad = quadrantAt(world, world->maps[i]);
+        if (!quad->map->mutated) continue; // The rest come out the same from the seed
+        size += 2*sizeof(uint32_t) + sizeof(SectorMap) + sizeof(Star) * quad->numStars;
+        numMaps++;
+    }
+    size += sizeof(Event) * world->numEvents;
+    char *buf = malloc(size), *at = buf;
+    if (!buf) return NULL;
+
+    JournalSnapshot snap = {world->date, world->daysRem, world->numKlingons, world->numStarbases, world->player,
+                            dice, world->clock, {0}, world->raided, (uint32_t) numQuads, numMaps,
+                            (uint32_t) world->numEvents};
+    memcpy(snap.repairDue, world->repairDue, sizeof(snap.repairDue));
+    memcpy(at, &snap, sizeof(snap));
+    at += sizeof(snap);
+    for (int q=0; q<numQuads; q++) {
+        uint16_t counts = packCounts(quadrantAt(world, q));
+        memcpy(at, &counts, sizeof(counts));
+        at += sizeof(counts);
+    }
+    if (world->tmpl) { // The scanned quadrants all have overlays
+        memset(at, 0, sizeof(uint16_t) * numQuads + sizeof(uint64_t) * words);
+        for (int i=0; i<world->capOverlay; i++) {
+            const Overlay *o = world->overlay[i];
+            if (!o || !o->scanned) continue;
+            uint64_t word;
+            char *w = at + sizeof(uint16_t) * numQuads + sizeof(uint64_t) * (o->q / 64);
+            memcpy(at + sizeof(uint16_t) * o->q, &o->archive, sizeof(o->archive));
+            memcpy(&word, w, sizeof(word));
+            word |= 1ULL << (o->q % 64);
+            memcpy(w, &word, sizeof(word));
+        }
+    } else {
+        memcpy(at, world->archive, sizeof(uint16_t) * numQuads);
+        memcpy(at + sizeof(uint16_t) * numQuads, world->scanned, sizeof(uint64_t) * words);
+    }
+    at += sizeof(uint16_t) * numQuads + sizeof(uint64_t) * words;
+    for (int i=0; i<world->numMaps; i++) {
+        Quadrant *quad = quadrantAt(world, world->maps[i]);
+        if (!quad->map->mutated) continue;
+        uint32_t head[2] = {(uint32_t) world->maps[i], (uint32_t) (sizeof(SectorMap) + sizeof(Star) * quad->numStars)};
+        memcpy(at, head, sizeof(head));
+        memcpy(at + sizeof(head), quad->map, head[1]);
+        at += sizeof(head) + head[1];
+    }
+    if (world->numEvents) memcpy(at, world->events, sizeof(Event) * world->numEvents);
+    *bytes = size;
+    return buf;
+}
+
+// Journals a snapshot of the world, so recoveries needn't replay the commands before it
+void journalSnapshot(World *world) {
+    size_t size;
+    char *buf = encodeSnapshot(world, &size);
+    if (!buf) return;
+    journalAppend(journalSnap, buf, size);
+    free(buf);
+}
+
+// Ends the calling thread's game, recording the state it ended in for replays to check against
+void journalEnd(World *world) {
+    Journal *j = journal;
+    if (!j || !journalSession) return;
+    uint64_t digest = worldDigest(world);
+    journalAppend(journalEnd_, &digest, sizeof(digest));
+    pthread_mutex_lock(&j->lock);
+    j->active--;
+    if (j->waiting >= j->active) pthread_cond_signal(&j->work);
+    pthread_mutex_unlock(&j->lock);
+}
+
+// atexit() hook: commits what's pending & stops the committer
+void journalClose() {
+    Journal *j = journal;
+    if (!j) return;
+    pthread_mutex_lock(&j->lock);
+    j->closing = true;
+    pthread_cond_signal(&j->work);
+    pthread_mutex_unlock(&j->lock);
+    pthread_join(j->committer, NULL);
+    journal = NULL;
+    close(j->fd);
+    pthread_mutex_destroy(&j->lock);
+    pthread_cond_destroy(&j->work);
+    pthread_cond_destroy(&j->durable);
+    free(j->buf);
+    free(j->spare);
+    free(j);
+}
+
+uint32_t worldDigest(const World *world) {
+    const Player *pl = &world->player;
+    int fields[] = {world->date, world->daysRem, world->numKlingons, world->numStarbases, pl->energy, pl->shield,
+                    pl->photon, pl->pos[0], pl->pos[1], pl->pos[2], pl->pos[3]};
+    return fnv1a(pl->damage, sizeof(pl->damage), fnv1a(fields, sizeof(fields), 2166136261u));
+}
+
+// Puts a freshly generated world into the state of a snapshot. False if it doesn't fit the world
+bool journalRestore(World *world, const char *data, size_t n) {
+    JournalSnapshot snap;
+    int numQuads = world->config.rows * world->config.cols, words = (numQuads + 63) / 64;
+    if (n < sizeof(snap)) return false;
+    memcpy(&snap, data, sizeof(snap));
+    size_t fixed = sizeof(snap) + sizeof(uint16_t) * 2 * numQuads + sizeof(uint64_t) * words;
+    if (snap.numQuads != (uint32_t) numQuads || n < fixed) return false;
+    const char *counts = data + sizeof(snap), *at = counts + sizeof(uint16_t) * numQuads;
+    if (world->tmpl) {
+        for (int q=0; q<numQuads; q++) {
+            uint64_t word;
+            memcpy(&word, at + sizeof(uint16_t) * numQuads + sizeof(uint64_t) * (q / 64), sizeof(word));
+            if (!(word >> (q % 64) & 1)) continue;
+            Overlay *o = overlayQuadrant(world, q);
+            memcpy(&o->archive, at + sizeof(uint16_t) * q, sizeof(o->archive));
+            o->scanned = true;
+        }
+    } else {
+        memcpy(world->archive, at, sizeof(uint16_t) * numQuads);
+        memcpy(world->scanned, at + sizeof(uint16_t) * numQuads, sizeof(uint64_t) * words);
+    }
+    at += sizeof(uint16_t) * numQuads + sizeof(uint64_t) * words;
+
+    // Sector maps first, while the quadrants still have their generated counts
+    for (uint32_t i=0; i<snap.numMaps; i++) {
+        uint32_t head[2];
+        if (at + sizeof(head) > data + n) return false;
+        memcpy(head, at, sizeof(head));
+        at += sizeof(head);
+        if (head[0] >= (uint32_t) numQuads || at + head[1] > data + n) return false;
+        Quadrant *quad = quadrantAt(world, (int) head[0]);
+        if (head[1] > sizeof(SectorMap) + sizeof(Star) * quad->numStars) return false;
+        SectorMap *map = touchQuadrant(world, (int) head[0] / world->config.cols, (int) head[0] % world->config.cols);
+        memcpy(map, at, head[1]);
+        map->mutated = true;
+        at += head[1];
+    }
+    if (at + sizeof(Event) * snap.numEvents > data + n) return false;
+    world->numEvents = 0;
+    for (uint32_t i=0; i<snap.numEvents; i++) {
+        Event event;
+        memcpy(&event, at + sizeof(Event) * i, sizeof(event));
+        scheduleEvent(world, event.type, event.arg, event.at);
+    }
+    for (int q=0; q<numQuads; q++) {
+        uint16_t packed;
+        memcpy(&packed, counts + sizeof(uint16_t) * q, sizeof(packed));
+        if (packCounts(quadrantAt(world, q)) == packed) continue;
+        Quadrant *quad = ownQuadrant(world, q);
+        quad->numKlingons = packed >> 12;
+        quad->numStarbases = packed >> 8 & 0xf;
+        quad->numStars = packed & 0xff;
+    }
+
+    world->date = snap.date;
+    world->daysRem = snap.daysRem;
+    world->numKlingons = snap.numKlingons;
+    world->numStarbases = snap.numStarbases;
+    world->player = snap.player;
+    world->clock = snap.clock;
+    memcpy(world->repairDue, snap.repairDue, sizeof(world->repairDue));
+    world->raided = snap.raided;
+    dice = snap.dice;
+    buildStarbaseField(world);
+    // Everything cached is stale
+    world->gen.quadrants++;
+    world->gen.position++;
+    world->gen.stats++;
+    world->gen.damage++;
+    return true;
+}
+
+// Replays a session's records from a snapshot (or seed record) at from up to until, onto a world
+// generated from the session's seed. Returns the commands replayed, -1 if a snapshot didn't fit
+int journalReplay(World *world, const Recovery *rec, uint32_t session, size_t from, size_t until) {
+    int commands = 0;
+    for (size_t off=from; off<until;) {
+        const JournalRecord *r = (const JournalRecord *) (rec->data + off);
+        const char *payload = (const char *) (r + 1);
+        off += r->size;
+        if (r->session != session) continue;
+        JournalArgs args;
+        memcpy(&args, payload, r->type >= journalNAV && r->type <= journalLRS ? sizeof(args) : 0);
+        switch (r->type) {
+            case journalSnap:
+                if (!journalRestore(world, payload, r->size - sizeof(JournalRecord))) return -1;
+                break;
+            case journalNAV: navigate(world, args.a, args.b); break;
+            case journalPHA: firePhasers(world, (int) args.a); break;
+            case journalTOR: fireTorpedo(world, args.a); break;
+            case journalSHE: setShields(world, (int) args.a); break;
+            case journalSRS: cmdSRS(world); break;
+            case journalLRS: cmdLRS(world); break;
+            default: continue;
+        }
+        if (r->type != journalSnap) commands++;
+    }
+    return commands;
+}
+
+// Reads the journal at path, replays every finished game from its last snapshot & checks it ends
+// the way it was recorded to, then reports. The latest unfinished game goes in rec for main
+// to resume. False if there's no journal to read
+bool recoverJournal(const char *path, const WorldConfig *config, Recovery *rec) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st)) {
+        fprintf(stderr, "CAN'T READ THE JOURNAL %s\n", path);
+        if (fd >= 0) close(fd);
+        return false;
+    }
+    rec->size = (size_t) st.st_size;
+    rec->data = rec->size ? mmap(NULL, rec->size, PROT_READ, MAP_PRIVATE, fd, 0) : "";
+    close(fd);
+    if (rec->data == MAP_FAILED) {
+        fprintf(stderr, "CAN'T READ THE JOURNAL %s\n", path);
+        return false;
+    }
+
+    // Where the games are, up to the first torn or corrupt record
+    JournalGame *games = NULL;
+    int numGames = 0, capGames = 0;
+    int *current = NULL;          // Per session: its game
+    size_t off = 0;
+    while (off + sizeof(JournalRecord) <= rec->size) {
+        const JournalRecord *r = (const JournalRecord *) (rec->data + off);
+        if (r->size < sizeof(JournalRecord) || r->size % 8 || r->size > rec->size - off
+            || r->check != fnv1a(&r->session, r->size - 2*sizeof(uint32_t), 2166136261u) || !r->session) break;
+        if (r->session > rec->maxSession) {
+            int *grown = realloc(current, sizeof(int) * (r->session + 1));
+            if (!grown) break;
+            current = grown;
+            for (uint32_t s=rec->maxSession+1; s<=r->session; s++) current[s] = -1;
+            rec->maxSession = r->session;
+        }
+        int g = current[r->session];
+        if (r->type == journalSeed_) {
+            if (numGames == capGames) {
+                capGames = capGames ? capGames * 2 : 64;
+                JournalGame *grown = realloc(games, sizeof(JournalGame) * capGames);
+                if (!grown) break;
+                games = grown;
+            }
+            games[numGames] = (JournalGame) {r->session, off, 0, 0};
+            current[r->session] = numGames++;
+        } else if (g >= 0 && r->type == journalSnap) {
+            games[g].snap = off;
+        } else if (g >= 0 && r->type == journalEnd_) {
+            games[g].end = off;
+        }
+        off += r->size;
+    }
+    rec->valid = off;
+
+    // Replay the finished games & pick the unfinished one to resume
+    World world = {0};
+    int finished = 0, matched = 0, unfinished = 0, failed = 0;
+    long long replayed = 0;
+    for (int g=0; g<numGames; g++) {
+        const JournalRecord *seedRecord = (const JournalRecord *) (rec->data + games[g].seed);
+        unsigned long long seed;
+        memcpy(&seed, seedRecord + 1, sizeof(seed));
+        size_t from = games[g].snap ? games[g].snap : games[g].seed;
+        if (!games[g].end) {
+            unfinished++;
+            rec->session = games[g].session;
+            rec->seed = seed;
+            rec->from = from;
+            continue;
+        }
+        WorldConfig cfg = *config;
+        cfg.seed = seed;
+        worldInit(&world, &cfg);
+        seedDice(seed);
+        int commands = journalReplay(&world, rec, games[g].session, from, games[g].end);
+        uint64_t digest;
+        memcpy(&digest, (const JournalRecord *) (rec->data + games[g].end) + 1, sizeof(digest));
+        finished++;
+        if (commands < 0) {
+            failed++;
+            continue;
+        }
+        replayed += commands;
+        if (worldDigest(&world) == digest) matched++;
+    }
+    freeWorld(&world);
+    free(games);
+    free(current);
+
+    printf("JOURNAL %s: %zu BYTES OF RECORDS, %zu TORN BYTES DROPPED\n", path, rec->valid, rec->size - rec->valid);
+    printf("  %d FINISHED GAMES, %d REBUILT EXACTLY (%d SNAPSHOTS DIDN'T FIT THE GALAXY)\n", finished, matched, failed);
+    printf("  %lld COMMANDS REPLAYED, %.1lf PER GAME FROM ITS LAST SNAPSHOT\n", replayed,
+           finished ? (double) replayed / finished : 0.0);
+    printf("  %d UNFINISHED GAMES%s\n", unfinished, rec->session ? ", RESUMING THE LAST ONE" : "");
+    fflush(stdout);
+    return true;
+}
 
-typedef struct World {
-    int date;
-    int daysRem;
-    int numKlingons;
-    int numStarbases;
-    char quadNames[9][STR_SIZE];
-    char statNames[8][STR_SIZE];
-    Klingon klingons[NUM_KL];
-    Starbase starbases[NUM_SB];
-    Star stars[NUM_STARS];
-    Quadrant quadrant[QS_SIZE][QS_SIZE];
-    Quadrant quadrantArch[QS_SIZE][QS_SIZE];
-    Player player;
-    bool gameOver;
-} World;
+// Rebuilds the recovered game onto world, generated from its seed, & carries on its session
+void journalResume(World *world, const Recovery *rec) {
+    // Nothing of the replay is shown, published or journaled again
+    Output *o = output;
+    Feed *f = feed;
+    Screen *s = screen;
+    Journal *j = journal;
+    output = NULL;
+    feed = NULL;
+    screen = NULL;
+    journal = NULL;
+    int commands = journalReplay(world, rec, rec->session, rec->from, rec->valid);
+    output = o;
+    feed = f;
+    screen = s;
+    journal = j;
+
+    gamePrintf("RESUMED GAME OF SEED %llu AFTER %d REPLAYED COMMANDS\n", rec->seed, commands);
+    if (!j) return;
+    journalSession = rec->session;
+    pthread_mutex_lock(&j->lock);
+    j->active++;
+    pthread_mutex_unlock(&j->lock);
+    journalSnapshot(world); // So the next recovery starts from here
+    journalCommands = 1;
+}
 
+void scheduleEvent(World *world, int type, int arg, double at) {
+    if (world->numEvents == world->capEvents) {
+        world->capEvents = world->capEvents ? world->capEvents * 2 : 16;
+        world->events = realloc(world->events, sizeof(Event) * world->capEvents);
+        if (!world->events) {
+            fprintf(stderr, "NOT ENOUGH MEMORY FOR %d EVENTS\n", world->capEvents);
+            exit(1);
+        }
+    }
+    Event *heap = world->events;
+    int i = world->numEvents++;
+    while (i > 0 && heap[(i - 1) / 2].at > at) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = (Event) {at, type, arg};
+}
 
-// Small Functions
-int randRange(int lo, int hi) {
-    return lo + rand() % (hi - lo);
+// Takes the earliest event off the heap, which mustn't be empty
+Event popEvent(World *world) {
+    Event *heap = world->events, first = heap[0], last = heap[--world->numEvents];
+    int i = 0, n = world->numEvents;
+    while (2*i + 1 < n) {
+        int child = 2*i + 1;
+        if (child + 1 < n && heap[child + 1].at < heap[child].at) child++;
+        if (heap[child].at >= last.at) break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    if (n) heap[i] = last;
+    return first;
 }
 
-double drand() {
-    return (rand() % 1000) / (1000.00);
+// Moves time on by days, running the events that come due on the way in order. Time jumps
+// from one event to the next, so a long wait costs its events, not its stardates
+void advanceClock(World *world, double days) {
+    double until = world->clock + days;
+    while (world->numEvents && world->events[0].at <= until && !world->gameOver) {
+        Event event = popEvent(world);
+        if (event.at > world->clock) world->clock = event.at;
+        world->date = START_DATE + (int) floor(world->clock + 1e-9);
+        runEvent(world, &event);
+    }
+    world->clock = until;
+    int elapsed = (int) floor(until + 1e-9); // Tenths of a stardate don't quite add up in binary
+    world->date = START_DATE + elapsed;
+    world->daysRem = world->config.days - elapsed;
 }
 
-double getDistance(Player *player, const int *to) {
-    int x = ((player->pos[1] * 8) + player->pos[3]) - ((to[1]*8)+to[3]);
-    int y = ((player->pos[0] * 8) + player->pos[2]) - ((to[0]*8)+to[2]);
-    return sqrt(pow(x,2) + pow(y,2));
+void runEvent(World *world, const Event *event) {
+    Player *pl = &world->player;
+    world->counters.events++;
+    switch (event->type) {
+        case eventRepair:
+            if (world->repairDue[event->arg] != event->at) return; // Damaged again since, so due later
+            pl->damage[event->arg] = 0;
+            world->gen.damage++;
+            gamePrintf("DAMAGE CONTROL REPORTS %s REPAIRED\n", deviceNames[event->arg]);
+            break;
+        case eventResupply:
+            if (!getQuadrant(world, pl->pos[0], pl->pos[1])->numStarbases) return; // Left before it was done
+            if (pl->energy < world->config.energy) pl->energy = world->config.energy;
+            pl->photon = PLAYER_TORPEDOES;
+            world->gen.stats++;
+            gamePrintf("STARBASE RESUPPLIES THE ENTERPRISE\n");
+            break;
+        case eventRaid: {
+            Quadrant *quad = quadrantAt(world, event->arg);
+            int q1 = event->arg / world->config.cols, q2 = event->arg % world->config.cols;
+            if (!quad->numStarbases || !quad->numKlingons) return; // Nothing left to raid, or with
+            if (q1 != pl->pos[0] || q2 != pl->pos[1]) { // Unless the Enterprise is there to defend it
+                removeEntity(world, &touchQuadrant(world, q1, q2)->starbases[0], 'b');
+                world->raided++;
+                gamePrintf("LT. UHURA REPORTS: STARBASE IN QUADRANT %i,%i DESTROYED BY KLINGONS\n", q1+1, q2+1);
+                quad = quadrantAt(world, event->arg); // A template world's is an overlay now
+            }
+            if (quad->numStarbases) scheduleEvent(world, eventRaid, event->arg, event->at + RAID_MIN);
+            break;
+        }
+        case eventTick:
+            galaxyTick(world);
+            scheduleEvent(world, eventTick, 0, event->at + 1);
+            break;
+        default:
+            break;
+    }
 }
 
+// Shard of galaxyTick(): decides where one klingon of every quadrant of the row goes, from the
+// counts before the tick. Lone klingons regroup with a neighbouring fleet, others sometimes set
+// out for a neighbouring starbase no one is raiding yet, or just reposition
+void tickRow(void *ctx, int row) {
+    Tick *tick = ctx;
+    World *world = tick->world;
+    int cols = world->config.cols;
+    int player = world->player.pos[0]*cols + world->player.pos[1];
+
+    for (int q2=0; q2<cols; q2++) {
+        int q = row*cols + q2;
+        int klingons = quadrantAt(world, q)->numKlingons;
+        tick->moves[q] = -1;
+        if (!klingons || q == player) continue; // Klingons fighting the Enterprise stay put
+
+        Rng rng;
+        rngInit(&rng, world->seed, RNG_TICK | (unsigned long long) tick->stardate << 32 | (unsigned long long) q);
+        bool raid = rngRange(&rng, 0, 4) == 0;
+        int best = -1, bestScore = 0;
+        for (int d1=-1; d1<=1; d1++) {
+            for (int d2=-1; d2<=1; d2++) {
+                Quadrant *next = getQuadrant(world, row+d1, q2+d2);
+                if (!next || (d1 == 0 && d2 == 0)) continue;
+                int score = 0;
+                if (raid && next->numStarbases > 0 && next->numKlingons == 0) score = 2;
+                else if (klingons == 1 && next->numKlingons > 0 && next->numKlingons < MAX_QK) score = 1;
+                if (score > bestScore) {
+                    best = (row+d1)*cols + q2+d2;
+                    bestScore = score;
+                }
+            }
+        }
+        if (best < 0 && rngRange(&rng, 0, 8) == 0) {
+            int d = rngRange(&rng, 0, 8);
+            if (d >= 4) d++; // Skips staying put
+            int d1 = d / 3 - 1, d2 = d % 3 - 1;
+            if (getQuadrant(world, row+d1, q2+d2)) best = (row+d1)*cols + q2+d2;
+        }
+        tick->moves[q] = best;
+    }
+}
 
-// Functions Header
-void printTitle();
-World generateWorld();
-void updateCond(World *world);
-Entity *getNearbyEntity(World *world, int n, char type);
-void getCmd(World *world);
-void cmdNAV(World *world);
-void printStat(World *world, int n);
-void cmdSRS(World *world);
-void cmdLRS(World *world);
-void cmdPHA(World *world);
-void cmdTOR(World *world);
-void cmdSHE(World *world);
-void cmdDAM(World *world);
-void cmdCOM(World *world);
-void cmdXXX(World *world);
-void sortEntities(Entity **entity, double *dist, int n);
-void klingonShooting(World *world);
-void checkGameOver(World *world);
-void printInstructions();
+// Galaxy-wide klingon turn, every stardate with -T. Rows decide their moves independently as
+// shards on the world's threads (big galaxies only), then the moves are applied one quadrant
+// after another in index order, so the outcome doesn't depend on the thread count
+void galaxyTick(World *world) {
+    int rows = world->config.rows, cols = world->config.cols, numQuads = rows * cols;
+    Tick tick = {world, (long long) floor(world->clock + 1e-9), malloc(sizeof(int) * numQuads)};
+    if (!tick.moves) return;
+    TRACE_BEGIN(t);
+    runTasks(tickRow, &tick, rows, numQuads >= TICK_TASKS ? world->config.threads : 1);
+
+    int player = world->player.pos[0]*cols + world->player.pos[1], moved = 0;
+    for (int q=0; q<numQuads; q++) {
+        int to = tick.moves[q];
+        if (to < 0 || to == player || !quadrantAt(world, q)->numKlingons) continue;
+        Quadrant *dest = quadrantAt(world, to);
+        if (dest->numKlingons >= MAX_QK || dest->numKlingons + dest->numStarbases + dest->numStars >= QS_SIZE*QS_SIZE - 1) {
+            continue; // No room
+        }
+        moveKlingon(world, q, to, tick.stardate);
+        dest = quadrantAt(world, to); // A template world's is an overlay now
+        moved++;
+        if (dest->numStarbases > 0 && dest->numKlingons == 1) scheduleEvent(world, eventRaid, to, world->clock + RAID_MIN);
+    }
+    if (moved) world->gen.quadrants++;
+    free(tick.moves);
+    TRACE_END(t, "galaxyTick");
+}
 
+// Moves a klingon between quadrants. Counts are all a quadrant without a sector map needs,
+// the map (if there is one) gets it in a free sector picked from the seed
+void moveKlingon(World *world, int from, int to, long long stardate) {
+    Quadrant *src = ownQuadrant(world, from), *dest = ownQuadrant(world, to);
+    int energy = 0;
+    if (src->map) {
+        Klingon *k = &src->map->klingons[src->numKlingons - 1];
+        energy = k->energy;
+        src->map->sector[k->pos[2]][k->pos[3]] = ' ';
+        src->map->mutated = true;
+    }
+    src->numKlingons--;
+
+    if (dest->map) {
+        Rng rng;
+        rngInit(&rng, world->seed, RNG_ARRIVAL | (unsigned long long) stardate << 32 | (unsigned long long) to);
+        if (!energy) energy = rngRange(&rng, 100, 301);
+        int s1, s2;
+        do {
+            s1 = rngRange(&rng, 0, QS_SIZE);
+            s2 = rngRange(&rng, 0, QS_SIZE);
+        } while (dest->map->sector[s1][s2] != ' ');
+        unsigned short id = 0;
+        for (int i=0; i<dest->numKlingons; i++) {
+            if (dest->map->klingons[i].id > id) id = dest->map->klingons[i].id;
+        }
+        dest->map->klingons[dest->numKlingons] = (Klingon) {energy, {to / world->config.cols, to % world->config.cols, s1, s2}, id + 1};
+        dest->map->sector[s1][s2] = 'K';
+        dest->map->mutated = true;
+    }
+    dest->numKlingons++;
+}
 
-// MARK - Game Main Entry Point //
-int main() {
-    srand(time(NULL));
+// Frees the sector maps of the world's game
+void freeMaps(World *world) {
+    for (int i=0; i<world->numMaps; i++) {
+        Quadrant *quad = quadrantAt(world, world->maps[i]);
+        free(quad->map);
+        quad->map = NULL;
+    }
+    world->numMaps = 0;
+}
 
-    printTitle();
-    World world = generateWorld();
+// Frees everything a world outside a pool holds
+void freeWorld(World *world) {
+    if (world->tmpl) clearOverlay(world);
+    else freeMaps(world);
+    free(world->overlay);
+    free(world->maps);
+    free(world->events);
+    free(world->quadrant);
+    free(world->archive);
+    free(world->scanned);
+    free(world->sbDist);
+    free(world->sbNearest);
+    world->maps = NULL;
+    world->numMaps = world->capMaps = 0;
+    world->events = NULL;
+    world->numEvents = world->capEvents = 0;
+    world->quadrant = NULL;
+    world->archive = NULL;
+    world->scanned = NULL;
+    world->sbDist = world->sbNearest = NULL;
+    world->capQuads = 0;
+    world->overlay = NULL;
+    world->capOverlay = 0;
+    freeTactics(world);
+}
 
-    while (!world.gameOver){
-        getCmd(&world);
-        checkGameOver(&world);
+#define ALIGN64(n) (((n) + 63) & ~(size_t) 63)
+#define HUGE_PAGE (2 << 20)
+
+// Maps room for the worlds being played & the ones generated ahead, and starts the prefetch
+// thread. Each world's quadrant buffers sit right behind it, so worldInit never has to allocate them.
+// Worlds of a galaxy template have none
+void poolInit(WorldPool *pool, const WorldConfig *config, int prefetch, int players) {
+    size_t numQuads = galaxyTemplate ? 0 : (size_t) config->rows * config->cols;
+    size_t quadBytes = ALIGN64(sizeof(Quadrant) * numQuads);
+    size_t archiveBytes = ALIGN64(sizeof(uint16_t) * numQuads);
+    size_t scannedBytes = ALIGN64(sizeof(uint64_t) * ((numQuads + 63) / 64));
+    size_t distBytes = ALIGN64(sizeof(int) * numQuads);
+
+    *pool = (WorldPool) {
+            .config = *config,
+            .nextSeed = config->seed ? config->seed : newSeed(),
+            .stride = ALIGN64(sizeof(World)) + quadBytes + archiveBytes + scannedBytes + 2 * distBytes,
+            .numSlots = prefetch + players,
+            .prefetch = prefetch
+    };
+    pool->mapped = (pool->stride * pool->numSlots + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE;
+    pool->slots = mmap(NULL, pool->mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    pool->recycled = malloc(sizeof(World *) * pool->numSlots);
+    pool->ready = malloc(sizeof(World *) * pool->numSlots);
+    if (pool->slots == MAP_FAILED || !pool->recycled || !pool->ready) {
+        fprintf(stderr, "NOT ENOUGH MEMORY FOR A %dx%d GALAXY\n", config->rows, config->cols);
+        exit(1);
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(pool->slots, pool->mapped, MADV_HUGEPAGE); // Only a hint, fine if it's refused
+#endif
+
+    // The mapping is zeroed, so every world starts out empty apart from its buffers
+    for (int i=0; i<pool->numSlots; i++) {
+        char *slot = pool->slots + pool->stride * i;
+        World *world = (World *) slot;
+        pool->recycled[pool->numRecycled++] = world;
+        if (!numQuads) continue;
+        slot += ALIGN64(sizeof(World));
+        world->quadrant = (Quadrant *) slot;
+        slot += quadBytes;
+        world->archive = (uint16_t *) slot;
+        slot += archiveBytes;
+        world->scanned = (uint64_t *) slot;
+        slot += scannedBytes;
+        world->sbDist = (int *) slot;
+        world->sbNearest = (int *) (slot + distBytes);
+        world->capQuads = numQuads;
     }
 
-    return 0;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->generated, NULL);
+    pthread_create(&pool->prefetcher, NULL, prefetchWorlds, pool);
 }
-// END OF MAIN //
 
+// Prefetch thread: regenerates recycled worlds until pool->prefetch of them are ready
+void *prefetchWorlds(void *arg) {
+    WorldPool *pool = arg;
+    traceThreadName("PREFETCH");
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->closing) {
+        if (pool->asleep || !pool->numRecycled || pool->numReady >= pool->prefetch) {
+            pthread_cond_wait(&pool->wake, &pool->lock);
+            continue;
+        }
+        World *world = pool->recycled[--pool->numRecycled];
+        WorldConfig config = pool->config;
+        config.seed = pool->nextSeed++;
+        pool->generating = true;
+        pthread_mutex_unlock(&pool->lock);
+
+        TRACE_BEGIN(t);
+        worldInit(world, &config);
+        TRACE_END(t, "generateWorld");
+        traceFlushThread();
+
+        pthread_mutex_lock(&pool->lock);
+        pool->ready[(pool->readyHead + pool->numReady++) % pool->numSlots] = world;
+        pool->generating = false;
+        pthread_cond_broadcast(&pool->generated);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
 
-// Functions :-
-void printTitle(){
-    printf("\n*****************************************\n");
-    printf("*                   *                   *\n");
-    printf("*                 * * *                 *\n");
-    printf("*     * *    SUPER STAR TREK   * *      *\n");
-    printf("*               * *   * *               *\n");
-    printf("*              * *     * *              *\n");
-    printf("*****************************************\n");
-    printf("\n                                    ,------*------,\n");
-    printf("                    ,-------------   '---  ------'\n");
-    printf("                     '-------- --'      / /\n");
-    printf("                         ,---' '-------/ /--,\n");
-    printf("                          '----------------'\n");
-    printf("                    THE USS ENTERPRISE --- NCC-1701\n");
-
-    printf("\n\nDO YOU WANT TO SEE THE GAME INSTRUCTIONS BEFORE STARTING (y/n)? ");
-    int ans = tolower(getchar());
-    while(fgetc(stdin)!='\n'); // Trim extra input
-    if (ans == 'y') printInstructions();
+// Gets the next generated world, only waiting if the prefetcher hasn't caught up
+World *poolTake(WorldPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->numReady) pthread_cond_wait(&pool->generated, &pool->lock);
+    World *world = pool->ready[pool->readyHead];
+    pool->readyHead = (pool->readyHead + 1) % pool->numSlots;
+    pool->numReady--;
+    pthread_mutex_unlock(&pool->lock);
+    world->pool = pool;
+    return world;
 }
 
-World generateWorld(){
+// Hands a finished world back. Cleaning it up is left to the prefetch thread
+void poolRecycle(WorldPool *pool, World *world) {
+    pthread_mutex_lock(&pool->lock);
+    pool->recycled[pool->numRecycled++] = world;
+    pthread_cond_signal(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+}
 
-    // Initialize World & Player
-    World world = {
-            .date = START_DATE,
-            .daysRem = START_DAYS,
-            .numKlingons = 0,
-            .numStarbases = 0,
-            .gameOver = false,
-            .player = {
-                    .energy = PLAYER_ENERGY,
-                    .shield = 0,
-                    .photon = 10,
-                    .pos = {4, 5, 3, 0}
-            },
-            .statNames = {"WARP ENGINES", "SHORT RANGE SENSORS", "LONG RANGE SENSORS", "PHASER CONTROL",
-                          "PHOTON TUBES", "DAMAGE CONTROL", "SHIELD CONTROL", "LIBRARY-COMPUTER"}
-    };
-    int numK = 0, numSB = 0, numStars = 0;
-    char empty = ' '; // EMPTY SPACE {Mainly for easier debugging}
-
-
-    // Initialize world to be empty
-    for (int q=0; q<QS_SIZE; q++) {
-        for (int qq=0; qq<QS_SIZE; qq++){
-            world.quadrant[q][qq].numKlingons = 0;
-            world.quadrant[q][qq].numStars = 0;
-            world.quadrant[q][qq].numStarbases = 0;
-            world.quadrant[q][qq].scanned = false;
-            world.quadrantArch[q][qq].scanned = false;
-            for (int s=0; s<QS_SIZE; s++) {
-                for (int ss=0; ss<QS_SIZE; ss++){
-                    world.quadrant[q][qq].sector[s][ss] = empty;
-                }
-            }
-        }
+// Stops the prefetch thread & frees every world, including ones still taken
+void poolClose(WorldPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->closing = true;
+    pthread_cond_signal(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+    pthread_join(pool->prefetcher, NULL);
+
+    for (int i=0; i<pool->numSlots; i++) {
+        World *world = (World *) (pool->slots + pool->stride * i);
+        if (world->tmpl) clearOverlay(world);
+        else freeMaps(world);
+        free(world->overlay);
+        free(world->maps);
+        free(world->events);
     }
+    munmap(pool->slots, pool->mapped);
+    free(pool->recycled);
+    free(pool->ready);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->wake);
+    pthread_cond_destroy(&pool->generated);
+}
 
+// For hibernateWorld(): stops the prefetcher & gives back the worlds it generated, to be generated
+// again with the same seeds after poolWake(). Then the pages of every world's quadrant buffers
+// but the other players' go back to the system, reading as zeros until worldInit fills them again
+void poolSleep(WorldPool *pool, World *taken) {
+    pthread_mutex_lock(&pool->lock);
+    pool->asleep = true;
+    while (pool->generating) pthread_cond_wait(&pool->generated, &pool->lock);
+    for (; pool->numReady; pool->numReady--) {
+        pool->recycled[pool->numRecycled++] = pool->ready[(pool->readyHead + pool->numReady - 1) % pool->numSlots];
+        pool->nextSeed--;
+    }
 
-    // Generate starbases in the world
-    for (int i=0; i<NUM_SB; i++) {
-        while (1) {
-            // Make sure starbases don't spawn in the first quadrant
-            int q1 = 4, q2 = 5;
-            while (q1 == 4 || q2 == 5) {
-                q1 = randRange(0, 8);
-                q2 = randRange(0, 8);
-            }
-            int s1 = randRange(0, 8);
-            int s2 = randRange(0, 8);
-            // Make sure it's placed in an empty spot & the quadrant doesn't have any already
-            if (world.quadrant[q1][q2].sector[s1][s2] == empty && world.quadrant[q1][q2].numStarbases <= 1){
-                world.quadrant[q1][q2].sector[s1][s2] = 'B';
-                world.starbases[numSB].pos[0] = q1;
-                world.starbases[numSB].pos[1] = q2;
-                world.starbases[numSB].pos[2] = s1;
-                world.starbases[numSB].pos[3] = s2;
-                world.starbases[numSB].energy = PLAYER_ENERGY;
-                world.quadrant[q1][q2].numStarbases++;
-                numSB++;
-                break;
-            }
+    uintptr_t page = (uintptr_t) sysconf(_SC_PAGESIZE);
+    for (int i=0; i<=pool->numRecycled; i++) {
+        World *world = i < pool->numRecycled ? pool->recycled[i] : taken;
+        if (world->tmpl) {
+            clearOverlay(world);
+            free(world->overlay);
+            world->overlay = NULL;
+            world->capOverlay = 0;
+            continue;
         }
+        freeMaps(world);
+        uintptr_t from = ((uintptr_t) world + ALIGN64(sizeof(World)) + page - 1) / page * page;
+        uintptr_t to = ((uintptr_t) world + pool->stride) / page * page; // Pages shared with the next slot stay
+        if (to > from) madvise((void *) from, to - from, MADV_DONTNEED);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void poolWake(WorldPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->asleep = false;
+    pthread_cond_signal(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Waits for the next command. If none comes within hibernateSecs, the game is written to a
+// snapshot file & its memory freed until there's input again
+void awaitCommand(World *world) {
+    if (!hibernateSecs) return;
+    struct pollfd in = {STDIN_FILENO, POLLIN, 0};
+    if (poll(&in, 1, hibernateSecs * 1000) != 0) return; // Input, or an EOF or error for fgets() to find
+
+    char path[512];
+    const char *dir = getenv("TMPDIR");
+    snprintf(path, sizeof(path), "%s/startrek-%d.hib", dir ? dir : "/tmp", (int) getpid());
+    if (!hibernateWorld(world, path)) return;
+    while (poll(&in, 1, -1) < 0 && errno == EINTR);
+    wakeWorld(world, path);
+}
 
+// Writes the world's snapshot to path, then frees its sector maps & events and releases its
+// quadrant buffers. Only the World itself stays. False if it couldn't be written
+bool hibernateWorld(World *world, const char *path) {
+    TRACE_BEGIN(t);
+    size_t size;
+    char *buf = encodeSnapshot(world, &size);
+    int fd = buf ? open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600) : -1;
+    bool written = fd >= 0 && write(fd, buf, size) == (ssize_t) size;
+    if (fd >= 0) close(fd);
+    free(buf);
+    if (!written) {
+        unlink(path);
+        return false;
     }
 
-    // Generate klingons in the world
-    for (int i=0; i<NUM_KL; i++) {
-        while (1) {
-            int q1 = randRange(0, 8);
-            int q2 = randRange(0, 8);
-            int s1 = randRange(0, 8);
-            int s2 = randRange(0, 8);
-
-            // Only Spawn 1 Klingon in The First Quadrant
-            if (i < 1) {
-                 q1 = 4;
-                 q2 = 5;
-                while ((s1 == 3 && s2 == 0)) { // Location can't overlap with player's
-                    s1 = randRange(0, 8);
-                    s2 = randRange(0, 8);
-                }
-            } else {
-                while (q1 == 4 || q2 == 5) {
-                    q1 = randRange(0, 8);
-                    q2 = randRange(0, 8);
-                }
-            }
-            // Make sure that there isn't 3 klingons in the same quadrant already & there isn't any starbases
-            if (world.quadrant[q1][q2].sector[s1][s2] == empty && world.quadrant[q1][q2].numKlingons <= 3 && !world.quadrant[q1][q2].numStarbases){
-                world.quadrant[q1][q2].sector[s1][s2] = 'K';
-                world.klingons[numK].pos[0] = q1;
-                world.klingons[numK].pos[1] = q2;
-                world.klingons[numK].pos[2] = s1;
-                world.klingons[numK].pos[3] = s2;
-                world.klingons[numK].energy = randRange(100, 301);
-                world.quadrant[q1][q2].numKlingons++;
-                numK++;
-                break;
-            }
+    if (world->tmpl) clearOverlay(world);
+    else freeMaps(world);
+    free(world->overlay);
+    free(world->maps);
+    free(world->events);
+    world->overlay = NULL;
+    world->capOverlay = 0;
+    world->maps = NULL;
+    world->numMaps = world->capMaps = 0;
+    world->events = NULL;
+    world->numEvents = world->capEvents = 0;
+    freeTactics(world);
+    if (world->pool) poolSleep(world->pool, world);
+#ifdef __GLIBC__
+    malloc_trim(0);
+#endif
+    feedEvent("%d: HIBERNATED", world->date);
+    TRACE_END(t, "hibernate");
+    return true;
+}
+
+// Brings a hibernated world back: regenerates it from its seed & puts it in the state of its
+// snapshot, like a recovery does
+void wakeWorld(World *world, const char *path) {
+    TRACE_BEGIN(t);
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    char *buf = NULL;
+    if (fd >= 0 && fstat(fd, &st) == 0) buf = malloc(st.st_size);
+    bool loaded = buf && read(fd, buf, st.st_size) == st.st_size;
+    if (fd >= 0) close(fd);
+
+    WorldConfig config = world->config;
+    WorldPool *pool = world->pool;
+    Counters counters = world->counters;
+    config.seed = world->seed;
+    worldInit(world, &config);
+    world->pool = pool;
+    world->counters = counters;
+    if (pool) poolWake(pool); // Generating ahead can start again now the game has its memory back
+    if (!loaded || !journalRestore(world, buf, st.st_size)) {
+        fprintf(stderr, "CAN'T WAKE THE GAME HIBERNATED TO %s\n", path);
+        exit(1);
+    }
+    free(buf);
+    unlink(path);
+    TRACE_END(t, "wake");
+}
+
+
+// Generates the galaxy of config & writes it to path as a template. The file only takes the name
+// once it's complete, so processes starting together never map half a template
+bool templateWrite(const char *path, const WorldConfig *config) {
+    WorldConfig cfg = *config;
+    if (!cfg.seed) cfg.seed = newSeed();
+    World world = {0};
+    worldInit(&world, &cfg);
+    int numQuads = cfg.rows * cfg.cols;
+    uint64_t *offsets = malloc(sizeof(uint64_t) * numQuads);
+    if (!offsets) {
+        freeWorld(&world);
+        return false;
+    }
+
+    Template head = {.magic = TEMPLATE_MAGIC, .numEvents = (uint32_t) world.numEvents, .config = cfg,
+                     .start = {world.start[0], world.start[1]}};
+    head.quadrants = ALIGN8(sizeof(Template));
+    head.field = head.quadrants + sizeof(Quadrant) * numQuads;
+    head.maps = head.field + ALIGN8(sizeof(int) * 2 * numQuads);
+    uint64_t end = head.maps + sizeof(uint64_t) * numQuads;
+    for (int q=0; q<numQuads; q++) {
+        offsets[q] = end;
+        end += ALIGN8(sizeof(SectorMap) + sizeof(Star) * world.quadrant[q].numStars);
+    }
+    head.events = end;
+    head.size = end + sizeof(Event) * head.numEvents;
+
+    char tmp[512];
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, (int) getpid());
+    FILE *out = fopen(tmp, "wb");
+    if (out) {
+        const char zeros[8] = {0};
+        fwrite(&head, sizeof(head), 1, out);
+        fwrite(zeros, head.quadrants - sizeof(head), 1, out);
+        for (int q=0; q<numQuads; q++) {
+            Quadrant quad = world.quadrant[q];
+            quad.map = NULL;
+            fwrite(&quad, sizeof(quad), 1, out);
         }
+        fwrite(world.sbDist, sizeof(int), numQuads, out);
+        fwrite(world.sbNearest, sizeof(int), numQuads, out);
+        fwrite(zeros, head.maps - head.field - sizeof(int) * 2 * numQuads, 1, out);
+        fwrite(offsets, sizeof(uint64_t), numQuads, out);
+        for (int q=0; q<numQuads; q++) { // One map at a time, so a huge galaxy never has them all at once
+            size_t size = sizeof(SectorMap) + sizeof(Star) * world.quadrant[q].numStars;
+            fwrite(touchQuadrant(&world, q / cfg.cols, q % cfg.cols), size, 1, out);
+            fwrite(zeros, ALIGN8(size) - size, 1, out);
+            freeMaps(&world);
+        }
+        fwrite(world.events, sizeof(Event), head.numEvents, out);
+    }
+    bool written = out && !ferror(out);
+    if (out && fclose(out)) written = false;
+    if (written) written = rename(tmp, path) == 0;
+    if (!written) unlink(tmp);
+    free(offsets);
+    freeWorld(&world);
+    return written;
+}
 
+// Maps the galaxy template at path, writing it from config first if there's no such file, and
+// makes it the one worlds are set up from. config takes on the template's galaxy: its size,
+// counts, days, seed & -T. Everything else (-j, the sweep parameters) stays the command line's
+bool templateOpen(const char *path, WorldConfig *config) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0 && errno == ENOENT && templateWrite(path, config)) fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) || (size_t) st.st_size < sizeof(Template)) {
+        if (fd >= 0) close(fd);
+        return false;
+    }
+    const Template *t = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (t == MAP_FAILED) return false;
+
+    uint64_t numQuads = (uint64_t) t->config.rows * t->config.cols;
+    if (t->magic != TEMPLATE_MAGIC || t->size != (uint64_t) st.st_size || !configValid(&t->config)
+        || t->maps + sizeof(uint64_t) * numQuads > t->size || t->events + sizeof(Event) * t->numEvents != t->size) {
+        munmap((void *) t, st.st_size);
+        return false;
     }
+    config->rows = t->config.rows;
+    config->cols = t->config.cols;
+    config->numKlingons = t->config.numKlingons;
+    config->numStarbases = t->config.numStarbases;
+    config->numStars = t->config.numStars;
+    config->days = t->config.days;
+    config->seed = t->config.seed;
+    config->tick = t->config.tick;
+    galaxyTemplate = t;
+    return true;
+}
 
-    // Generate stars in the world
-    for (int i=0; i<NUM_STARS; i++){
-        while (1) {
-            int q1 = randRange(0, 8);
-            int q2 = randRange(0, 8);
-            int s1 = randRange(0, 8);
-            int s2 = randRange(0, 8);
-            while ((s1 == 3 && s2 == 0) && (q1 == 4 && q2 == 5)) { // Location can't overlap with player's
-                s1 = randRange(0, 8);
-                s2 = randRange(0, 8);
-            }
-            if (world.quadrant[q1][q2].sector[s1][s2] == empty){
-                world.quadrant[q1][q2].sector[s1][s2] = '*';
-                world.stars[numStars].pos[0] = q1;
-                world.stars[numStars].pos[1] = q2;
-                world.stars[numStars].pos[2] = s1;
-                world.stars[numStars].pos[3] = s2;
-                world.stars[numStars].energy = 0; // Stars don't have energy
-                world.quadrant[q1][q2].numStars++;
-                numStars++;
-                break;
-            }
+// Sets up a world of the template t, for worldInit(): the galaxy & the events scheduled at the
+// start are the template's. Quadrants get overlays as the game goes
+void templateWorld(World *world, const Template *t) {
+    int numQuads = t->config.rows * t->config.cols;
+    world->tmpl = t;
+    world->seed = world->config.seed = t->config.seed;
+    world->numKlingons = t->config.numKlingons;
+    world->numStarbases = t->config.numStarbases;
+    world->sbDist = (int *) ((const char *) t + t->field); // Read only, see ownStarbaseField()
+    world->sbNearest = world->sbDist + numQuads;
+    const Event *events = (const Event *) ((const char *) t + t->events);
+    for (uint32_t i=0; i<t->numEvents; i++) scheduleEvent(world, events[i].type, events[i].arg, events[i].at);
+    touchQuadrant(world, world->start[0], world->start[1]);
+}
+
+void overlayInsert(Overlay **table, int cap, Overlay *o) {
+    unsigned mask = (unsigned) cap - 1, i = (unsigned) o->q * 2654435761u & mask;
+    while (table[i]) i = (i + 1) & mask;
+    table[i] = o;
+}
+
+// Gets a template world's overlay of quadrant q, copying the template's quadrant into a new one
+// if there's none yet. Overlays don't move once made, so pointers to their quadrants stay good
+Overlay *overlayQuadrant(World *world, int q) {
+    Overlay *o = findOverlay(world, q);
+    if (o) return o;
+    if (2 * (world->numOverlay + 1) > world->capOverlay) {
+        int cap = world->capOverlay ? world->capOverlay * 2 : 16;
+        Overlay **table = calloc(cap, sizeof(Overlay *));
+        if (!table) {
+            fprintf(stderr, "NOT ENOUGH MEMORY FOR A %dx%d GALAXY\n", world->config.rows, world->config.cols);
+            exit(1);
+        }
+        for (int i=0; i<world->capOverlay; i++) {
+            if (world->overlay[i]) overlayInsert(table, cap, world->overlay[i]);
         }
+        free(world->overlay);
+        world->overlay = table;
+        world->capOverlay = cap;
     }
+    o = malloc(sizeof(Overlay));
+    if (!o) {
+        fprintf(stderr, "NOT ENOUGH MEMORY FOR A %dx%d GALAXY\n", world->config.rows, world->config.cols);
+        exit(1);
+    }
+    *o = (Overlay) {q, ((const Quadrant *) ((const char *) world->tmpl + world->tmpl->quadrants))[q], 0, false};
+    overlayInsert(world->overlay, world->capOverlay, o);
+    world->numOverlay++;
+    return o;
+}
 
-    world.numKlingons = numK;
-    world.numStarbases = numSB;
-    cmdSRS(&world);
+// Quadrant q to change, which for a template world means its overlay
+Quadrant *ownQuadrant(World *world, int q) {
+    return world->tmpl ? &overlayQuadrant(world, q)->quad : &world->quadrant[q];
+}
 
-    return world;
+// Drops a template world's sector maps, overlays & starbase field of its own, if it has one.
+// The hash table is kept for the next game
+void clearOverlay(World *world) {
+    freeMaps(world);
+    for (int i=0; i<world->capOverlay; i++) {
+        free(world->overlay[i]);
+        world->overlay[i] = NULL;
+    }
+    world->numOverlay = 0;
+    const Template *t = world->tmpl;
+    if (world->sbDist && (const char *) world->sbDist != (const char *) t + t->field) free(world->sbDist);
+    world->sbDist = world->sbNearest = NULL;
 }
 
+// A template world reads the template's starbase field until the field has to change, then
+// gets a copy of its own
+void ownStarbaseField(World *world) {
+    const Template *t = world->tmpl;
+    if (!t || (const char *) world->sbDist != (const char *) t + t->field) return;
+    int numQuads = world->config.rows * world->config.cols;
+    int *field = malloc(sizeof(int) * 2 * numQuads);
+    if (!field) {
+        fprintf(stderr, "NOT ENOUGH MEMORY FOR A %dx%d GALAXY\n", world->config.rows, world->config.cols);
+        exit(1);
+    }
+    memcpy(field, world->sbDist, sizeof(int) * 2 * numQuads); // sbNearest follows sbDist in the template
+    world->sbDist = field;
+    world->sbNearest = field + numQuads;
+}
 
-void updateCond(World *world) {
-    world->player.condition = green;
-    int q1 = world->player.pos[0], q2 = world->player.pos[1];
-    if (world->quadrant[q1][q2].numStarbases > 0) world->player.condition = docked;
-    else if (world->quadrant[q1][q2].numKlingons > 0) world->player.condition = red;
-    else if (world->player.energy+world->player.shield < (PLAYER_ENERGY*0.1)) world->player.condition = yellow;
+// Bytes a game's world holds, not counting the allocator's own: the World, its sector maps &
+// events, and either its overlays or its buffers for every quadrant
+size_t worldBytes(World *world) {
+    size_t numQuads = (size_t) world->config.rows * world->config.cols;
+    size_t bytes = sizeof(World) + sizeof(int) * world->capMaps + sizeof(Event) * world->capEvents;
+    if (world->tactics) bytes += sizeof(Tactics) + sizeof(TacticsEntry) * world->tactics->cap;
+    for (int i=0; i<world->numMaps; i++) {
+        bytes += sizeof(SectorMap) + sizeof(Star) * quadrantAt(world, world->maps[i])->numStars;
+    }
+    if (!world->tmpl) {
+        return bytes + (sizeof(Quadrant) + sizeof(uint16_t) + 2 * sizeof(int)) * numQuads
+               + sizeof(uint64_t) * ((numQuads + 63) / 64);
+    }
+    bytes += sizeof(Overlay *) * world->capOverlay + sizeof(Overlay) * world->numOverlay;
+    if ((const char *) world->sbDist != (const char *) world->tmpl + world->tmpl->field) bytes += sizeof(int) * 2 * numQuads;
+    return bytes;
 }
 
-// Gets the n'th nearest chosen entity (klingons, starbases, or stars)
-Entity *getNearbyEntity(World *world, int n, char type) {
 
-    int q1 = world->player.pos[0], q2 = world->player.pos[1];
-    int numEntity;
-    int size;
-
-    // Get how many (chosen) entities in the quadrant
-    if (type == 's') {
-        numEntity = world->quadrant[q1][q2].numStars;
-        size = NUM_STARS;
-    } else if (type == 'b') {
-         numEntity = world->quadrant[q1][q2].numStarbases;
-        size = NUM_SB;
+// Gets the sector map of a quadrant, generating it on first touch (a template world copies the
+// template's, unless klingons have moved in or out since). The map only depends on the world
+// seed & the quadrant's counts, so untouched maps can be dropped & rebuilt
+SectorMap *touchQuadrant(World *world, int q1, int q2) {
+    int q = q1*world->config.cols + q2;
+    Quadrant *quad = quadrantAt(world, q);
+    Galaxy *g = world->galaxy;
+    if (g && shipThread && atomic_load_explicit(&g->holders[q], memory_order_relaxed) != shipThread) {
+        atomic_fetch_add_explicit(&g->unlocked, 1, memory_order_relaxed); // Checked by the -M report
+    }
+    if (quad->map) return quad->map;
+
+    size_t size = sizeof(SectorMap) + sizeof(Star) * quad->numStars;
+    SectorMap *map = malloc(size);
+    if (!map) {
+        fprintf(stderr, "NOT ENOUGH MEMORY FOR A %dx%d GALAXY\n", world->config.rows, world->config.cols);
+        exit(1); // Like the rest of the world's growth, its callers have no way to do without the map
+    }
+    const Template *t = world->tmpl;
+    if (t) {
+        const Quadrant *original = (const Quadrant *) ((const char *) t + t->quadrants) + q;
+        uint64_t offset;
+        memcpy(&offset, (const char *) t + t->maps + sizeof(uint64_t) * q, sizeof(offset));
+        if (packCounts(original) == packCounts(quad)) memcpy(map, (const char *) t + offset, size);
+        else generateMap(world, q1, q2, map);
+        quad = &overlayQuadrant(world, q)->quad;
     } else {
-        numEntity = world->quadrant[q1][q2].numKlingons;
-        size = NUM_KL;
+        generateMap(world, q1, q2, map);
+    }
+
+    // A ship's maps are the galaxy's. The caller holds the quadrant's lock, not the list's
+    World *owner = world->galaxy ? &world->galaxy->world : world;
+    if (world->galaxy) pthread_mutex_lock(&world->galaxy->mapsLock);
+    if (owner->numMaps == owner->capMaps) {
+        int cap = owner->capMaps ? owner->capMaps * 2 : 16;
+        int *maps = realloc(owner->maps, sizeof(int) * cap);
+        if (!maps) {
+            free(map); // The list is kept as it was, freeWorld still frees the maps on it
+            if (world->galaxy) pthread_mutex_unlock(&world->galaxy->mapsLock);
+            fprintf(stderr, "NOT ENOUGH MEMORY FOR A %dx%d GALAXY\n", world->config.rows, world->config.cols);
+            exit(1);
+        }
+        owner->maps = maps;
+        owner->capMaps = cap;
     }
+    owner->maps[owner->numMaps++] = q;
+    if (world->galaxy) pthread_mutex_unlock(&world->galaxy->mapsLock);
+    quad->map = map;
+    return map;
+}
 
-    if (numEntity <= 0) return NULL;
+// Fills in the sector map of a quadrant from the world seed
+void generateMap(World *world, int q1, int q2, SectorMap *map) {
+    const Quadrant *quad = getQuadrant(world, q1, q2);
+    Rng rng;
+    rngInit(&rng, world->seed, RNG_QUADRANT | (unsigned long long) (q1*world->config.cols + q2));
+    bool start = (q1 == world->start[0] && q2 == world->start[1]);
+    int numB = quad->numStarbases, numK = quad->numKlingons, numS = quad->numStars;
+
+    map->mutated = false;
+    memset(map->sector, ' ', sizeof(map->sector));
+    if (start) map->sector[3][0] = 'E'; // Location can't overlap with player's
+
+    // Starbases, then klingons, then stars, each in a free sector
+    for (int i=0; i<numB+numK+numS; i++) {
+        int s1, s2;
+        do {
+            s1 = rngRange(&rng, 0, QS_SIZE);
+            s2 = rngRange(&rng, 0, QS_SIZE);
+        } while (map->sector[s1][s2] != ' ');
+
+        Entity *entity;
+        if (i < numB) {
+            entity = &map->starbases[i];
+            entity->energy = PLAYER_ENERGY;
+            map->sector[s1][s2] = 'B';
+        } else if (i < numB+numK) {
+            entity = &map->klingons[i-numB];
+            entity->energy = rngRange(&rng, 100, 301);
+            map->sector[s1][s2] = 'K';
+        } else {
+            entity = &map->stars[i-numB-numK];
+            entity->energy = 0; // Stars don't have energy
+            map->sector[s1][s2] = '*';
+        }
+        entity->pos[0] = q1;
+        entity->pos[1] = q2;
+        entity->pos[2] = s1;
+        entity->pos[3] = s2;
+        entity->id = i + 1;
+    }
+    if (start) map->sector[3][0] = ' ';
+}
 
-    Entity *ePtr[numEntity];
-    double distance[numEntity];
+// Drops the sector maps the game doesn't need anymore: anything unchanged that isn't
+// in or next to the player's quadrant. They'll be rebuilt from the seed if touched again
+void evictQuadrants(World *world) {
+    if (world->galaxy) return; // Other ships may be looking at them
+    int cols = world->config.cols;
+    for (int i=0; i<world->numMaps; i++) {
+        int q = world->maps[i];
+        Quadrant *quad = quadrantAt(world, q);
+        if (quad->map->mutated) continue;
+        if (abs(q / cols - world->player.pos[0]) <= 1 && abs(q % cols - world->player.pos[1]) <= 1) continue;
+
+        free(quad->map);
+        quad->map = NULL;
+        world->maps[i--] = world->maps[--world->numMaps];
+    }
+}
 
-    int i = 0;
-    if (type == 's') { // If stars
-        for (int j=0; j<size; j++) {
-            if (world->stars[j].pos[0] == q1 && world->stars[j].pos[1] == q2) {
-                ePtr[i] = &world->stars[j];
-                distance[i] = getDistance(&(world->player), ePtr[i]->pos);
-                i++;
-            }
+
+// Sets the distance of quadrant q's unreached neighbours & appends them to the BFS queue.
+// Ships can move diagonally, so each quadrant has 8 neighbours (chebyshev distance)
+int spreadStarbaseField(World *world, int q, int *queue, int tail) {
+    int cols = world->config.cols;
+    int q1 = q / cols, q2 = q % cols;
+    for (int d1=-1; d1<=1; d1++) {
+        for (int d2=-1; d2<=1; d2++) {
+            if (!getQuadrant(world, q1+d1, q2+d2)) continue;
+            int n = (q1+d1)*cols + (q2+d2);
+            if (world->sbDist[n] != -1) continue;
+            world->sbDist[n] = world->sbDist[q] + 1;
+            world->sbNearest[n] = world->sbNearest[q];
+            queue[tail++] = n;
+        }
+    }
+    return tail;
+}
+
+// Multi-source BFS from every quadrant holding a starbase over the quadrant grid
+void buildStarbaseField(World *world) {
+    int numQuads = world->config.rows * world->config.cols;
+    int *queue = malloc(sizeof(int) * numQuads);
+    int head = 0, tail = 0;
+    ownStarbaseField(world);
+
+    for (int q=0; q<numQuads; q++) {
+        world->sbDist[q] = -1;
+        world->sbNearest[q] = -1;
+        if (quadrantAt(world, q)->numStarbases > 0) {
+            world->sbDist[q] = 0;
+            world->sbNearest[q] = q;
+            queue[tail++] = q;
         }
+    }
+
+    while (head < tail) {
+        tail = spreadStarbaseField(world, queue[head++], queue, tail);
+    }
+    free(queue);
+}
+
+int compareSeeds(const void *a, const void *b) {
+    long long x = *(const long long *) a, y = *(const long long *) b;
+    return (x > y) - (x < y);
+}
 
-    } else if (type == 'b') { // If starbases
-        for (int j=0; j<size; j++) {
-            if (world->starbases[j].pos[0] == q1 && world->starbases[j].pos[1] == q2) {
-                ePtr[i] = &world->starbases[j];
-                distance[i] = getDistance(&(world->player), ePtr[i]->pos);
-                i++;
+// Incremental update after the last starbase of quadrant (q1,q2) is destroyed.
+// Only the quadrants that were routed to it change: they are reset, then re-reached
+// by a BFS seeded from their untouched neighbours in order of distance
+void removeStarbaseFromField(World *world, int q1, int q2) {
+    int numQuads = world->config.rows * world->config.cols;
+    int cols = world->config.cols;
+    int gone = q1*cols + q2;
+    if (world->sbNearest[gone] != gone) return;
+    ownStarbaseField(world);
+
+    // The quadrants routed to a starbase are connected, so flood fill them from it
+    int *queue = malloc(sizeof(int) * numQuads);
+    int numAffected = 0;
+    queue[numAffected++] = gone;
+    world->sbDist[gone] = -1;
+    world->sbNearest[gone] = -1;
+    for (int i=0; i<numAffected; i++) {
+        int r = queue[i] / cols, c = queue[i] % cols;
+        for (int d1=-1; d1<=1; d1++) {
+            for (int d2=-1; d2<=1; d2++) {
+                if (!getQuadrant(world, r+d1, c+d2)) continue;
+                int n = (r+d1)*cols + (c+d2);
+                if (world->sbNearest[n] != gone) continue;
+                world->sbDist[n] = -1;
+                world->sbNearest[n] = -1;
+                queue[numAffected++] = n;
             }
         }
+    }
 
-    } else { // If Klingons
-        for (int j=0; j<size; j++) {
-            if (world->klingons[j].pos[0] == q1 && world->klingons[j].pos[1] == q2) {
-                ePtr[i] = &world->klingons[j];
-                distance[i] = getDistance(&(world->player), ePtr[i]->pos);
-                i++;
+    // Seeds are the reached quadrants bordering the reset area, keyed by distance
+    long long *seeds = malloc(sizeof(long long) * numAffected * 8);
+    int numSeeds = 0;
+    for (int i=0; i<numAffected; i++) {
+        int r = queue[i] / cols, c = queue[i] % cols;
+        for (int d1=-1; d1<=1; d1++) {
+            for (int d2=-1; d2<=1; d2++) {
+                if (!getQuadrant(world, r+d1, c+d2)) continue;
+                int n = (r+d1)*cols + (c+d2);
+                if (world->sbDist[n] >= 0) seeds[numSeeds++] = (long long) world->sbDist[n] * numQuads + n;
             }
         }
+    }
+    qsort(seeds, numSeeds, sizeof(long long), compareSeeds);
+
+    // BFS that merges the sorted seeds in, so quadrants are still settled in distance order
+    int head = 0, tail = 0, s = 0;
+    while (s < numSeeds || head < tail) {
+        int q;
+        if (s < numSeeds && (head == tail || seeds[s] / numQuads <= world->sbDist[queue[head]])) {
+            q = (int) (seeds[s++] % numQuads);
+        } else {
+            q = queue[head++];
+        }
+        tail = spreadStarbaseField(world, q, queue, tail);
+    }
+    free(seeds);
+    free(queue);
+}
+
+// O(1) lookup of the nearest starbase with the course & warp factor that reach it.
+// Returns false if no starbases are left
+bool nearestStarbase(World *world, Starbase **base, double *course, double *warp) {
+    int nearest = world->sbNearest[world->player.pos[0]*world->config.cols + world->player.pos[1]];
+    if (nearest < 0) return false;
+
+    // The quadrant holds at most MAX_QB starbases, take the closer one
+    int q1 = nearest / world->config.cols, q2 = nearest % world->config.cols;
+    SectorMap *map = touchQuadrant(world, q1, q2);
+    Starbase *target = NULL;
+    for (int i=0; i<getQuadrant(world, q1, q2)->numStarbases; i++) {
+        Starbase *sb = &map->starbases[i];
+        if (!target || getDistance(&world->player, sb->pos) < getDistance(&world->player, target->pos)) target = sb;
+    }
+
+    int fromRow = world->player.pos[0]*QS_SIZE + world->player.pos[2];
+    int fromCol = world->player.pos[1]*QS_SIZE + world->player.pos[3];
+    int toRow = target->pos[0]*QS_SIZE + target->pos[2], toCol = target->pos[1]*QS_SIZE + target->pos[3];
+    double dist;
+    calcDirection(fromRow, fromCol, toRow, toCol, course, &dist);
+
+    // Warp factor W moves floor(W)*8 + (first decimal of W) sectors along the course,
+    // and the course is scaled so its longest axis steps one sector at a time
+    int dRow = abs(toRow - fromRow), dCol = abs(toCol - fromCol);
+    int steps = dRow > dCol ? dRow : dCol;
+    *warp = (steps / QS_SIZE) + (steps % QS_SIZE) / 10.0;
+    *base = target;
+    return true;
+}
+
+
+// Saves a scanned quadrant's counts for the galactic record, packed as 4 bits klingons,
+// 4 bits starbases & 8 bits stars. Only words whose value changes are written
+void archiveQuadrant(World *world, int q1, int q2) {
+    int q = q1*world->config.cols + q2;
+    uint16_t counts = packCounts(quadrantAt(world, q));
+    uint64_t bit = 1ULL << (q % 64);
+
+    world->counters.archiveScans++;
+    if (world->tmpl) {
+        Overlay *o = overlayQuadrant(world, q);
+        if (o->archive != counts || !o->scanned) world->counters.archiveBytes += sizeof(uint16_t);
+        o->archive = counts;
+        o->scanned = true;
+        return;
+    }
+    if (world->archive[q] != counts) {
+        world->archive[q] = counts;
+        world->counters.archiveBytes += sizeof(uint16_t);
+    }
+    if (!(world->scanned[q / 64] & bit)) {
+        world->scanned[q / 64] |= bit;
+        world->counters.archiveBytes += sizeof(uint64_t);
+    }
+}
+
+// Whether quadrant q has been scanned, & if so its counts as of the last scan
+bool archivedCounts(World *world, int q, uint16_t *counts) {
+    if (world->tmpl) {
+        const Overlay *o = findOverlay(world, q);
+        if (!o || !o->scanned) return false;
+        *counts = o->archive;
+        return true;
+    }
+    if (!(world->scanned[q / 64] >> (q % 64) & 1)) return false;
+    *counts = world->archive[q];
+    return true;
+}
+
+void updateCond(World *world) {
+    if (world->condGen.quadrants == world->gen.quadrants && world->condGen.position == world->gen.position
+        && world->condGen.stats == world->gen.stats) {
+        world->counters.condSkipped++;
+        return;
+    }
+    world->condGen = world->gen;
+
+    world->player.condition = green;
+    Quadrant *quad = getQuadrant(world, world->player.pos[0], world->player.pos[1]);
+    if (quad->numStarbases > 0) world->player.condition = docked;
+    else if (quad->numKlingons > 0) world->player.condition = red;
+    else if (world->player.energy+world->player.shield < (world->config.energy*0.1)) world->player.condition = yellow;
+}
+
+// The array holding the chosen entities (klingons, starbases, or stars) of a sector map
+Entity *entitySlots(SectorMap *map, char type) {
+    if (type == 's') return map->stars;
+    if (type == 'b') return map->starbases;
+    return map->klingons;
+}
+
+unsigned char *entityCountPtr(Quadrant *quad, char type) {
+    if (type == 's') return &quad->numStars;
+    if (type == 'b') return &quad->numStarbases;
+    return &quad->numKlingons;
+}
+
+int entityCount(Quadrant *quad, char type) {
+    return *entityCountPtr(quad, type);
+}
+
+Handle getHandle(const Entity *entity, char type) {
+    Handle handle = {entity->pos[0], entity->pos[1], type, entity->id};
+    return handle;
+}
+
+// Gets the entity a handle refers to, or NULL if it has been removed
+Entity *resolveHandle(World *world, Handle handle) {
+    Quadrant *quad = getQuadrant(world, handle.q1, handle.q2);
+    if (!quad) return NULL;
+    Entity *slots = entitySlots(touchQuadrant(world, handle.q1, handle.q2), handle.type);
+    for (int i=0; i<entityCount(quad, handle.type); i++) {
+        if (slots[i].id == handle.id) return &slots[i];
+    }
+    return NULL;
+}
+
+// Removes a destroyed entity by moving the quadrant's last one of the same type into its slot.
+// Pointers into the array are invalid afterwards, hold a Handle across removals instead
+void removeEntity(World *world, Entity *entity, char type) {
+    int q1 = entity->pos[0], q2 = entity->pos[1];
+    Quadrant *quad = getQuadrant(world, q1, q2);
+    SectorMap *map = touchQuadrant(world, q1, q2);
+    unsigned char *count = entityCountPtr(quad, type);
+
+    map->sector[entity->pos[2]][entity->pos[3]] = ' ';
+    map->mutated = true;
+    world->gen.quadrants++;
+    feedEvent("%d: %s DESTROYED AT %d,%d", world->date, type == 'k' ? "KLINGON" : type == 'b' ? "STARBASE" : "STAR",
+              entity->pos[2]+1, entity->pos[3]+1);
+    *entity = entitySlots(map, type)[--*count];
+
+    if (type == 'k') world->numKlingons--;
+    if (type == 'k' && world->galaxy) {
+        atomic_fetch_sub(&world->galaxy->numKlingons, 1);
+        atomic_fetch_sub_explicit(&world->galaxy->klingons[q1*world->config.cols + q2], 1, memory_order_relaxed);
+    }
+    if (type == 'b') {
+        world->numStarbases--;
+        if (world->galaxy) pthread_mutex_lock(&world->galaxy->fieldLock);
+        if (quad->numStarbases == 0) removeStarbaseFromField(world, q1, q2);
+        if (world->galaxy) pthread_mutex_unlock(&world->galaxy->fieldLock);
+    }
+}
+
+// Gets the n'th nearest chosen entity (klingons, starbases, or stars) in the player's quadrant
+Entity *getNearbyEntity(World *world, int n, char type) {
+    STAT_COUNT(nearbyLookups);
+
+    int q1 = world->player.pos[0], q2 = world->player.pos[1];
+    Quadrant *quad = getQuadrant(world, q1, q2);
+    Entity *slots = entitySlots(touchQuadrant(world, q1, q2), type);
+    int numEntity = entityCount(quad, type);
+
+    if (n >= numEntity) return NULL;
+
+    Entity *ePtr[numEntity];
+    double distance[numEntity];
 
+    // Live entities are packed at the front of the array, so there's nothing to skip
+    for (int i=0; i<numEntity; i++) {
+        ePtr[i] = &slots[i];
+        distance[i] = getDistance(&(world->player), ePtr[i]->pos);
     }
+    world->counters.entityScans++;
+    world->counters.slotsScanned += numEntity;
+    world->counters.slotsSaved += (type == 's' ? 0 : (type == 'b' ? MAX_QB : MAX_QK) - numEntity);
 
     // Sort entities based on distance
     sortEntities(ePtr, distance, numEntity);
@@ -351,23 +5143,37 @@ Entity *getNearbyEntity(World *world, int n, char type) {
 
 
 void getCmd(World *world) {
-    printf("COMMAND: ");
+    TRACE_BEGIN(turn);
+    gamePrintf("COMMAND: ");
     char input[STR_SIZE];
+    flushOutput();
+    awaitCommand(world);
     fgets(input, STR_SIZE, stdin);
     for (int i=0; i<3; i++) input[i] = (char) toupper(input[i]); // Turn first 3 chars to upper
+    input[strcspn(input, "\n")] = '\0';
+    feedEvent("%d: COMMAND %.3s", world->date, input);
 
-    if (!strncmp(input, "NAV", 3)) cmdNAV(world);
-    else if (!strncmp(input, "SRS", 3)) cmdSRS(world);
-    else if (!strncmp(input, "LRS", 3)) cmdLRS(world);
-    else if (!strncmp(input, "PHA", 3)) cmdPHA(world);
-    else if (!strncmp(input, "TOR", 3)) cmdTOR(world);
-    else if (!strncmp(input, "SHE", 3)) cmdSHE(world);
-    else if (!strncmp(input, "DAM", 3)) cmdDAM(world);
-    else if (!strncmp(input, "COM", 3)) cmdCOM(world);
-    else if (!strncmp(input, "XXX", 3)) cmdXXX(world);
-    else if (!strncmp(input, "INS", 3)) printInstructions();
+    if (!strncmp(input, "NAV", 3)) SPAN(statNAV, "NAV", cmdNAV(world));
+    else if (!strncmp(input, "SRS", 3)) {
+        if (journalCommand(world, journalSRS, 0, 0)) SPAN(statSRS, "SRS", cmdSRS(world));
+    }
+    else if (!strncmp(input, "LRS", 3)) {
+        if (journalCommand(world, journalLRS, 0, 0)) SPAN(statLRS, "LRS", cmdLRS(world));
+    }
+    else if (!strncmp(input, "PHA", 3)) SPAN(statPHA, "PHA", cmdPHA(world));
+    else if (!strncmp(input, "TOR", 3)) SPAN(statTOR, "TOR", cmdTOR(world));
+    else if (!strncmp(input, "SHE", 3)) SPAN(statSHE, "SHE", cmdSHE(world));
+    else if (!strncmp(input, "DAM", 3)) SPAN(statDAM, "DAM", cmdDAM(world));
+    else if (!strncmp(input, "COM", 3)) SPAN(statCOM, "COM", cmdCOM(world));
+    else if (!strncmp(input, "XXX", 3)) SPAN(statXXX, "XXX", cmdXXX(world));
+    else if (!strncmp(input, "INS", 3)) SPAN(statINS, "INS", printInstructions());
+    else if (!strncmp(input, "PRE", 3)) SPAN(statPRE, "PREVIEW", cmdPRE(world, input));
+#ifdef STATS
+    else if (!strncmp(input, "STA", 3)) SPAN(statSTATS, "STATS", cmdSTATS(input));
+#endif
     else {
-        printf("ENTER ONE OF THE FOLLOWING : \n"
+        STAT_BEGIN(t);
+        gamePrintf("ENTER ONE OF THE FOLLOWING : \n"
                "  NAV  (TO SET COURSE)\n"
                "  SRS  (FOR SHORT RANGE SENSOR SCAN)\n"
                "  LRS  (FOR LONG RANGE SENSOR SCAN)\n"
@@ -377,39 +5183,59 @@ void getCmd(World *world) {
                "  DAM  (FOR DAMAGE CONTROL REPORTS)\n"
                "  COM  (TO CALL ON LIBRARY-COMPUTER)\n"
                "  XXX  (TO RESIGN YOUR COMMAND)\n"
-               "  INS  (TO PRINT GAME INSTRUCTIONS)\n\n");
+               "  INS  (TO PRINT GAME INSTRUCTIONS)\n"
+               "  PRE  (PREVIEW NAV COURSE WARP, OR PREVIEW TOR COURSE)\n\n");
+        STAT_END(t, statOther);
     }
-
+    TRACE_END(turn, "TURN");
 }
 
 
 void cmdNAV(World *world){
     double courseInput;
-    printf("COURSE (1-9) ");
+    gamePrintf("COURSE (1-9) ");
+    flushOutput();
     scanf("%lf", &courseInput);
     getchar();
 
     if ((courseInput < 1.0) || (courseInput > 9.0)) {
-        printf("LT. SULU REPORTS, 'INCORRECT COURSE DATA, SIR!'\n");
+        gamePrintf("LT. SULU REPORTS, 'INCORRECT COURSE DATA, SIR!'\n");
+        return;
+    }
+
+    double maxWarp = 8.0, warpInput;
+    if (world->player.damage[warp] < 0) {
+        maxWarp = 0.2;
+    }
+    gamePrintf("WARP FACTOR (0-%.1f) ", maxWarp);
+    flushOutput();
+    scanf("%lf", &warpInput);
+    getchar();
+    SPAN(statNavigate, "navigate", navigate(world, courseInput, warpInput));
+}
+
+
+// Moves the ship, for cmdNAV & autopilots
+void navigate(World *world, double courseInput, double warpInput){
+    if (!journalCommand(world, journalNAV, courseInput, warpInput)) return;
+    if ((courseInput < 1.0) || (courseInput > 9.0)) {
+        gamePrintf("LT. SULU REPORTS, 'INCORRECT COURSE DATA, SIR!'\n");
     } else {
 
-        double maxWarp = 8.0, warpInput;
+        double maxWarp = 8.0;
         if (world->player.damage[warp] < 0) {
             maxWarp = 0.2;
         }
-        printf("WARP FACTOR (0-%.1f) ", maxWarp);
-        scanf("%lf", &warpInput);
-        getchar();
         double N = floor(warpInput * 8 + 0.5);
 
         if ((warpInput < 0) || (warpInput > 8)) {
-            printf("CHIEF ENGINEER SCOTT REPORTS, 'THE ENGINES WON'T TAKE WARP %.1lf!'\n", warpInput);
+            gamePrintf("CHIEF ENGINEER SCOTT REPORTS, 'THE ENGINES WON'T TAKE WARP %.1lf!'\n", warpInput);
 
         } else if (warpInput > maxWarp) {
-            printf("WARP ENGINES ARE DAMAGED.  MAXIMUM SPEED = WARP %.1lf\n", maxWarp);
+            gamePrintf("WARP ENGINES ARE DAMAGED.  MAXIMUM SPEED = WARP %.1lf\n", maxWarp);
 
         } else if (N > (world->player.energy+world->player.shield)) {
-            printf("ENGINEERING REPORTS 'INSUFFICIENT ENERGY AVAILABLE\n"
+            gamePrintf("ENGINEERING REPORTS 'INSUFFICIENT ENERGY AVAILABLE\n"
                    "                     FOR MANEUVERING AT WARP %.1lf!'\n", warpInput);
             return;
 
@@ -417,125 +5243,41 @@ void cmdNAV(World *world){
             int q1 = world->player.pos[0], q2 = world->player.pos[1];
 
             // Let the klingons nearby shoot
-            if (world->quadrant[q1][q2].numKlingons > 0) {
+            if (getQuadrant(world, q1, q2)->numKlingons > 0) {
                 klingonShooting(world);
             }
 
-            int courseMovement[10][3] = {
-                    {0,0,0},    // NOTHING
-                    {0,0,1},    // 1
-                    {0,-1,1},   // 2
-                    {0,-1,0},   // 3
-                    {0,-1,-1},  // 4
-                    {0,0,-1},   // 5
-                    {0,1,-1},   // 6
-                    {0,1,0},    // 7
-                    {0,1,1},    // 8
-                    {0,0,1},    // 9
-            };
-
-            double rowStep,  colStep; // torpedo course
-            int s1 = world->player.pos[2], s2 = world->player.pos[3];
-            double posRowFl, posColFl;
-            int posRow, posCol; // used for torpedo track
-
-            world->quadrant[q1][q2].sector[s1][s2] = ' ';// remove player from current pos
-
-            double quadFl;
-            double sectFl = modf(warpInput, &quadFl);
-            int numQuad = floor(quadFl);
-            int numSect = (int) floor(sectFl * 10.00) + 1;
-            int countQuad = 0, countSect = 0;
-            int count = ((numQuad * 8) + numSect) - 1;
-
-            int courseInt = (int)floor(courseInput);
-            rowStep = courseMovement[courseInt][1] + (courseMovement[courseInt + 1][1] - courseMovement[courseInt][1]) * (courseInput - courseInt);
-            colStep = courseMovement[courseInt][2] + (courseMovement[courseInt + 1][2] - courseMovement[courseInt][2]) * (courseInput - courseInt);
-
-
-            // SHIP MOVEMENT:
-            bool stop = false;
-            while (countSect < count && !stop) {
-                ////////////////
-                posRowFl = s1 + 1;
-                posColFl = s2 + 1;
-
-                // GET ALL STARS NEARBY
-                int stars = world->quadrant[q1][q2].numStars;
-                const Star *sNearby[stars];
-                for (int k=0; k<stars; k++) {
-                    sNearby[k] = getNearbyEntity(world, k, 's');
-                }
-
-
-                // For every possible move inside the quadrant
-                while (countSect < count) {
-                    countSect++;
-                    posRowFl = (posRowFl + rowStep);
-                    posColFl = (posColFl + colStep);
-                    posRow = (int) floor(posRowFl + 0.5);
-                    posCol = (int) floor(posColFl + 0.5);
-
-                    // Ship went outside quadrant
-                    if ((posRow < 1) || (posRow > 8) || (posCol < 1) || (posCol > 8)){
-                        countQuad++;
-                        if (posRow < 1) {
-                            posRow = 8;
-                            s1 = 7;
-                            q1 -= 1;
-                        } else if (posRow > 8) {
-                            posRow = 1;
-                            s1 = 0;
-                            q1 += 1;
-                        } else if (posCol < 1) {
-                            posCol = 8;
-                            s2 = 7;
-                            q2 -= 1;
-                        } else if (posCol > 8) {
-                            posCol = 1;
-                            s2 = 0;
-                            q2 += 1;
-                        }
-                        break;
-                    }
-
-                    // Check for stars collision
-                    for (int k=0; k<stars-1; k++) {
-                        if (posRow == sNearby[k]->pos[2]+1 && posCol == sNearby[k]->pos[3]+1) {
-                            // Torpedo hit star
-                            printf("WARP ENGINES SHUT DOWN AT SECTOR %i,%i DUE TO BAD NAVIGATION.\n", posRow, posCol);
-                            stop = true;
-                            break;
-                        }
-                    }
-                    if (stop) break;
-
-                }
-                ///////////////
+            touchQuadrant(world, q1, q2)->sector[world->player.pos[2]][world->player.pos[3]] = ' '; // remove player from current pos
+            Track track;
+            navTrack(world, courseInput, warpInput, false, &track);
+            if (track.stop == '|') {
+                gamePrintf("LT. UHURA REPORTS MESSAGE FROM STARFLEET COMMAND:\n"
+                       "  'PERMISSION TO ATTEMPT CROSSING OF GALACTIC PERIMETER\n"
+                       "  IS HEREBY *DENIED*. SHUT DOWN YOUR ENGINES.'\n");
+            } else if (track.stop != ' ') {
+                gamePrintf("WARP ENGINES SHUT DOWN AT SECTOR %i,%i DUE TO BAD NAVIGATION.\n", track.pos[2]+1, track.pos[3]+1);
             }
-
+            q1 = track.pos[0];
+            q2 = track.pos[1];
 
             Player *pl = &world->player;
             pl->pos[0] = q1;
             pl->pos[1] = q2;
-            pl->pos[2] = posRow-1;
-            pl->pos[3] = posCol-1;
-
-            //Advance days & subtract energy
-            world->daysRem -= 1;
-            world->date += 1;
-            world->player.energy -= floor(N);
-
-            if (!world->gameOver) {
-                if (randRange(0, 5) == 0) {
-                    for (int i=0; i<8; i++){
-                        printf("REPAIRING IN PROGRESS\n");
-                        world->player.damage[i] = 0;
-                    }
-                }
+            pl->pos[2] = track.pos[2];
+            pl->pos[3] = track.pos[3];
+            evictQuadrants(world);
 
-                cmdSRS(world);
+            //Advance time & subtract energy. Sublight moves take tenths of a stardate, as in the original
+            double days = warpInput < 1 ? fmax(0.1, floor(warpInput * 10) / 10) : 1;
+            world->player.energy -= floor(N);
+            world->gen.position++;
+            world->gen.stats++;
+            if (getQuadrant(world, q1, q2)->numStarbases > 0) {
+                scheduleEvent(world, eventResupply, 0, world->clock + days); // Docked on arrival
             }
+            advanceClock(world, days);
+
+            if (!world->gameOver) cmdSRS(world);
 
 
             ////////
@@ -547,36 +5289,36 @@ void cmdNAV(World *world){
 
 
 void printStat(World *world, int n){
-    printf("       ");
+    gamePrintf("       ");
     switch (n) {
         case 0:
-            printf("STARDATE:            %i\n", world->date);
+            gamePrintf("STARDATE:            %.1lf\n", START_DATE + world->clock);
             break;
         case 1: {
-            char cond[7] = "GREEN";
+            char cond[9] = "GREEN";
             if (world->player.condition == yellow) strcpy(cond, "*YELLOW*");
             else if (world->player.condition == red) strcpy(cond, "*RED*");
             else if (world->player.condition == docked) strcpy(cond, "DOCKED");
-            printf("CONDITION:           %s\n", cond);
+            gamePrintf("CONDITION:           %s\n", cond);
             break;
         }
         case 2:
-            printf("QUADRANT:            %i,%i\n", world->player.pos[0]+1, world->player.pos[1]+1);
+            gamePrintf("QUADRANT:            %i,%i\n", world->player.pos[0]+1, world->player.pos[1]+1);
             break;
         case 3:
-            printf("SECTOR:              %i,%i\n", world->player.pos[2]+1, world->player.pos[3]+1);
+            gamePrintf("SECTOR:              %i,%i\n", world->player.pos[2]+1, world->player.pos[3]+1);
             break;
         case 4:
-            printf("PHOTON TORPEDOES:    %i\n", world->player.photon);
+            gamePrintf("PHOTON TORPEDOES:    %i\n", world->player.photon);
             break;
         case 5:
-            printf("TOTAL ENERGY:        %i\n", world->player.energy+world->player.shield);
+            gamePrintf("TOTAL ENERGY:        %i\n", world->player.energy+world->player.shield);
             break;
         case 6:
-            printf("SHIELDS:             %i\n", world->player.shield);
+            gamePrintf("SHIELDS:             %i\n", world->player.shield);
             break;
         case 7:
-            printf("KLINGONS REMAINING:  %i [%i]\n", world->numKlingons, world->quadrant[world->player.pos[0]][world->player.pos[1]].numKlingons);
+            gamePrintf("KLINGONS REMAINING:  %i [%i]\n", world->numKlingons, getQuadrant(world, world->player.pos[0], world->player.pos[1])->numKlingons);
             break;
         default:
             break;
@@ -587,85 +5329,112 @@ void printStat(World *world, int n){
 void cmdSRS(World *world){
     // Check if SRS is operable
     if (world->player.damage[srs] < 0) {
-        printf("*** SHORT RANGE SENSORS ARE OUT ***\n");
+        gamePrintf("*** SHORT RANGE SENSORS ARE OUT ***\n");
         return;
     }
     int q1 = world->player.pos[0], q2 = world->player.pos[1];
-    int s1P = world->player.pos[2], s2P = world->player.pos[3];
-    world->quadrant[q1][q2].sector[s1P][s2P] = 'E';
+    Quadrant *quad = getQuadrant(world, q1, q2);
+    SectorMap *map = touchQuadrant(world, q1, q2);
 
     // Check shield & nearby klingons
-    printf("\n");
-    if (world->quadrant[q1][q2].numKlingons > 0) printf("COMBAT AREA      CONDITION RED\n");
-    if (world->player.shield <= 200) printf("   SHIELDS DANGEROUSLY LOW\n");
+    gamePrintf("\n");
+    if (quad->numKlingons > 0) gamePrintf("COMBAT AREA      CONDITION RED\n");
+    if (world->player.shield <= 200) gamePrintf("   SHIELDS DANGEROUSLY LOW\n");
     updateCond(world);
 
 
-//    printf("QUADRANT: %i,%i\n", world->player.pos[0]+1, world->player.pos[1]+1);
-    printf("------------------------------------\n");
-    for (int s1=0; s1<QS_SIZE; s1++) {
-
-        // Buffer spaces at the start of each sector row
-        // (and + or < instead of space if the column after contains the player or klingons)
-        for (int i=0; i<3; i++) {
-            if (world->quadrant[q1][q2].sector[s1][0] == 'K' && i == 2) printf("+");
-            else if (world->quadrant[q1][q2].sector[s1][0] == 'E' && i == 2) printf("<");
-            else if (world->quadrant[q1][q2].sector[s1][0] == 'B' && i == 2) printf(">");
-            else printf(" ");
-        }
-
-        // Go through sector columns
-        for (int s2=0; s2<QS_SIZE; s2++){
-
-            // Print sector column
-            printf("%c",world->quadrant[q1][q2].sector[s1][s2]);
+//    gamePrintf("QUADRANT: %i,%i\n", world->player.pos[0]+1, world->player.pos[1]+1);
+    // Redraw the sector rows only if the ship moved or something in the quadrant changed
+    TRACE_BEGIN(render);
+    if (world->boardGen.quadrants == world->gen.quadrants && world->boardGen.position == world->gen.position) {
+        world->counters.boardSkipped++;
+    } else {
+        world->boardGen = world->gen;
+        map->sector[world->player.pos[2]][world->player.pos[3]] = 'E';
+        for (int s1=0; s1<QS_SIZE; s1++) {
+            char *out = world->srsBoard[s1];
 
-            // Buffer spaces after each sector column
-            // (and + or <> instead of space if the column contains the player or klingons)
+            // Buffer spaces at the start of each sector row
+            // (and + or < instead of space if the column after contains the player or klingons)
             for (int i=0; i<3; i++) {
-                if ((world->quadrant[q1][q2].sector[s1][s2] == 'K' && i == 0)
-                    || (world->quadrant[q1][q2].sector[s1][s2+1] == 'K' && i == 2 && s2<QS_SIZE-1)) printf("+");
-                else if ((world->quadrant[q1][q2].sector[s1][s2] == 'E' && i == 0)
-                        || (world->quadrant[q1][q2].sector[s1][s2+1] == 'B' && i == 2 && s2<QS_SIZE-1)) printf(">");
-                else if ((world->quadrant[q1][q2].sector[s1][s2+1] == 'E' && i == 2 && s2<QS_SIZE-1)
-                        || (world->quadrant[q1][q2].sector[s1][s2] == 'B' && i == 0)) printf("<");
-                else printf(" ");
+                if (map->sector[s1][0] == 'K' && i == 2) *out++ = '+';
+                else if (map->sector[s1][0] == 'E' && i == 2) *out++ = '<';
+                else if (map->sector[s1][0] == 'B' && i == 2) *out++ = '>';
+                else *out++ = ' ';
             }
 
+            // Go through sector columns
+            for (int s2=0; s2<QS_SIZE; s2++){
+
+                // Sector column
+                *out++ = map->sector[s1][s2];
+
+                // Buffer spaces after each sector column
+                // (and + or <> instead of space if the column contains the player or klingons)
+                for (int i=0; i<3; i++) {
+                    if ((map->sector[s1][s2] == 'K' && i == 0)
+                        || (s2<QS_SIZE-1 && map->sector[s1][s2+1] == 'K' && i == 2)) *out++ = '+';
+                    else if ((map->sector[s1][s2] == 'E' && i == 0)
+                            || (s2<QS_SIZE-1 && map->sector[s1][s2+1] == 'B' && i == 2)) *out++ = '>';
+                    else if ((s2<QS_SIZE-1 && map->sector[s1][s2+1] == 'E' && i == 2)
+                            || (map->sector[s1][s2] == 'B' && i == 0)) *out++ = '<';
+                    else *out++ = ' ';
+                }
+
+            }
+            *out = '\0';
         }
-        printStat(world, s1);
+    }
 
+    screenCapture(SCREEN_SRS, SCREEN_RECORD);
+    gamePrintf("------------------------------------\n");
+    for (int s1=0; s1<QS_SIZE; s1++) {
+        gamePrintf("%s", world->srsBoard[s1]);
+        printStat(world, s1);
     }
-    printf("------------------------------------\n");
+    gamePrintf("------------------------------------\n");
+    screenRelease();
+    TRACE_END(render, "renderSRS");
 
-    world->quadrant[q1][q2].scanned = true;
-    world->quadrantArch[q1][q2] = world->quadrant[q1][q2];
+    if (world->archiveGen.quadrants == world->gen.quadrants && world->archiveGen.position == world->gen.position) {
+        world->counters.archiveSkipped++;
+        return;
+    }
+    world->archiveGen = world->gen;
+    archiveQuadrant(world, q1, q2);
 
 }
 
 
 void cmdLRS(World *world){
     if (world->player.damage[lrs] < 0) {
-        printf("LONG RANGE SENSORS ARE INOPERABLE\n");
+        gamePrintf("LONG RANGE SENSORS ARE INOPERABLE\n");
         return;
     }
 
     int q1 = world->player.pos[0], q2 = world->player.pos[1];
-    printf("LONG RANGE SCAN FOR QUADRANT %d,%d\n", q1+1, q2+1);
-    printf("    -------------------\n");
+    gamePrintf("LONG RANGE SCAN FOR QUADRANT %d,%d\n", q1+1, q2+1);
+    gamePrintf("    -------------------\n");
 
     // Rows
     for (int i=q1-1; i<=q1+1; i++) {
-        printf(" :  ");
+        gamePrintf(" :  ");
         // Columns
         for (int j=q2-1; j<=q2+1; j++) {
+            // Beyond the edge of the galaxy
+            Quadrant *quad = getQuadrant(world, i, j);
+            if (!quad) {
+                gamePrintf("***  :  ");
+                continue;
+            }
             // Print nearby quadrants
-            printf("%d%d%d  :  ", world->quadrant[i][j].numKlingons, world->quadrant[i][j].numStarbases, world->quadrant[i][j].numStars);
-            // Set nearby quadrants as scanned and save their info in the archive
-            world->quadrant[i][j].scanned = true;
-            world->quadrantArch[i][j] = world->quadrant[i][j];
+            gamePrintf("%d%d%d  :  ", quad->numKlingons, quad->numStarbases, quad->numStars);
+            // Set nearby quadrants as scanned and save their info in the archive.
+            // They're the likely next destinations, so their sector maps get built too
+            touchQuadrant(world, i, j);
+            archiveQuadrant(world, i, j);
         }
-        printf("\n    -------------------\n");
+        gamePrintf("\n    -------------------\n");
     }
 
 
@@ -674,141 +5443,178 @@ void cmdLRS(World *world){
 
 void cmdPHA(World *world){
     int q1 = world->player.pos[0], q2 = world->player.pos[1];
+    Quadrant *quad = getQuadrant(world, q1, q2);
 
     if (world->player.damage[pha] < 0) {
-        printf("PHASERS INOPERATIVE\n");
+        gamePrintf("PHASERS INOPERATIVE\n");
 
-    } else if (world->quadrant[q1][q2].numKlingons <= 0) {
-        printf("SCIENCE OFFICER SPOCK REPORTS  'SENSORS SHOW NO ENEMY SHIPS\n"
+    } else if (quad->numKlingons <= 0) {
+        gamePrintf("SCIENCE OFFICER SPOCK REPORTS  'SENSORS SHOW NO ENEMY SHIPS\n"
                "                              IN THIS QUADRANT'");
 
     } else {
 
         if (world->player.damage[libComp] < 0) {
-            printf("COMPUTER FAILURE HAMPERS ACCURACY\n");
+            gamePrintf("COMPUTER FAILURE HAMPERS ACCURACY\n");
         }
 
-        printf("PHASERS LOCKED ON TARGET;  ENERGY AVAILABLE = %d UNITS\nNUMBER OF UNITS TO FIRE? ",
+        gamePrintf("PHASERS LOCKED ON TARGET;  ENERGY AVAILABLE = %d UNITS\nNUMBER OF UNITS TO FIRE? ",
                world->player.energy);
 
         int input = 0;
         bool inputAccepted = false;
         while (!inputAccepted) {
+            flushOutput();
             if (!scanf("%i", &input)) {
                 while (fgetc(stdin) != '\n');  // Trim extra input in buffer
-                printf("?REENTER\n NUMBER OF UNITS TO FIRE? ");
+                gamePrintf("?REENTER\n NUMBER OF UNITS TO FIRE? ");
                 continue;
             }
             while(fgetc(stdin)!='\n');  // Trim extra input in buffer
             if (input > world->player.energy) {
-                printf("ENERGY AVAILABLE = %i\n NUMBER OF UNITS TO FIRE? ", world->player.energy);
+                gamePrintf("ENERGY AVAILABLE = %i\n NUMBER OF UNITS TO FIRE? ", world->player.energy);
 
             }
             else if (input > 0) inputAccepted = true;
             else return;
         }
-        // Handling Attacking
-        world->player.energy -= input; // Remove used energy
-        int dmgPerK = input / world->quadrant[q1][q2].numKlingons;
+        SPAN(statPhasers, "firePhasers", firePhasers(world, input));
+    }
+}
 
-        // Generate array of type Klingon that points to all nearby klingons
-        int klingons = world->quadrant[q1][q2].numKlingons;
-        Klingon *kNearby[klingons];
-        for (int k=0; k<klingons; k++) {
-            kNearby[k] = getNearbyEntity(world, k, 'k');
-        }
 
-        for (int i=0; i<klingons; i++) {
+// Fires units of phaser energy, split over the klingons in the quadrant, for cmdPHA & autopilots
+void firePhasers(World *world, int input){
+    if (!journalCommand(world, journalPHA, input, 0)) return;
+    int q1 = world->player.pos[0], q2 = world->player.pos[1];
+    Quadrant *quad = getQuadrant(world, q1, q2);
+    if (world->player.damage[pha] < 0 || quad->numKlingons <= 0 || input <= 0 || input > world->player.energy) return;
+
+    // Handling Attacking
+    world->player.energy -= input; // Remove used energy
+    world->gen.stats++;
+    int dmgPerK = input / quad->numKlingons;
+
+    // Handles to all nearby klingons. A destroyed klingon's slot is taken over by
+    // another one, so plain pointers could end up on the wrong ship
+    int klingons = quad->numKlingons;
+    Handle kNearby[klingons];
+    for (int k=0; k<klingons; k++) {
+        kNearby[k] = getHandle(getNearbyEntity(world, k, 'k'), 'k');
+    }
 
-            Klingon *target = kNearby[i];
-            int dmgApplied = (int) ((dmgPerK / getDistance(&(world->player), target->pos)) * (drand()+2));
+    for (int i=0; i<klingons; i++) {
 
-            if (dmgApplied > (0.15 * target->energy)) {
-                printf("%i UNIT HIT ON KLINGON AT SECTOR %i,%i\n", dmgApplied, target->pos[2]+1, target->pos[3]+1);
-                target->energy -= dmgApplied;
+        Klingon *target = resolveHandle(world, kNearby[i]);
+        int dmgApplied = (int) ((dmgPerK / getDistance(&(world->player), target->pos)) * (drand()+2));
+        dmgApplied = dmgApplied * world->config.phasers / 100;
 
-                if (target->energy <= 0) { // Klingon destroyed
-                    printf("*** KLINGON DESTROYED ***\n");
-                    world->numKlingons--;
-                    world->quadrant[q1][q2].numKlingons--;
-                    world->quadrant[q1][q2].sector[target->pos[2]][target->pos[3]] = ' ';
-                    target->energy = -1;
-                    target->pos[0] = -1; // So it doesn't count when performing other commands
+        if (dmgApplied > (0.15 * target->energy)) {
+            gamePrintf("%i UNIT HIT ON KLINGON AT SECTOR %i,%i\n", dmgApplied, target->pos[2]+1, target->pos[3]+1);
+            target->energy -= dmgApplied;
+            quad->map->mutated = true;
 
-                } else {
-                    printf("    (SENSORS SHOW %i UNITS REMAINING)\n", target->energy);
-                }
+            if (target->energy <= 0) { // Klingon destroyed
+                gamePrintf("*** KLINGON DESTROYED ***\n");
+                removeEntity(world, target, 'k');
 
             } else {
-                printf("SENSORS SHOW NO DAMAGE TO ENEMY AT %d,%d\n", target->pos[2]+1, target->pos[3]+1);
-
+                gamePrintf("    (SENSORS SHOW %i UNITS REMAINING)\n", target->energy);
             }
 
+        } else {
+            gamePrintf("SENSORS SHOW NO DAMAGE TO ENEMY AT %d,%d\n", target->pos[2]+1, target->pos[3]+1);
 
         }
-        klingonShooting(world);
+
 
     }
+    klingonShooting(world);
+
 }
 
 
 void klingonShooting(World *world) {
+    TRACE_BEGIN(t);
     int q1 = world->player.pos[0], q2 = world->player.pos[1];
+    Quadrant *quad = getQuadrant(world, q1, q2);
 
-    if (world->quadrant[q1][q2].numStarbases > 0) {
-        printf("STARBASE SHIELDS PROTECT THE ENTERPRISE\n");
+    if (quad->numStarbases > 0) {
+        gamePrintf("STARBASE SHIELDS PROTECT THE ENTERPRISE\n");
+        TRACE_END(t, "klingonShooting");
         return;
     }
 
     // For every klingon nearby
-    for (int i=0; i<world->quadrant[q1][q2].numKlingons; i++) {
+    for (int i=0; i<quad->numKlingons; i++) {
         Klingon *shooter = getNearbyEntity(world, i, 'k');
         int dmg = (int) ((shooter->energy / getDistance(&(world->player), shooter->pos)) * (drand()+2));
+        dmg = dmg * world->config.fire / 100;
         shooter->energy /= (int) (drand()+3);
+        quad->map->mutated = true;
         world->player.shield -= dmg; // Deduct damage taken
-        printf("%i UNIT HIT ON ENTERPRISE FROM SECTOR %i,%i\n", dmg, shooter->pos[2]+1, shooter->pos[3]+1);
+        world->gen.stats++;
+        feedEvent("%d: %d UNIT HIT ON ENTERPRISE", world->date, dmg);
+        gamePrintf("%i UNIT HIT ON ENTERPRISE FROM SECTOR %i,%i\n", dmg, shooter->pos[2]+1, shooter->pos[3]+1);
 
         if (world->player.shield < 0) {
-            printf("\n\nTHE ENTERPRISE HAS BEEN DESTROYED. THE FEDERATION WILL BE CONQUERED\n");
+            gamePrintf("\n\nTHE ENTERPRISE HAS BEEN DESTROYED. THE FEDERATION WILL BE CONQUERED\n");
             world->gameOver = true;
+            TRACE_END(t, "klingonShooting");
             return;
         }
-        printf("      <SHIELDS DOWN TO %i UNITS>\n", world->player.shield);
+        gamePrintf("      <SHIELDS DOWN TO %i UNITS>\n", world->player.shield);
 
         //IF RND(1)>.6ORH/S<=.02
-        if (drand() > 0.6 && (dmg/world->player.shield) <= 0.2) {
+        if (drand() > 0.6 && world->player.shield > 0 && (dmg/world->player.shield) <= 0.2) {
             int damageIndex = floor(drand() * 8);
             world->player.damage[damageIndex] -= -(dmg / world->player.shield - 0.5*drand());
-            printf("DAMAGE CONTROL REPORTS %s DAMAGED BY THE HIT'\n\n", world->statNames[damageIndex]);
+            world->gen.damage++;
+            world->repairDue[damageIndex] = world->clock - world->player.damage[damageIndex] * REPAIR_DAYS;
+            scheduleEvent(world, eventRepair, damageIndex, world->repairDue[damageIndex]);
+            gamePrintf("DAMAGE CONTROL REPORTS %s DAMAGED BY THE HIT'\n\n", deviceNames[damageIndex]);
 
         }
 
     }
-
+    TRACE_END(t, "klingonShooting");
 }
 
 
 void cmdSHE(World *world){
     if (world->player.damage[she] < 0) {
-        printf("SHIELD CONTROL INOPERABLE\n\n");
+        gamePrintf("SHIELD CONTROL INOPERABLE\n\n");
         return;
     }
 
-    printf("ENERGY AVAILABLE = %i\n     NUMBER OF UNITS TO SHIELDS? ", world->player.energy+world->player.shield);
+    gamePrintf("ENERGY AVAILABLE = %i\n     NUMBER OF UNITS TO SHIELDS? ", world->player.energy+world->player.shield);
     int input = 0;
+    flushOutput();
     scanf("%i", &input);
     while(fgetc(stdin)!='\n');  // Trim extra input in buffer
+    SPAN(statShields, "setShields", setShields(world, input));
+}
+
+
+// Puts input units of the ship's energy in the shields, for cmdSHE & autopilots
+void setShields(World *world, int input){
+    if (!journalCommand(world, journalSHE, input, 0)) return;
+    if (world->player.damage[she] < 0) {
+        gamePrintf("SHIELD CONTROL INOPERABLE\n\n");
+        return;
+    }
 
     if (input == world->player.shield || input < 1) {
-        printf("\n<SHIELDS UNCHANGED>\n");
+        gamePrintf("\n<SHIELDS UNCHANGED>\n");
 
     } else if (input <= world->player.energy+world->player.shield) {
         world->player.energy = (world->player.energy+world->player.shield) - input;
         world->player.shield = input;
-        printf("DEFLECTOR CONTROL ROOM REPORT : \n"
+        world->gen.stats++;
+        gamePrintf("DEFLECTOR CONTROL ROOM REPORT : \n"
                "\'SHIELDS NOW AT %i UNITS PER YOUR COMMAND\'\n\n", world->player.shield);
     } else {
-        printf("SHIELD CONTROL REPORTS : \n"
+        gamePrintf("SHIELD CONTROL REPORTS : \n"
                " \'THIS IS NOT THE FEDERATION TREASURY.\'\n\n");
     }
 
@@ -817,299 +5623,873 @@ void cmdSHE(World *world){
 
 void cmdDAM(World *world){
     if (world->player.damage[libComp] < 0) {
-        printf("DAMAGE CONTROL REPORT NOT AVAILABLE\n");
+        gamePrintf("DAMAGE CONTROL REPORT NOT AVAILABLE\n");
         return;
     }
-    printf("DEVICE                    STATE OF REPAIR\n");
-    printf("WARP ENGINES:             %lf\n", world->player.damage[warp]);
-    printf("SHORT RANGE SENSORS:      %lf\n", world->player.damage[srs]);
-    printf("LONG RANGE SENSORS:       %lf\n", world->player.damage[lrs]);
-    printf("PHASER CONTROL:           %lf\n", world->player.damage[pha]);
-    printf("PHOTON TUBES:             %lf\n", world->player.damage[tor]);
-    printf("DAMAGE CONTROL:           %lf\n", world->player.damage[damageControl]);
-    printf("SHIELD CONTROL:           %lf\n", world->player.damage[she]);
-    printf("LIBRARY-COMPUTER:         %lf\n", world->player.damage[libComp]);
-    printf("\n");
+    gamePrintf("DEVICE                    STATE OF REPAIR\n");
+    gamePrintf("WARP ENGINES:             %lf\n", world->player.damage[warp]);
+    gamePrintf("SHORT RANGE SENSORS:      %lf\n", world->player.damage[srs]);
+    gamePrintf("LONG RANGE SENSORS:       %lf\n", world->player.damage[lrs]);
+    gamePrintf("PHASER CONTROL:           %lf\n", world->player.damage[pha]);
+    gamePrintf("PHOTON TUBES:             %lf\n", world->player.damage[tor]);
+    gamePrintf("DAMAGE CONTROL:           %lf\n", world->player.damage[damageControl]);
+    gamePrintf("SHIELD CONTROL:           %lf\n", world->player.damage[she]);
+    gamePrintf("LIBRARY-COMPUTER:         %lf\n", world->player.damage[libComp]);
+    gamePrintf("\n");
 
 }
 
 void cmdTOR(World *world){
-    int q1 = world->player.pos[0], q2 = world->player.pos[1];
-
     double courseInput; //user input for torpedo course
-    double rowStep,  colStep; // torpedo course
-    int s1 = world->player.pos[2], s2 = world->player.pos[3];
-    double posRowFl, posColFl;
-    int posRow, posCol; // used for torpedo track
 
     if (world->player.photon <= 0){
-        printf("ALL PHOTON TORPEDOES EXPENDED\n");
+        gamePrintf("ALL PHOTON TORPEDOES EXPENDED\n");
         return;
     } else if (world->player.damage[tor] < 0) {
-        printf("PHOTON TUBES ARE NOT OPERATIONAL\n");
+        gamePrintf("PHOTON TUBES ARE NOT OPERATIONAL\n");
         return;
     }
 
-    int courseMovement[10][3] = {
-            {0,0,0},    // NOTHING
-            {0,0,1},    // 1
-            {0,-1,1},   // 2
-            {0,-1,0},   // 3
-            {0,-1,-1},  // 4
-            {0,0,-1},   // 5
-            {0,1,-1},   // 6
-            {0,1,0},    // 7
-            {0,1,1},    // 8
-            {0,0,1},    // 9
-    };
-
-    printf("PHOTON TORPEDO COURSE (1-9) ");
+    gamePrintf("PHOTON TORPEDO COURSE (1-9) ");
+    flushOutput();
     scanf("%lf", &courseInput);
     getchar();
+    SPAN(statTorpedo, "fireTorpedo", fireTorpedo(world, courseInput));
+}
+
+
+// Fires a photon torpedo, for cmdTOR & autopilots
+void fireTorpedo(World *world, double courseInput){
+    if (!journalCommand(world, journalTOR, courseInput, 0)) return;
+    int q1 = world->player.pos[0], q2 = world->player.pos[1];
+    Quadrant *quad = getQuadrant(world, q1, q2);
+
+    if (world->player.photon <= 0){
+        gamePrintf("ALL PHOTON TORPEDOES EXPENDED\n");
+        return;
+    } else if (world->player.damage[tor] < 0) {
+        gamePrintf("PHOTON TUBES ARE NOT OPERATIONAL\n");
+        return;
+    }
+
     if (floor(courseInput) == 9) {
         courseInput -= 8.00;
     }
 
     if ((courseInput < 1) || (courseInput > 9)) {
-        printf("ENSIGN CHEKOV REPORTS,  'INCORRECT COURSE DATA, SIR!'\n");
+        gamePrintf("ENSIGN CHEKOV REPORTS,  'INCORRECT COURSE DATA, SIR!'\n");
         return;
     // Course accepted:
     } else if ((courseInput >= 1) && (courseInput <= 9)) {
         // Deduct energy & torpedos
         world->player.energy -= 2;
         world->player.photon -= 1;
+        world->gen.stats++;
 
-        int courseInt = (int)floor(courseInput);
-        rowStep = courseMovement[courseInt][1] + (courseMovement[courseInt + 1][1] - courseMovement[courseInt][1]) * (courseInput - courseInt);
-        colStep = courseMovement[courseInt][2] + (courseMovement[courseInt + 1][2] - courseMovement[courseInt][2]) * (courseInput - courseInt);
-
-        posRowFl = s1 + 1;
-        posColFl = s2 + 1;
-
-        printf("TORPEDO TRACK : \n");
-
-        // GET ALL KLINGONS NEARBY
-        int klingons = world->quadrant[q1][q2].numKlingons;
-        Klingon *kNearby[klingons];
-        for (int k=0; k<klingons; k++) {
-            kNearby[k] = getNearbyEntity(world, k, 'k');
+        gamePrintf("TORPEDO TRACK : \n");
+        Track track;
+        torpedoTrack(world, courseInput, &track);
+        for (int i=0; i<track.length; i++) {
+            gamePrintf("               %i,%i\n", track.path[i][2]+1, track.path[i][3]+1);
         }
 
-        // GET ALL STARBASES NEARBY
-        int starbases = world->quadrant[q1][q2].numStarbases;
-        Starbase *bNearby[starbases];
-        for (int k=0; k<starbases; k++) {
-            bNearby[k] = getNearbyEntity(world, k, 'b');
+        if (track.stop == '>') {
+            gamePrintf("TORPEDO MISSED\n");
+        } else if (track.stop == 'K') {
+            // Torpedo hit klingon
+            gamePrintf("*** KLINGON DESTROYED ***\n");
+            removeEntity(world, track.hit, 'k');
+        } else if (track.stop == 'B') {
+            // TODO: Torpedo hit starbase
+            gamePrintf("*** STARBASE DESTROYED ***\n");
+            removeEntity(world, track.hit, 'b');
+            if (world->numStarbases + world->raided == world->config.numStarbases - 1) {
+                gamePrintf("STARFLEET COMMAND REVIEWING YOUR RECORD TO CONSIDER\nCOURT MARTIAL!\n");
+            } else {
+                gamePrintf("THAT DOES IT, CAPTAIN!! YOU ARE HEREBY RELIEVED OF COMMAND\n");
+                gamePrintf("AND SENTENCED TO 99 STARDATES AT HARD LABOR ON CYGNUS 12!!\n\n");
+                world->gameOver = true;
+                return;
+            }
+        } else if (track.stop == '*') {
+            // Torpedo hit star
+            gamePrintf("STAR AT %i,%i ABSORBED TORPEDO ENERGY.\n", track.at[2]+1, track.at[3]+1);
         }
 
-        // GET ALL STARS NEARBY
-        int stars = world->quadrant[q1][q2].numStars;
-        const Star *sNearby[stars];
-        for (int k=0; k<stars; k++) {
-            sNearby[k] = getNearbyEntity(world, k, 's');
+        // Let the klingons nearby shoot
+        if (quad->numKlingons > 0) {
+            klingonShooting(world);
         }
 
-        bool stop = false;
+    } else { //invalid
+        gamePrintf("?REENTER\n?");
+        // repeat prompt
+    }
+
+}
+
+
+// The sectors a move at warpInput would cross from the ship's position, & where the engines
+// would shut down: at the galactic perimeter, or short of anything in the way. With clear, as
+// if every sector were empty: that needs no sector maps, and the move can only stop sooner
+void navTrack(World *world, double courseInput, double warpInput, bool clear, Track *track) {
+    int q1 = world->player.pos[0], q2 = world->player.pos[1];
+    double rowStep, colStep;
+    int s1 = world->player.pos[2], s2 = world->player.pos[3];
+    double posRowFl, posColFl;
+    int posRow = s1 + 1, posCol = s2 + 1;
+
+    double quadFl;
+    double sectFl = modf(warpInput, &quadFl);
+    int numQuad = floor(quadFl);
+    int numSect = (int) floor(sectFl * 10.00) + 1;
+    int countSect = 0;
+    int count = ((numQuad * 8) + numSect) - 1;
+
+    courseStep(courseInput, &rowStep, &colStep);
+    track->length = 0;
+    track->stop = ' ';
+    track->hit = NULL;
+
+    bool stop = false;
+    while (countSect < count && !stop) {
+        posRowFl = s1 + 1;
+        posColFl = s2 + 1;
+
+        // SECTORS OF THE QUADRANT THE SHIP IS CROSSING
+        SectorMap *map = clear ? NULL : touchQuadrant(world, q1, q2);
+
         // For every possible move inside the quadrant
-        for (int i=0; i<9; i++) {
+        while (countSect < count) {
+            int prevRow = posRow, prevCol = posCol; // Where the ship stops if it can't go on
+            countSect++;
             posRowFl = (posRowFl + rowStep);
             posColFl = (posColFl + colStep);
             posRow = (int) floor(posRowFl + 0.5);
             posCol = (int) floor(posColFl + 0.5);
 
-            // Torpedo went outside quadrant
+            // Ship went outside quadrant. A diagonal course can leave through a corner, so wrap both axes
             if ((posRow < 1) || (posRow > 8) || (posCol < 1) || (posCol > 8)){
-                printf("TORPEDO MISSED\n");
-                break;
-            }
-
-            printf("               %i,%i\n", posRow, posCol);
-
-            // Check for klingons collision
-            for (int k=0; k<klingons; k++) {
-                if (posRow == kNearby[k]->pos[2]+1 && posCol == kNearby[k]->pos[3]+1) {
-                    // Torpedo hit klingon
-                    printf("*** KLINGON DESTROYED ***\n");
-                    world->numKlingons--;
-                    world->quadrant[q1][q2].numKlingons--;
-                    world->quadrant[q1][q2].sector[kNearby[k]->pos[2]][kNearby[k]->pos[3]] = ' ';
-                    kNearby[k]->energy = -1;
-                    kNearby[k]->pos[0] = -1; // So it doesn't count when performing other commands
+                int nextQ1 = q1 + (posRow > 8) - (posRow < 1), nextQ2 = q2 + (posCol > 8) - (posCol < 1);
+                int nextRow = posRow < 1 ? 8 : (posRow > 8 ? 1 : posRow);
+                int nextCol = posCol < 1 ? 8 : (posCol > 8 ? 1 : posCol);
+
+                // The galaxy has no quadrant on the other side, stop at its edge
+                if (!getQuadrant(world, nextQ1, nextQ2)) {
+                    track->stop = '|';
+                    posRow = prevRow;
+                    posCol = prevCol;
                     stop = true;
                     break;
                 }
-            }
-            if (stop) break;
-
-            // Check for starbases collision
-            for (int k=0; k<starbases; k++) {
-                if (posRow == bNearby[k]->pos[2]+1 && posCol == bNearby[k]->pos[3]+1) {
-                    // TODO: Torpedo hit starbase
-                    printf("*** STARBASE DESTROYED ***\n");
-                    world->numStarbases--;
-                    world->quadrant[q1][q2].numStarbases--;
-                    world->quadrant[q1][q2].sector[bNearby[k]->pos[2]][bNearby[k]->pos[3]] = ' ';
-                    bNearby[k]->energy = -1;
-                    bNearby[k]->pos[0] = -1; // So it doesn't count when performing other commands
+                char next = clear ? ' ' : touchQuadrant(world, nextQ1, nextQ2)->sector[nextRow-1][nextCol-1];
+                if (next != ' ') {
+                    track->stop = next;
+                    track->at[0] = nextQ1;
+                    track->at[1] = nextQ2;
+                    track->at[2] = nextRow-1;
+                    track->at[3] = nextCol-1;
+                    posRow = prevRow;
+                    posCol = prevCol;
                     stop = true;
-                    if (world->numStarbases == 2) {
-                        printf("STARFLEET COMMAND REVIEWING YOUR RECORD TO CONSIDER\nCOURT MARTIAL!\n");
-                        break;
-                    } else {
-                        printf("THAT DOES IT, CAPTAIN!! YOU ARE HEREBY RELIEVED OF COMMAND\n");
-                        printf("AND SENTENCED TO 99 STARDATES AT HARD LABOR ON CYGNUS 12!!\n\n");
-                        world->gameOver = true;
-                        return;
-                    }
+                    break;
                 }
+                q1 = nextQ1;
+                q2 = nextQ2;
+                posRow = nextRow;
+                posCol = nextCol;
+                s1 = posRow - 1;
+                s2 = posCol - 1;
+                memcpy(track->path[track->length++], (int[4]) {q1, q2, s1, s2}, sizeof(int[4]));
+                break;
             }
-            if (stop) break;
 
-            // Check for stars collision
-            for (int k=0; k<stars-1; k++) {
-                if (posRow == sNearby[k]->pos[2]+1 && posCol == sNearby[k]->pos[3]+1) {
-                    // Torpedo hit star
-                    printf("STAR AT %i,%i ABSORBED TORPEDO ENERGY.\n", posRow, posCol);
-                    stop = true;
-                    break;
+            // Check for collision with a star, klingon, or starbase
+            if (map) STAT_COUNT(collisionChecks);
+            if (map && map->sector[posRow-1][posCol-1] != ' ') {
+                track->stop = map->sector[posRow-1][posCol-1];
+                memcpy(track->at, (int[4]) {q1, q2, posRow-1, posCol-1}, sizeof(int[4]));
+                posRow = prevRow;
+                posCol = prevCol;
+                stop = true;
+                break;
+            }
+            memcpy(track->path[track->length++], (int[4]) {q1, q2, posRow-1, posCol-1}, sizeof(int[4]));
+        }
+    }
+    memcpy(track->pos, (int[4]) {q1, q2, posRow-1, posCol-1}, sizeof(int[4]));
+}
+
+// The sectors a torpedo would cross & what it would hit. Checks the quadrant's entities like
+// fireTorpedo() always has, which lets it through the farthest star
+void torpedoTrack(World *world, double courseInput, Track *track) {
+    int q1 = world->player.pos[0], q2 = world->player.pos[1];
+    Quadrant *quad = getQuadrant(world, q1, q2);
+    double rowStep, colStep;
+    double posRowFl = world->player.pos[2] + 1, posColFl = world->player.pos[3] + 1;
+    int posRow, posCol;
+
+    courseStep(courseInput, &rowStep, &colStep);
+    track->length = 0;
+    track->stop = ' ';
+    track->hit = NULL;
+
+    // GET ALL ENTITIES NEARBY
+    int klingons = quad->numKlingons, starbases = quad->numStarbases, stars = quad->numStars;
+    Entity *kNearby[MAX_QK], *bNearby[MAX_QB], *sNearby[stars > 0 ? stars : 1]; // Stars have no cap
+    for (int k=0; k<klingons; k++) kNearby[k] = getNearbyEntity(world, k, 'k');
+    for (int k=0; k<starbases; k++) bNearby[k] = getNearbyEntity(world, k, 'b');
+    for (int k=0; k<stars; k++) sNearby[k] = getNearbyEntity(world, k, 's');
+
+    // For every possible move inside the quadrant
+    for (int i=0; i<9 && track->stop == ' '; i++) {
+        posRowFl = (posRowFl + rowStep);
+        posColFl = (posColFl + colStep);
+        posRow = (int) floor(posRowFl + 0.5);
+        posCol = (int) floor(posColFl + 0.5);
+
+        // Torpedo went outside quadrant
+        if ((posRow < 1) || (posRow > 8) || (posCol < 1) || (posCol > 8)){
+            track->stop = '>';
+            break;
+        }
+        memcpy(track->path[track->length++], (int[4]) {q1, q2, posRow-1, posCol-1}, sizeof(int[4]));
+        STAT_COUNT(collisionChecks);
+
+        for (int k=0; k<klingons && track->stop == ' '; k++) {
+            if (posRow == kNearby[k]->pos[2]+1 && posCol == kNearby[k]->pos[3]+1) {
+                track->stop = 'K';
+                track->hit = kNearby[k];
+            }
+        }
+        for (int k=0; k<starbases && track->stop == ' '; k++) {
+            if (posRow == bNearby[k]->pos[2]+1 && posCol == bNearby[k]->pos[3]+1) {
+                track->stop = 'B';
+                track->hit = bNearby[k];
+            }
+        }
+        for (int k=0; k<stars-1 && track->stop == ' '; k++) {
+            if (posRow == sNearby[k]->pos[2]+1 && posCol == sNearby[k]->pos[3]+1) {
+                track->stop = '*';
+                track->hit = sNearby[k];
+            }
+        }
+    }
+    if (track->length) memcpy(track->pos, track->path[track->length-1], sizeof(int[4]));
+    else memcpy(track->pos, world->player.pos, sizeof(int[4]));
+    if (track->hit) memcpy(track->at, track->hit->pos, sizeof(int[4]));
+}
+
+// Klingon fire the ship's position draws, see klingonShooting(): each klingon but spared hits
+// for energy / distance * (2 to 3), scaled by config.fire
+void previewFire(World *world, const Entity *spared, Preview *preview) {
+    int q1 = world->player.pos[0], q2 = world->player.pos[1];
+    Quadrant *quad = getQuadrant(world, q1, q2);
+    preview->fire = preview->maxFire = 0;
+    if (quad->numStarbases > 0) return; // Starbase shields protect the Enterprise
+
+    Entity *slots = entitySlots(touchQuadrant(world, q1, q2), 'k');
+    for (int i=0; i<quad->numKlingons; i++) {
+        if (&slots[i] == spared) continue;
+        double dmg = slots[i].energy / getDistance(&world->player, slots[i].pos) * world->config.fire / 100;
+        preview->fire += dmg * 2.5;
+        preview->maxFire += dmg * 3;
+    }
+}
+
+// What navigate() would do, without doing it. The klingons shoot before the ship moves
+void previewNav(World *world, double courseInput, double warpInput, Preview *preview) {
+    memset(preview, 0, sizeof(Preview));
+    double maxWarp = world->player.damage[warp] < 0 ? 0.2 : 8.0;
+    preview->energy = (int) floor(warpInput * 8 + 0.5);
+    if ((courseInput < 1.0) || (courseInput > 9.0)) preview->refused = "INCORRECT COURSE DATA";
+    else if ((warpInput < 0) || (warpInput > 8)) preview->refused = "THE ENGINES WON'T TAKE IT";
+    else if (warpInput > maxWarp) preview->refused = "WARP ENGINES ARE DAMAGED";
+    else if (preview->energy > world->player.energy+world->player.shield) preview->refused = "INSUFFICIENT ENERGY";
+    if (preview->refused) {
+        preview->energy = 0;
+        return;
+    }
+
+    navTrack(world, courseInput, warpInput, false, &preview->track);
+    preview->days = warpInput < 1 ? fmax(0.1, floor(warpInput * 10) / 10) : 1;
+    preview->docks = getQuadrant(world, preview->track.pos[0], preview->track.pos[1])->numStarbases > 0;
+    if (getQuadrant(world, world->player.pos[0], world->player.pos[1])->numKlingons > 0) {
+        previewFire(world, NULL, preview);
+    }
+}
+
+// What fireTorpedo() would do, without doing it. The klingons left shoot after the torpedo
+void previewTor(World *world, double courseInput, Preview *preview) {
+    memset(preview, 0, sizeof(Preview));
+    if (floor(courseInput) == 9) courseInput -= 8.00;
+    if (world->player.photon <= 0) preview->refused = "ALL PHOTON TORPEDOES EXPENDED";
+    else if (world->player.damage[tor] < 0) preview->refused = "PHOTON TUBES ARE NOT OPERATIONAL";
+    else if ((courseInput < 1) || (courseInput > 9)) preview->refused = "INCORRECT COURSE DATA";
+    if (preview->refused) return;
+
+    preview->energy = 2;
+    preview->torpedoes = 1;
+    torpedoTrack(world, courseInput, &preview->track);
+    bool relieved = preview->track.stop == 'B'
+                    && world->numStarbases + world->raided != world->config.numStarbases - 1;
+    if (!relieved) previewFire(world, preview->track.stop == 'K' ? preview->track.hit : NULL, preview);
+}
+
+// PREVIEW NAV COURSE WARP, or PREVIEW TOR COURSE: reports the track, what stops it & the cost
+// of the command without taking the turn
+void cmdPRE(World *world, const char *input) {
+    char what[4] = "";
+    double courseInput = 0, warpInput = 0;
+    int args = sscanf(input, "%*s %3s %lf %lf", what, &courseInput, &warpInput);
+    for (int i=0; what[i]; i++) what[i] = (char) toupper(what[i]);
+    bool nav = !strcmp(what, "NAV");
+    if (args < 2 + nav || (!nav && strcmp(what, "TOR"))) {
+        gamePrintf("PREVIEW NAV COURSE WARP, OR PREVIEW TOR COURSE\n");
+        return;
+    }
+
+    Preview preview;
+    if (nav) previewNav(world, courseInput, warpInput, &preview);
+    else previewTor(world, courseInput, &preview);
+    if (preview.refused) {
+        gamePrintf("WOULD BE REFUSED: %s\n", preview.refused);
+        return;
+    }
+
+    Track *track = &preview.track;
+    if (nav) {
+        gamePrintf("TRACK: %i SECTORS TO QUADRANT %i,%i SECTOR %i,%i\n", track->length, track->pos[0]+1,
+                   track->pos[1]+1, track->pos[2]+1, track->pos[3]+1);
+    } else {
+        gamePrintf("TRACK:");
+        for (int i=0; i<track->length; i++) gamePrintf(" %i,%i", track->path[i][2]+1, track->path[i][3]+1);
+        gamePrintf("\n");
+    }
+
+    const char *names[] = {"KLINGON", "STARBASE", "STAR", "SHIP"};
+    const char *name = names[track->stop == 'K' ? 0 : track->stop == 'B' ? 1 : track->stop == '*' ? 2 : 3];
+    if (track->stop == '|') gamePrintf("STOPS AT THE GALACTIC PERIMETER\n");
+    else if (track->stop == '>') gamePrintf("MISSES\n");
+    else if (track->stop != ' ') {
+        gamePrintf("%s %s AT QUADRANT %i,%i SECTOR %i,%i\n", nav ? "STOPS SHORT OF" : "HITS", name,
+                   track->at[0]+1, track->at[1]+1, track->at[2]+1, track->at[3]+1);
+    }
+
+    if (nav) gamePrintf("COST: %i ENERGY, %.1lf STARDATES%s\n", preview.energy, preview.days, preview.docks ? ", DOCKS ON ARRIVAL" : "");
+    else gamePrintf("COST: %i ENERGY, %i TORPEDO\n", preview.energy, preview.torpedoes);
+    if (preview.maxFire > 0) {
+        gamePrintf("KLINGON FIRE: %.0lf UNITS EXPECTED, UP TO %.0lf (SHIELDS %i)\n", preview.fire, preview.maxFire,
+                   world->player.shield);
+        if (preview.maxFire > world->player.shield) gamePrintf("THE ENTERPRISE COULD BE DESTROYED\n");
+    }
+}
+
+
+// Packs a position into a table key: 12 bits each of energy & shields, 4 of torpedoes, 3 of
+// plies, a bit for shieldsSet, 7 bits a klingon (127 once it's destroyed) & 3 for the working
+// devices, with the top bit set so no key is 0
+uint64_t combatKey(const Combat *c) {
+    uint64_t key = 1ULL << 63 | (uint64_t) c->devices << 60 | (uint64_t) (c->energy / TACTICS_SHIP) << 48
+                   | (uint64_t) (c->shield / TACTICS_SHIP) << 36 | (uint64_t) c->torpedoes << 32
+                   | (uint64_t) c->plies << 29 | (uint64_t) c->shieldsSet << 28;
+    for (int i=0; i<MAX_QK; i++) {
+        key |= (uint64_t) (c->klingon[i] < 0 ? 127 : c->klingon[i] / TACTICS_KLINGON) << (7 * i);
+    }
+    return key;
+}
+
+// Rounds a position onto the solver's grid, within what its key holds. The ship's energy &
+// shields round down, so the commands it finds are ones the ship can afford
+Combat combatRound(Combat c) {
+    int maxShip = 4095 * TACTICS_SHIP, maxKlingon = 126 * TACTICS_KLINGON;
+    c.energy = c.energy < 0 ? 0 : c.energy / TACTICS_SHIP * TACTICS_SHIP;
+    c.shield = c.shield / TACTICS_SHIP * TACTICS_SHIP;
+    if (c.energy > maxShip) c.energy = maxShip;
+    if (c.shield > maxShip) c.shield = maxShip;
+    if (c.torpedoes > 15) c.torpedoes = 15;
+    for (int i=0; i<MAX_QK; i++) {
+        if (c.klingon[i] < 0) continue;
+        c.klingon[i] = (c.klingon[i] + TACTICS_KLINGON / 2) / TACTICS_KLINGON * TACTICS_KLINGON;
+        if (c.klingon[i] > maxKlingon) c.klingon[i] = maxKlingon;
+    }
+    return c;
+}
+
+TacticsEntry *tacticsLookup(Tactics *t, uint64_t key) {
+    if (!t->cap) return NULL;
+    for (unsigned h = (unsigned) (key * 0x9E3779B97F4A7C15ULL >> 32) & (t->cap - 1); t->table[h].key; h = (h + 1) & (t->cap - 1)) {
+        if (t->table[h].key == key) return &t->table[h];
+    }
+    return NULL;
+}
+
+// Adds a solved position, doubling the table at 1/2 load. A full TACTICS_MAX table starts over
+void tacticsStore(Tactics *t, const TacticsEntry *e) {
+    if (2 * (t->count + 1) > t->cap) {
+        int cap = t->cap ? t->cap * 2 : 1024;
+        TacticsEntry *table = cap <= TACTICS_MAX ? calloc(cap, sizeof(TacticsEntry)) : NULL;
+        if (!table) {
+            if (!t->cap) return;
+            memset(t->table, 0, sizeof(TacticsEntry) * t->cap);
+            t->count = 0;
+        } else {
+            TacticsEntry *old = t->table;
+            int oldCap = t->cap;
+            t->table = table;
+            t->cap = cap;
+            t->count = 0;
+            for (int i=0; i<oldCap; i++) {
+                if (old[i].key) tacticsStore(t, &old[i]);
+            }
+            free(old);
+        }
+    }
+    unsigned h = (unsigned) (e->key * 0x9E3779B97F4A7C15ULL >> 32) & (t->cap - 1);
+    while (t->table[h].key) h = (h + 1) & (t->cap - 1);
+    t->table[h] = *e;
+    t->count++;
+}
+
+// The klingons left shoot at the ship, unless a starbase protects it, as klingonShooting()
+// does: each hits for its energy / distance * (2 to 3), then has a third of its energy left,
+// & a hit the shields hold damages one of the 8 devices 40% of the time. Phasers, tubes &
+// shield control stay damaged for the rest of the fight, as fighting takes no time. Rolls
+// that leave the shields the same on the grid are solved once. Returns the value of the
+// position after the ship's command c
+double klingonFire(Tactics *t, const Combat *c) {
+    char action;
+    int arg;
+    Combat next = *c;
+    next.plies--;
+    int alive = 0;
+    for (int i=0; i<t->numKlingons; i++) alive += c->klingon[i] >= 0;
+    if (!alive || t->protected) {
+        next = combatRound(next);
+        return solveCombat(t, &next, &action, &arg);
+    }
+    for (int i=0; i<t->numKlingons; i++) {
+        if (next.klingon[i] >= 0) next.klingon[i] /= 3;
+    }
+
+    // The chance of each set of the 3 devices ending up damaged, each hit damaging a given one
+    // 1 time in 20, & what the ship has left working then
+    double damaged[8] = {1}, working[8] = {0};
+    for (int h=0; h<alive; h++) {
+        double after[8] = {0};
+        for (int m=0; m<8; m++) {
+            after[m] += damaged[m] * 0.85;
+            for (int d=0; d<3; d++) after[m | 1 << d] += damaged[m] * 0.05;
+        }
+        memcpy(damaged, after, sizeof(after));
+    }
+    for (int m=0; m<8; m++) working[c->devices & ~m] += damaged[m];
+
+    int combos = 1 << alive, shields[1 << MAX_QK], weight[1 << MAX_QK], n = 0;
+    for (int m=0; m<combos; m++) {
+        int hits = 0;
+        for (int i=0, b=0; i<t->numKlingons; i++) {
+            if (c->klingon[i] < 0) continue;
+            double roll = (m >> b++ & 1) ? 2.75 : 2.25;
+            hits += (int) (c->klingon[i] / t->kDist[i] * roll) * t->fire / 100;
+        }
+        if (c->shield - hits < 0) continue; // Destroyed
+        next.shield = c->shield - hits;
+        int shield = combatRound(next).shield, k = 0;
+        while (k < n && shields[k] != shield) k++;
+        if (k == n) {
+            shields[n] = shield;
+            weight[n++] = 0;
+        }
+        weight[k]++;
+    }
+
+    double value = 0;
+    for (int k=0; k<n; k++) {
+        for (int d=0; d<8; d++) {
+            if (working[d] == 0) continue;
+            next.shield = shields[k];
+            next.devices = d;
+            Combat rounded = combatRound(next);
+            value += weight[k] * working[d] * solveCombat(t, &rounded, &action, &arg);
+        }
+    }
+    return value / combos;
+}
+
+// The value of position c with best play from it, c->plies commands deep, & the command
+// that gets it: a torpedo at each klingon, phasers of 100 to 1600 units (or all there is, below
+// 100), or shields of 100 to 1600 units before firing. 1 & a sliver for the energy left once
+// the klingons are all destroyed, 0 if the ship is destroyed, & a smaller sliver for the damage
+// done if they aren't by the end, which ranks commands when no search deep enough to win fits
+// the budget. The search stops at the first command that's sure to win, trying the cheapest first
+double solveCombat(Tactics *t, const Combat *c, char *action, int *arg) {
+    static const int units[] = {100, 200, 400, 800, 1600};
+    int alive = 0;
+    for (int i=0; i<t->numKlingons; i++) alive += c->klingon[i] >= 0;
+    *action = 0;
+    *arg = 0;
+    if (!alive) return 1 + (c->energy + c->shield) * 1e-7;
+    if (t->out || t->visited++ >= t->budget) {
+        t->out = true;
+        return 0;
+    }
+    if (!c->plies) { // Not won in time: a sliver for the klingon energy gone, out of up to 300 each
+        double left = 0;
+        for (int i=0; i<t->numKlingons; i++) {
+            if (c->klingon[i] >= 0) left += c->klingon[i] < 300 ? c->klingon[i] : 300;
+        }
+        return (1 - left / (300.0 * t->numKlingons)) * 1e-9;
+    }
+    uint64_t key = combatKey(c);
+    TacticsEntry *hit = tacticsLookup(t, key);
+    if (hit) {
+        *action = hit->action;
+        *arg = hit->arg;
+        return hit->value;
+    }
+    t->solved++;
+    double best = 0;
+
+    // A torpedo destroys the first klingon still there on its course, if nothing stops it first
+    for (int j=0; j<t->numKlingons && c->torpedoes > 0 && (c->devices & 2) && best < 1; j++) {
+        if (c->klingon[j] < 0) continue;
+        Combat next = *c;
+        next.energy -= 2;
+        next.torpedoes--;
+        next.shieldsSet = false;
+        for (int k=0; k<t->kPathLen[j]; k++) {
+            if (next.klingon[t->kPath[j][k]] >= 0) {
+                next.klingon[t->kPath[j][k]] = -1;
+                break;
+            }
+        }
+        double value = klingonFire(t, &next);
+        if (value > best) {
+            best = value;
+            *action = 'T';
+            *arg = j;
+        }
+    }
+
+    // Phasers: the units are split evenly over the klingons, each hit rolling the low or high
+    // half of its dice, & only count for more than 15% of the klingon's energy. Rolls that
+    // end the same are played once
+    for (int u=0; u<5 && (c->devices & 1) && best < 1; u++) {
+        int input = c->energy < 100 && u == 0 ? c->energy : units[u];
+        if (input < 1 || input > c->energy) break;
+        int combos = 1 << alive, dmgPerK = input / alive, weight[1 << MAX_QK], n = 0;
+        Combat ends[1 << MAX_QK];
+        for (int m=0; m<combos; m++) {
+            Combat next = *c;
+            next.energy -= input;
+            next.shieldsSet = false;
+            for (int i=0, b=0; i<t->numKlingons; i++) {
+                if (c->klingon[i] < 0) continue;
+                double roll = (m >> b++ & 1) ? 2.75 : 2.25;
+                int dmg = (int) (dmgPerK / t->kDist[i] * roll) * t->phasers / 100;
+                if (dmg > 0.15 * next.klingon[i]) {
+                    next.klingon[i] -= dmg;
+                    if (next.klingon[i] <= 0) next.klingon[i] = -1;
                 }
             }
-            if (stop) break;
+            int k = 0;
+            while (k < n && memcmp(ends[k].klingon, next.klingon, sizeof(next.klingon))) k++;
+            if (k == n) {
+                ends[n] = next;
+                weight[n++] = 0;
+            }
+            weight[k]++;
+        }
+        double value = 0;
+        for (int k=0; k<n; k++) value += weight[k] * klingonFire(t, &ends[k]);
+        value /= combos;
+        if (value > best) {
+            best = value;
+            *action = 'P';
+            *arg = input;
+        }
+    }
+
+    // Shields take a command of their own but draw no fire, so they're set at most once between shots
+    for (int u=0; u<5 && !c->shieldsSet && (c->devices & 4) && best < 1; u++) {
+        if (units[u] == c->shield || units[u] > c->energy + c->shield) continue;
+        Combat next = *c;
+        next.energy = c->energy + c->shield - units[u];
+        next.shield = units[u];
+        next.shieldsSet = true;
+        next.plies--;
+        char nextAction;
+        int nextArg;
+        next = combatRound(next);
+        double value = solveCombat(t, &next, &nextAction, &nextArg);
+        if (value > best) {
+            best = value;
+            *action = 'S';
+            *arg = units[u];
+        }
+    }
 
+    if (!t->out) tacticsStore(t, &(TacticsEntry) {.key = key, .value = (float) best, .action = *action, .arg = *arg});
+    return best;
+}
+
+// Iterative deepening: solves c 1, 2, ... TACTICS_PLIES commands deep until a search would
+// visit more than TACTICS_BUDGET positions, & returns the deepest one that finished, with
+// its depth in plies. The positions a dropped search did finish stay in the table, so the next
+// advice in the fight gets further
+double deepenCombat(Tactics *t, const Combat *c, char *action, int *arg, int *plies) {
+    double value = 0;
+    *action = 0;
+    *arg = 0;
+    *plies = 0;
+    t->budget = t->visited + TACTICS_BUDGET;
+    t->out = false;
+    for (int d=1; d<=TACTICS_PLIES && value < 1; d++) {
+        Combat root = *c;
+        root.plies = d;
+        char a;
+        int x;
+        double v = solveCombat(t, &root, &a, &x);
+        if (t->out) break;
+        value = v;
+        *action = a;
+        *arg = x;
+        *plies = d;
+    }
+    return value;
+}
 
+// The solver for the ship's quadrant & its position there now. The roster & the cache are kept
+// while the ship hasn't moved & every klingon in the quadrant is on the roster (the destroyed
+// ones just aren't there any more), else they're started over. NULL if there's no memory
+Tactics *tacticsFor(World *world, Combat *c) {
+    Player *pl = &world->player;
+    Quadrant *quad = getQuadrant(world, pl->pos[0], pl->pos[1]);
+    SectorMap *map = touchQuadrant(world, pl->pos[0], pl->pos[1]);
+    Klingon *slots = entitySlots(map, 'k');
+    if (!world->tactics) world->tactics = calloc(1, sizeof(Tactics));
+    Tactics *t = world->tactics;
+    if (!t) return NULL;
+
+    int place[MAX_QK];
+    bool same = t->valid && !memcmp(t->pos, pl->pos, sizeof(t->pos)) && t->protected == (quad->numStarbases > 0)
+                && t->fire == world->config.fire && t->phasers == world->config.phasers;
+    for (int i=0; i<quad->numKlingons && same; i++) {
+        place[i] = -1;
+        for (int j=0; j<t->numKlingons; j++) {
+            if (slots[i].pos[2] == t->kPos[j][0] && slots[i].pos[3] == t->kPos[j][1]) place[i] = j;
         }
-        // Let the klingons nearby shoot
-        if (world->quadrant[q1][q2].numKlingons > 0) {
-            klingonShooting(world);
+        same = place[i] >= 0;
+    }
+
+    if (!same) {
+        t->valid = true;
+        memcpy(t->pos, pl->pos, sizeof(t->pos));
+        t->protected = quad->numStarbases > 0;
+        t->fire = world->config.fire;
+        t->phasers = world->config.phasers;
+        t->numKlingons = quad->numKlingons;
+        for (int i=0; i<t->numKlingons; i++) {
+            place[i] = i;
+            t->kPos[i][0] = slots[i].pos[2];
+            t->kPos[i][1] = slots[i].pos[3];
+            t->kDist[i] = getDistance(pl, slots[i].pos);
+            double dist;
+            calcDirection(pl->pos[2], pl->pos[3], slots[i].pos[2], slots[i].pos[3], &t->kCourse[i], &dist);
         }
 
-    } else { //invalid
-        printf("?REENTER\n?");
-        // repeat prompt
+        // Walk each course as torpedoTrack() does. It checks every star but the farthest
+        int stars = quad->numStars > 0 ? quad->numStars - 1 : 0;
+        int starPos[stars][2];
+        for (int s=0; s<stars; s++) {
+            Star *star = getNearbyEntity(world, s, 's');
+            starPos[s][0] = star->pos[2];
+            starPos[s][1] = star->pos[3];
+        }
+        for (int j=0; j<t->numKlingons; j++) {
+            double rowStep, colStep, rowFl = pl->pos[2] + 1, colFl = pl->pos[3] + 1;
+            courseStep(t->kCourse[j], &rowStep, &colStep);
+            t->kPathLen[j] = 0;
+            for (int i=0; i<9; i++) {
+                rowFl += rowStep;
+                colFl += colStep;
+                int row = (int) floor(rowFl + 0.5) - 1, col = (int) floor(colFl + 0.5) - 1;
+                if (row < 0 || row >= QS_SIZE || col < 0 || col >= QS_SIZE) break;
+                int k = 0;
+                while (k < t->numKlingons && (t->kPos[k][0] != row || t->kPos[k][1] != col)) k++;
+                if (k < t->numKlingons) {
+                    t->kPath[j][t->kPathLen[j]++] = k;
+                    continue;
+                }
+                bool stopped = map->sector[row][col] == 'B';
+                for (int s=0; s<stars && !stopped; s++) stopped = starPos[s][0] == row && starPos[s][1] == col;
+                if (stopped) break;
+            }
+        }
+        if (t->count) memset(t->table, 0, sizeof(TacticsEntry) * t->cap);
+        t->count = 0;
+        t->solved = 0;
+        t->shielded = 0;
     }
 
+    *c = (Combat) {.energy = pl->energy, .shield = pl->shield, .torpedoes = pl->photon, .plies = TACTICS_PLIES,
+                   .devices = (pl->damage[pha] >= 0) | (pl->damage[tor] >= 0) << 1 | (pl->damage[she] >= 0) << 2};
+    for (int j=0; j<MAX_QK; j++) c->klingon[j] = -1;
+    for (int i=0; i<quad->numKlingons; i++) c->klingon[place[i]] = slots[i].energy;
+    *c = combatRound(*c);
+    Combat shielded = *c;
+    shielded.shieldsSet = true;
+    c->shieldsSet = combatKey(&shielded) == t->shielded;
+    return t;
+}
+
+void freeTactics(World *world) {
+    if (!world->tactics) return;
+    free(world->tactics->table);
+    free(world->tactics);
+    world->tactics = NULL;
 }
 
+// Library-computer function 7: the solver's best command for the fight in the ship's quadrant
+void tacticalAdvice(World *world) {
+    Quadrant *quad = getQuadrant(world, world->player.pos[0], world->player.pos[1]);
+    if (quad->numKlingons <= 0) {
+        gamePrintf("SCIENCE OFFICER SPOCK REPORTS  'SENSORS SHOW NO ENEMY SHIPS\n"
+                   "                              IN THIS QUADRANT'\n");
+        return;
+    }
+    TRACE_BEGIN(trace);
+    long long start = monotonicNanos();
+    Combat c;
+    Tactics *t = tacticsFor(world, &c);
+    if (!t) {
+        gamePrintf("NOT ENOUGH COMPUTER MEMORY FOR TACTICAL ADVICE\n");
+        return;
+    }
+    long long solved = t->solved;
+    char action;
+    int arg, plies;
+    double value = deepenCombat(t, &c, &action, &arg, &plies);
+    double ms = (monotonicNanos() - start) / 1e6;
+    TRACE_END(trace, "tacticalAdvice");
+    if (action == 'S') {
+        Combat next = c;
+        next.energy = c.energy + c.shield - arg;
+        next.shield = arg;
+        next.shieldsSet = true;
+        next = combatRound(next);
+        t->shielded = combatKey(&next);
+    }
+
+    gamePrintf("\nTACTICAL ADVICE AGAINST %d KLINGON%s :\n", quad->numKlingons, quad->numKlingons > 1 ? "S" : "");
+    bool lost = value < 0.0005; // Shows as 0.0%
+    if (lost && (plies == TACTICS_PLIES || !action)) {
+        gamePrintf("  NOTHING THE ENTERPRISE CAN DO HERE WINS THIS FIGHT. RETREAT\n");
+    } else {
+        if (lost) gamePrintf("  NO WIN FOUND IN %d COMMAND%s. FOR THE MOST DAMAGE :\n", plies, plies == 1 ? "" : "S");
+        if (action == 'P') gamePrintf("  FIRE PHASERS, %d UNITS\n", arg);
+        else if (action == 'T') {
+            gamePrintf("  FIRE A PHOTON TORPEDO, COURSE %.2lf (AT THE KLINGON AT SECTOR %d,%d)\n", t->kCourse[arg],
+                       t->kPos[arg][0]+1, t->kPos[arg][1]+1);
+        }
+        else gamePrintf("  SET SHIELDS TO %d UNITS\n", arg);
+    }
+    gamePrintf("  CHANCE OF DESTROYING THEM ALL IN %d COMMAND%s : %.1lf%%\n", plies, plies == 1 ? "" : "S",
+               100 * fmin(value, 1));
+    gamePrintf("  %lld POSITIONS SOLVED FOR THIS, %d IN THE COMPUTER'S MEMORY, %.2lf MS\n\n", t->solved - solved,
+               t->count, ms);
+}
 
 void cmdCOM(World *world){
     int q1 = world->player.pos[0], q2 = world->player.pos[1];
+    Quadrant *quad = getQuadrant(world, q1, q2);
 
     while (true) {
 
         int i = 0;
         int numCOM = 6;
-        printf("COMPUTER ACTIVE AND AWAITING COMMAND: ");
+        gamePrintf("COMPUTER ACTIVE AND AWAITING COMMAND: ");
+        flushOutput();
         scanf("%d", &numCOM);  // Get COM#
         while (fgetc(stdin) != '\n');
 
         if (numCOM == 0) {
 
-            printf("\n");
-            printf("        COMPUTER RECORD OF GALAXY FOR QUADRANT %d,%d\n", world->player.pos[0]+1, world->player.pos[1]+1);
-            printf("       1     2     3     4     5     6     7     8\n"); // Column #s
-            printf("     ----- ----- ----- ----- ----- ----- ----- -----\n");
+            screenCapture(SCREEN_RECORD, SCREEN_ROWS);
+            gamePrintf("\n");
+            gamePrintf("        COMPUTER RECORD OF GALAXY FOR QUADRANT %d,%d\n", world->player.pos[0]+1, world->player.pos[1]+1);
+            // Large galaxies only show the 8x8 window of the record around the ship
+            int rows = world->config.rows, cols = world->config.cols;
+            int r0 = q1 - GALAXY_SIZE/2, c0 = q2 - GALAXY_SIZE/2;
+            if (r0 > rows - GALAXY_SIZE) r0 = rows - GALAXY_SIZE;
+            if (c0 > cols - GALAXY_SIZE) c0 = cols - GALAXY_SIZE;
+            if (r0 < 0) r0 = 0;
+            if (c0 < 0) c0 = 0;
+            int r1 = (r0 + GALAXY_SIZE < rows) ? r0 + GALAXY_SIZE : rows;
+            int c1 = (c0 + GALAXY_SIZE < cols) ? c0 + GALAXY_SIZE : cols;
+
+            gamePrintf("     ");
+            for (int c=c0; c<c1; c++) gamePrintf(c < c1-1 ? "  %-4d" : "  %d", c+1); // Column #s
+            gamePrintf("\n     ");
+            for (int c=c0; c<c1; c++) gamePrintf("%s", c == c0 ? "-----" : " -----");
+            gamePrintf("\n");
 
             // Print each row
-            for (int r=0; r<QS_SIZE; r++) {
-                printf("%d     ", r+1); // Row #
+            for (int r=r0; r<r1; r++) {
+                gamePrintf("%-6d", r+1); // Row #
                 // Each column
-                for (int c=0; c<QS_SIZE; c++) {
-                    Quadrant *quad = &world->quadrantArch[r][c];
-                    if (world->quadrantArch[r][c].scanned) printf("%d%d%d   ", quad->numKlingons, quad->numStarbases, quad->numStars);
-                    else printf("***   ");
+                for (int c=c0; c<c1; c++) {
+                    int q = r*cols + c;
+                    uint16_t arch;
+                    if (archivedCounts(world, q, &arch)) gamePrintf("%d%d%d   ", arch >> 12, arch >> 8 & 0xf, arch & 0xff);
+                    else gamePrintf("***   ");
                 }
-                printf("\n     ----- ----- ----- ----- ----- ----- ----- -----\n");
+                gamePrintf("\n     ");
+                for (int c=c0; c<c1; c++) gamePrintf("%s", c == c0 ? "-----" : " -----");
+                gamePrintf("\n");
             }
+            screenRelease();
             break;
 
 
 
         } else if (numCOM == 1) {
 
-            printf("\n  STATUS REPORT :\n");
-            printf("KLINGONS LEFT : %d\n", world->numKlingons);
-            printf("MISSION MUST BE COMPLETED IN %d STARDATES\n", world->daysRem);
-            printf("THE FEDERATION IS MAINTAINING %d STARBASES IN THE GALAXY\n\n", world->numStarbases);
-            printf("DEVICE                    STATE OF REPAIR\n");
-            printf("WARP ENGINES              %lf\n", world->player.damage[warp]);
-            printf("SHORT RANGE SENSORS       %lf\n", world->player.damage[srs]);
-            printf("LONG RANGE SENSORS        %lf\n", world->player.damage[lrs]);
-            printf("PHASER CONTROL            %lf\n", world->player.damage[pha]);
-            printf("PHOTON TUBES              %lf\n", world->player.damage[tor]);
-            printf("DAMAGE CONTROL            %lf\n", world->player.damage[damageControl]);
-            printf("SHIELD CONTROL            %lf\n", world->player.damage[she]);
-            printf("LIBRARY-COMPUTER          %lf\n", world->player.damage[libComp]);
-            printf("\n");
+            gamePrintf("\n  STATUS REPORT :\n");
+            gamePrintf("KLINGONS LEFT : %d\n", world->numKlingons);
+            gamePrintf("MISSION MUST BE COMPLETED IN %d STARDATES\n", world->daysRem);
+            gamePrintf("THE FEDERATION IS MAINTAINING %d STARBASES IN THE GALAXY\n\n", world->numStarbases);
+            gamePrintf("DEVICE                    STATE OF REPAIR\n");
+            gamePrintf("WARP ENGINES              %lf\n", world->player.damage[warp]);
+            gamePrintf("SHORT RANGE SENSORS       %lf\n", world->player.damage[srs]);
+            gamePrintf("LONG RANGE SENSORS        %lf\n", world->player.damage[lrs]);
+            gamePrintf("PHASER CONTROL            %lf\n", world->player.damage[pha]);
+            gamePrintf("PHOTON TUBES              %lf\n", world->player.damage[tor]);
+            gamePrintf("DAMAGE CONTROL            %lf\n", world->player.damage[damageControl]);
+            gamePrintf("SHIELD CONTROL            %lf\n", world->player.damage[she]);
+            gamePrintf("LIBRARY-COMPUTER          %lf\n", world->player.damage[libComp]);
+            gamePrintf("\n");
             break;
 
 
         } else if (numCOM == 2) {
 
-            if (world->quadrant[q1][q2].numKlingons <= 0) { // no klingon
-                printf("SCIENCE OFFICER SPOCK REPORTS  \'SENSORS SHOW NO ENEMY SHIPS\n                                IN THIS QUADRANT\'\n");
+            if (quad->numKlingons <= 0) { // no klingon
+                gamePrintf("SCIENCE OFFICER SPOCK REPORTS  \'SENSORS SHOW NO ENEMY SHIPS\n                                IN THIS QUADRANT\'\n");
             }
             else {
-                printf("\nFROM ENTERPRISE TO KLINGON BATTLE CRUISER(S)\n");
-                for (i = 0; i < world->quadrant[q1][q2].numKlingons; ++i){ //variable for # of klingon in the sector.
+                gamePrintf("\nFROM ENTERPRISE TO KLINGON BATTLE CRUISER(S)\n");
+                for (i = 0; i < quad->numKlingons; ++i){ //variable for # of klingon in the sector.
                     Klingon *target = getNearbyEntity(world, i, 'k');
                     double C1 =  world->player.pos[2]+1;
                     double A = world->player.pos[3]+1;
                     double W1 = target->pos[2]+1; // set W1 equal to nearest klingon
                     double X = target->pos[3]+1; // set W1 equal to nearest klingon
-                    double DIR = 0;
-                    double DIST = 0;
-                    X = X-A;
-                    A = C1-W1;
-                    if (X < 0) {
-                        if (A > 0) {
-                            C1 = 3;
-                            if (fabs(A) >= fabs(X)){
-                                DIR = C1+(fabs(X)/fabs(A));
-                            }
-                            else {
-                                DIR = C1+(((fabs(X)-fabs(A))+fabs(X))/fabs(X));
-                            }
-                        }
-                        else if (X != 0){
-                            C1 = 5;
-                            if (fabs(A)<=fabs(X)) {
-                                DIR = C1+(fabs(A)/fabs(X));
-                            }
-                            else {
-                                DIR = C1+(((fabs(X)-fabs(A))+fabs(X))/fabs(X));
-                            }
-                        }
-                    }
-                    else if (A < 0) {
-                        C1 = 7;
-                        if (fabs(A) >= fabs(X)){
-                            DIR = C1+(fabs(X)/fabs(A));
-                        }
-                        else {
-                            DIR = C1+(((fabs(X)-fabs(A))+fabs(X))/fabs(X));
-                        }
-                    }
-                    else if (X > 0) {
-                        C1 = 1;
-                        if (fabs(A)<=fabs(X)) {
-                            DIR = C1+(fabs(A)/fabs(X));
-                        }
-                        else {
-                            DIR = C1+(((fabs(X)-fabs(A))+fabs(X))/fabs(X));
-                        }
-                    }
-                    else if (A == 0) {
-                        C1 = 5;
-                        if (fabs(A)<=fabs(X)) {
-                            DIR = C1+(fabs(A)/fabs(X));
-                        }
-                        else {
-                            DIR = C1+(((fabs(X)-fabs(A))+fabs(X))/fabs(X));
-                        }
-                    }
-                    DIST = sqrt( pow(X, 2)+pow(A, 2));
-                    printf("DIRECTION = %lf\n", DIR);
-                    printf("DISTANCE = %lf\n", DIST);
+                    double DIR, DIST;
+                    calcDirection(C1, A, W1, X, &DIR, &DIST);
+                    gamePrintf("DIRECTION = %lf\n", DIR);
+                    gamePrintf("DISTANCE = %lf\n", DIST);
                 }
             }
             break;
@@ -1117,71 +6497,21 @@ void cmdCOM(World *world){
 
         }  else if (numCOM == 3) {
 
-            if (world->quadrant[q1][q2].numStarbases == 0){ // no base
-                printf("\nMR. SPOCK REPORTS,  \'SENSORS SHOW NO STARBASES IN THIS QUADRANT.\'\n");
+            if (quad->numStarbases == 0){ // no base
+                gamePrintf("\nMR. SPOCK REPORTS,  \'SENSORS SHOW NO STARBASES IN THIS QUADRANT.\'\n");
             }
             else {
-                printf("\nFROM ENTERPRISE TO KLINGON STARBASE");
-                for (i = 0; i < world->quadrant[q1][q2].numStarbases; ++i){
+                gamePrintf("\nFROM ENTERPRISE TO KLINGON STARBASE");
+                for (i = 0; i < quad->numStarbases; ++i){
                     Starbase *target = getNearbyEntity(world, i, 'b');
                     double C1 =  world->player.pos[2]+1;
                     double A = world->player.pos[3]+1;
                     double W1 = target->pos[2]+1; // set W1 equal to nearest starbase
                     double X = target->pos[3]+1; // set X equal to nearest starbase
-                    double DIR = 0;
-                    double DIST = 0;
-                    X = X-A;
-                    A = C1-W1;
-                    if (X < 0) {
-                        if (A > 0) {
-                            C1 = 3;
-                            if (fabs(A) >= fabs(X)){
-                                DIR = C1+(fabs(X)/fabs(A));
-                            }
-                            else {
-                                DIR = C1+(((fabs(X)-fabs(A))+fabs(X))/fabs(X));
-                            }
-                        }
-                        else if (X != 0){
-                            C1 = 5;
-                            if (fabs(A)<=fabs(X)) {
-                                DIR = C1+(fabs(A)/fabs(X));
-                            }
-                            else {
-                                DIR = C1+(((fabs(X)-fabs(A))+fabs(X))/fabs(X));
-                            }
-                        }
-                    }
-                    else if (A < 0) {
-                        C1 = 7;
-                        if (fabs(A) >= fabs(X)){
-                            DIR = C1+(fabs(X)/fabs(A));
-                        }
-                        else {
-                            DIR = C1+(((fabs(X)-fabs(A))+fabs(X))/fabs(X));
-                        }
-                    }
-                    else if (X > 0) {
-                        C1 = 1;
-                        if (fabs(A)<=fabs(X)) {
-                            DIR = C1+(fabs(A)/fabs(X));
-                        }
-                        else {
-                            DIR = C1+(((fabs(X)-fabs(A))+fabs(X))/fabs(X));
-                        }
-                    }
-                    else if (A == 0) {
-                        C1 = 5;
-                        if (fabs(A)<=fabs(X)) {
-                            DIR = C1+(fabs(A)/fabs(X));
-                        }
-                        else {
-                            DIR = C1+(((fabs(X)-fabs(A))+fabs(X))/fabs(X));
-                        }
-                    }
-                    DIST = sqrt( pow(X, 2)+pow(A, 2));
-                    printf("DIRECTION = %lf\n", DIR);
-                    printf("DISTANCE = %lf\n", DIST);
+                    double DIR, DIST;
+                    calcDirection(C1, A, W1, X, &DIR, &DIST);
+                    gamePrintf("DIRECTION = %lf\n", DIR);
+                    gamePrintf("DISTANCE = %lf\n", DIST);
                 }
             }
             break;
@@ -1193,108 +6523,83 @@ void cmdCOM(World *world){
             double A;
             double W1;
             double X;
-            printf("DIRECTION/DISTANCE CALCULATOR :\n");
-            printf("YOU ARE AT QUADRANT %d,%d SECTOR %d,%d\n",world->player.pos[0]+1, world->player.pos[1]+1, world->player.pos[2]+1, world->player.pos[3]+1);
-            printf("PLEASE ENTER\n");
-            printf("  INITIAL COORDINATES (X,Y) ");
+            gamePrintf("DIRECTION/DISTANCE CALCULATOR :\n");
+            gamePrintf("YOU ARE AT QUADRANT %d,%d SECTOR %d,%d\n",world->player.pos[0]+1, world->player.pos[1]+1, world->player.pos[2]+1, world->player.pos[3]+1);
+            gamePrintf("PLEASE ENTER\n");
+            gamePrintf("  INITIAL COORDINATES (X,Y) ");
+            flushOutput();
             scanf("%lf,%lf", &C1, &A);
             getchar();
-            printf("  FINAL COORDINATES (X,Y) ");
+            gamePrintf("  FINAL COORDINATES (X,Y) ");
+            flushOutput();
             scanf("%lf,%lf", &W1, &X);
             getchar();
-            double DIR = 0;
-            double DIST = 0;
-            X = X-A;
-            A = C1-W1;
-            if (X < 0) {
-                if (A > 0) {
-                    C1 = 3;
-                    if (fabs(A) >= fabs(X)){
-                        DIR = C1+(fabs(X)/fabs(A));
-                    }
-                    else {
-                        DIR = C1+(((fabs(X)-fabs(A))+fabs(X))/fabs(X));
-                    }
-                }
-                else if (X != 0){
-                    C1 = 5;
-                    if (fabs(A)<=fabs(X)) {
-                        DIR = C1+(fabs(A)/fabs(X));
-                    }
-                    else {
-                        DIR = C1+(((fabs(X)-fabs(A))+fabs(X))/fabs(X));
-                    }
-                }
-            }
-            else if (A < 0) {
-                C1 = 7;
-                if (fabs(A) >= fabs(X)){
-                    DIR = C1+(fabs(X)/fabs(A));
-                }
-                else {
-                    DIR = C1+(((fabs(X)-fabs(A))+fabs(X))/fabs(X));
-                }
-            }
-            else if (X > 0) {
-                C1 = 1;
-                if (fabs(A)<=fabs(X)) {
-                    DIR = C1+(fabs(A)/fabs(X));
-                }
-                else {
-                    DIR = C1+(((fabs(X)-fabs(A))+fabs(X))/fabs(X));
-                }
-            }
-            else if (A == 0) {
-                C1 = 5;
-                if (fabs(A)<=fabs(X)) {
-                    DIR = C1+(fabs(A)/fabs(X));
-                }
-                else {
-                    DIR = C1+(((fabs(X)-fabs(A))+fabs(X))/fabs(X));
-                }
-            }
-            DIST = sqrt( pow(X, 2)+pow(A, 2));
-            printf("DIRECTION = %lf\n", DIR);
-            printf("DISTANCE = %lf\n", DIST);
+            double DIR, DIST;
+            calcDirection(C1, A, W1, X, &DIR, &DIST);
+            gamePrintf("DIRECTION = %lf\n", DIR);
+            gamePrintf("DISTANCE = %lf\n", DIST);
             break;
 
 
         } else if (numCOM == 5){
 
-            printf("\n\t\t       THE GALAXY\n");
-            printf("      1     2     3     4     5     6     7     8\n");
-            printf("    ----- ----- ----- ----- ----- ----- ----- -----\n");
-            printf("1        ANTARES\t          SIRIUS\n");
-            printf("    ----- ----- ----- ----- ----- ----- ----- -----\n");
-            printf("2         RIGEL\t\t          DENEB\n");
-            printf("    ----- ----- ----- ----- ----- ----- ----- -----\n");
-            printf("3        PROCYON\t         CAPELLA\n");
-            printf("    ----- ----- ----- ----- ----- ----- ----- -----\n");
-            printf("4          VEGA\t\t        BETELGEUSE\n");
-            printf("    ----- ----- ----- ----- ----- ----- ----- -----\n");
-            printf("5        CANOPUS\t        ALDEBRAN\n");
-            printf("    ----- ----- ----- ----- ----- ----- ----- -----\n");
-            printf("6         ALTAIR\t         REGULUS\n");
-            printf("    ----- ----- ----- ----- ----- ----- ----- -----\n");
-            printf("7      SAGITTARIUS\t         ARCTURUS\n");
-            printf("    ----- ----- ----- ----- ----- ----- ----- -----\n");
-            printf("8         POLLUX\t          SPICA\n");
-            printf("    ----- ----- ----- ----- ----- ----- ----- -----\n");
-
-
-        } else if ((numCOM > 5) || (numCOM < 0)) {
-
-            printf("FUNCTIONS AVAILABLE FROM LIBRARY-COMPUTER :\n");
-            printf("   0 = CUMULATIVE GALACTIC RECORD\n");
-            printf("   1 = STATUS REPORT\n");
-            printf("   2 = PHOTON TORPEDO DATA\n");
-            printf("   3 = STARBASE NAV DATA\n");
-            printf("   4 = DIRECTION/DISTANCE CALCULATOR\n");
-            printf("   5 = GALAXY 'REGION NAME' MAP\n\n");
+            gamePrintf("\n\t\t       THE GALAXY\n");
+            gamePrintf("      1     2     3     4     5     6     7     8\n");
+            gamePrintf("    ----- ----- ----- ----- ----- ----- ----- -----\n");
+            gamePrintf("1        ANTARES\t          SIRIUS\n");
+            gamePrintf("    ----- ----- ----- ----- ----- ----- ----- -----\n");
+            gamePrintf("2         RIGEL\t\t          DENEB\n");
+            gamePrintf("    ----- ----- ----- ----- ----- ----- ----- -----\n");
+            gamePrintf("3        PROCYON\t         CAPELLA\n");
+            gamePrintf("    ----- ----- ----- ----- ----- ----- ----- -----\n");
+            gamePrintf("4          VEGA\t\t        BETELGEUSE\n");
+            gamePrintf("    ----- ----- ----- ----- ----- ----- ----- -----\n");
+            gamePrintf("5        CANOPUS\t        ALDEBRAN\n");
+            gamePrintf("    ----- ----- ----- ----- ----- ----- ----- -----\n");
+            gamePrintf("6         ALTAIR\t         REGULUS\n");
+            gamePrintf("    ----- ----- ----- ----- ----- ----- ----- -----\n");
+            gamePrintf("7      SAGITTARIUS\t         ARCTURUS\n");
+            gamePrintf("    ----- ----- ----- ----- ----- ----- ----- -----\n");
+            gamePrintf("8         POLLUX\t          SPICA\n");
+            gamePrintf("    ----- ----- ----- ----- ----- ----- ----- -----\n");
+
+
+        } else if (numCOM == 6) {
+
+            Starbase *target;
+            double DIR, WARP;
+            if (!nearestStarbase(world, &target, &DIR, &WARP)) {
+                gamePrintf("\nMR. SPOCK REPORTS,  \'SENSORS SHOW NO STARBASES LEFT IN THE GALAXY.\'\n");
+            } else {
+                gamePrintf("\nFROM ENTERPRISE TO NEAREST STARBASE\n");
+                gamePrintf("QUADRANT = %d,%d  SECTOR = %d,%d\n", target->pos[0]+1, target->pos[1]+1, target->pos[2]+1, target->pos[3]+1);
+                gamePrintf("DIRECTION = %lf\n", DIR);
+                gamePrintf("WARP FACTOR = %.1lf\n", WARP);
+            }
+            break;
+
+
+        } else if (numCOM == 7) {
+
+            tacticalAdvice(world);
+            break;
+
+
+        } else if ((numCOM > 7) || (numCOM < 0)) {
+
+            gamePrintf("FUNCTIONS AVAILABLE FROM LIBRARY-COMPUTER :\n");
+            gamePrintf("   0 = CUMULATIVE GALACTIC RECORD\n");
+            gamePrintf("   1 = STATUS REPORT\n");
+            gamePrintf("   2 = PHOTON TORPEDO DATA\n");
+            gamePrintf("   3 = STARBASE NAV DATA\n");
+            gamePrintf("   4 = DIRECTION/DISTANCE CALCULATOR\n");
+            gamePrintf("   5 = GALAXY 'REGION NAME' MAP\n");
+            gamePrintf("   6 = NEAREST STARBASE ROUTE\n");
+            gamePrintf("   7 = TACTICAL ADVICE\n\n");
 
 
         } else {
-            printf("?REENTER \n");
+            gamePrintf("?REENTER \n");
         }
 
     }
@@ -1306,42 +6611,50 @@ void cmdXXX(World *world){
 }
 
 
-void checkGameOver(World *world) {
+// Ends the game if it's over. Returns the world to carry on with, a new one if the player volunteers
+World *checkGameOver(World *world) {
 
     if (world->daysRem <= 0) {
         world->gameOver = true;
     }
     if (world->gameOver) {
-        printf("IT IS STARDATE %i\n", world->date);
-        printf("THERE WERE %i KLINGON BATTLE CRUISERS LEFT AT\n", world->numKlingons);
-        printf("THE END OF YOUR MISSION.\n\n");
+        journalEnd(world);
+        gamePrintf("IT IS STARDATE %i\n", world->date);
+        gamePrintf("THERE WERE %i KLINGON BATTLE CRUISERS LEFT AT\n", world->numKlingons);
+        gamePrintf("THE END OF YOUR MISSION.\n\n");
+        if (journal && journalFailed()) exit(1); // No new game to journal it to
 
-        printf("THE FEDERATION IS IN NEED OF A NEW STARSHIP COMMANDER\n"
+        gamePrintf("THE FEDERATION IS IN NEED OF A NEW STARSHIP COMMANDER\n"
                "FOR A SIMILAR MISSION -- IF THERE IS A VOLUNTEER,\n"
                "LET HIM STEP FORWARD AND ENTER 'AYE': ");
 
         char input[STR_SIZE];
+        flushOutput();
         fgets(input, STR_SIZE, stdin);
         for (int i=0; i<3; i++) input[i] = (char) toupper(input[i]); // Turn first 3 chars to upper
 
         if (!strncmp(input, "AYE", 3)) {
             printTitle();
-            *world = generateWorld();
-            return;
+            World *next = poolTake(world->pool); // Already generated while the last game was played
+            poolRecycle(world->pool, world);
+            seedDice(next->seed);
+            journalSeed(next);
+            if (journalCommand(next, journalSRS, 0, 0)) cmdSRS(next);
+            return next;
 
         } else {
-            printf("\n*****************************************\n");
-            printf("*                   *                   *\n");
-            printf("*                 * * *                 *\n");
-            printf("*     * *   THANKS FOR PLAYING!   * *   *\n");
-            printf("*               * *   * *               *\n");
-            printf("*              * *     * *              *\n");
-            printf("*****************************************\n\n");
+            gamePrintf("\n*****************************************\n");
+            gamePrintf("*                   *                   *\n");
+            gamePrintf("*                 * * *                 *\n");
+            gamePrintf("*     * *   THANKS FOR PLAYING!   * *   *\n");
+            gamePrintf("*               * *   * *               *\n");
+            gamePrintf("*              * *     * *              *\n");
+            gamePrintf("*****************************************\n\n");
             exit(0);
         }
 
     }
-
+    return world;
 }
 
 
@@ -1351,6 +6664,7 @@ void sortEntities(Entity **entity, double *dist, int n) {
 
     for (int i = 0 ; i<n-1; i++) {
         for (int j=0; j<n-i-1; j++) {
+            STAT_COUNT(sortCompares);
             if (dist[j] > dist[j+1]) {
 
                 /* Swapping */
@@ -1367,111 +6681,226 @@ void sortEntities(Entity **entity, double *dist, int n) {
 }
 
 void printInstructions() {
-    printf("            INSTRUCTIONS FOR 'SUPER STAR TREK'            \n");
-    printf("===========================================================\n");
-    printf("1.When you see COMMAND ? printed, enter one of the legal\n");
-    printf("Commands(NAV, SRS, LRS, PHA, TOR, SHE, DAM, COM, or XXX).\n");
-    printf("2.If you should type an illegal command, you'll get a short\n");
-    printf("list of legal commands printed out.\n");
-    printf("3.Some commands require you to enter data (For example, the\n");
-    printf("'NAV' comes back with 'Course (1-9) ?'.) if you\n");
-    printf("type in illegal data, like negative numbers, that command\n");
-    printf("will be aborted\n");
-    printf("\n");
-    printf("The galaxy is divided into an 8x8 quadrant grid\n");
-    printf("and each quadrant is further divided into an 8x8 sector grid\n");
-    printf("\n");
-    printf("You will be assigned a starting point somewhere in the\n");
-    printf("galaxy to begin a tour of duty as commander of the Starship\n");
-    printf("Enterprise. your mission: to seek and destroy the fleet of\n");
-    printf("Klingon Warships which are menacing the United Federation of\n");
-    printf("planets\n");
-    printf("\n");
-    printf("You have the following commands available to you as captain\n");
-    printf("of the Starship Enterprise: \n");
-    printf("\n");
-    printf("NAV Command = Warp Engine Control --\n");
-    printf("   Course is in a circular numerical      4  3  2\n");
-    printf("   vector arrangement as shown.            * * *\n");
-    printf("   Integers and Reals may be                ***\n");
-    printf("   used. (thus course 1.5 is half-     5  ---*---  1\n");
-    printf("   way between 1 and 2)                     ***\n");
-    printf("                                           * * *\n");
-    printf("   Values may approach 9.0, which         6  7  8\n");
-    printf("   itself is equivalent to 1.0\n");
-    printf("                                           Course\n");
-    printf("   One warp factor is the size of\n");
-    printf("   one quadrant. Therefore, to get\n");
-    printf("   from quadrant 6,5 to 5,5, you would\n");
-    printf("   use course 3, warp factor 1.\n");
-    printf("\n");
-    printf("SRS Command = Short Range Sensor Scan\n");
-    printf("   Shows you a scan of your present quadrant.\n");
-    printf("\n");
-    printf("   Symbology on your sensor screen is as follows:\n");
-    printf("      <*> = Your starship's position\n");
-    printf("      +K+ = Klingon Battle Cruiser\n");
-    printf("      >!< = Federation Starbase (Refuel/Repair/Re-arm here!)\n");
-    printf("\n");
-    printf("       * = Star\n");
-    printf("\n");
-    printf("    A condensed status report will also be presented.\n");
-    printf("\n");
-    printf("LRS Command = Long Range Sensor Scan\n");
-    printf("   Shows conditions in space for one quadrant on each side\n");
-    printf("   of the Enterprise (which is in the middle of the scan)\n");
-    printf("   The scan is coded in the form ###, where the units digit\n");
-    printf("   is the number of stars, the tens digit is the number of\n");
-    printf("   starbases, and the hundreds digit is the number of Klingons\n");
-    printf("\n");
-    printf("   Example - 207 = 2 Klingons, No Starbases & 7 Stars\n");
-    printf("\n");
-    printf("PHA Command = Phaser Control\n");
-    printf("   Allows you to destroy the Klingon Battle Cruisers by\n");
-    printf("   zapping them with suitably large units of energy to\n");
-    printf("   deplete their shield power. (Remember, Klingons have\n");
-    printf("   Phasers too!)\n");
-    printf("\n");
-    printf("TOR Command = Photon Torpedo Control\n");
-    printf("   Torpedo course is the same as used in warp engine control\n");
-    printf("   If you hit the Klingon Vessel, he is destroyed and\n");
-    printf("   cannot fire back at you. If you miss, you are subject to\n");
-    printf("   his Phaser fire. In either case, you are also subject to\n");
-    printf("   the Phaser fire of all other Klingons in the quadrant\n");
-    printf("   The library computer ('COM' Command) has an option to\n");
-    printf("   compute torpedo trajectory for you (Option 2)\n");
-    printf("\n");
-    printf("SHE Command = Shield Control\n");
-    printf("   Defines the number of energy units to be assigned to the\n");
-    printf("   shields. Energy is taken from total ship's energy. Note\n");
-    printf("   that the status display total energy includes shield energy\n");
-    printf("\n");
-    printf("DAM Command = Damage Control Report\n");
-    printf("   Gives the state of repair of all devices. Where a negative\n");
-    printf("   'State of Repair' shows that the device is temporarily damaged\n");
-    printf("\n");
-    printf("COM Command = Library-Computer\n");
-    printf("   The Library-Computer contains six options:\n");
-    printf("   Option 0 = Cumulative Galactic Record\n");
-    printf("      This option shows computer memory of the results of \n");
-    printf("      previous short and long range sensor scans\n");
-    printf("   Option 1 = Status Report\n");
-    printf("      This option shows the number of Klingons, Stardates,\n");
-    printf("      and Starbases remaining in the game.\n");
-    printf("   Option 2 = Photon Torpedo Data\n");
-    printf("      Which gives directions and distance from the Enterprise\n");
-    printf("      to all Klingons in your quadrant.\n");
-    printf("   Option 3 = Starbase NAV Data\n");
-    printf("      This option gives direction and distance to any\n");
-    printf("      Starbase within your quadrant\n");
-    printf("   Option 4 = Direction/Distance Calculator\n");
-    printf("      This option allows you to enter coordinates for\n");
-    printf("      Direction/Distance calculations\n");
-    printf("   Option 5 = Galactic / Region Name / Map\n");
-    printf("      This option prints the names of the sixteen major\n");
-    printf("      galactic regions referred to in the game\n");
-    printf("===========================================================\n");
-    printf("               (ENTER ANY KEY TO CONTINUE) ");
+    gamePrintf("            INSTRUCTIONS FOR 'SUPER STAR TREK'            \n");
+    gamePrintf("===========================================================\n");
+    gamePrintf("1.When you see COMMAND ? printed, enter one of the legal\n");
+    gamePrintf("Commands(NAV, SRS, LRS, PHA, TOR, SHE, DAM, COM, or XXX).\n");
+    gamePrintf("2.If you should type an illegal command, you'll get a short\n");
+    gamePrintf("list of legal commands printed out.\n");
+    gamePrintf("3.Some commands require you to enter data (For example, the\n");
+    gamePrintf("'NAV' comes back with 'Course (1-9) ?'.) if you\n");
+    gamePrintf("type in illegal data, like negative numbers, that command\n");
+    gamePrintf("will be aborted\n");
+    gamePrintf("\n");
+    gamePrintf("The galaxy is divided into an 8x8 quadrant grid\n");
+    gamePrintf("and each quadrant is further divided into an 8x8 sector grid\n");
+    gamePrintf("\n");
+    gamePrintf("You will be assigned a starting point somewhere in the\n");
+    gamePrintf("galaxy to begin a tour of duty as commander of the Starship\n");
+    gamePrintf("Enterprise. your mission: to seek and destroy the fleet of\n");
+    gamePrintf("Klingon Warships which are menacing the United Federation of\n");
+    gamePrintf("planets\n");
+    gamePrintf("\n");
+    gamePrintf("You have the following commands available to you as captain\n");
+    gamePrintf("of the Starship Enterprise: \n");
+    gamePrintf("\n");
+    gamePrintf("NAV Command = Warp Engine Control --\n");
+    gamePrintf("   Course is in a circular numerical      4  3  2\n");
+    gamePrintf("   vector arrangement as shown.            * * *\n");
+    gamePrintf("   Integers and Reals may be                ***\n");
+    gamePrintf("   used. (thus course 1.5 is half-     5  ---*---  1\n");
+    gamePrintf("   way between 1 and 2)                     ***\n");
+    gamePrintf("                                           * * *\n");
+    gamePrintf("   Values may approach 9.0, which         6  7  8\n");
+    gamePrintf("   itself is equivalent to 1.0\n");
+    gamePrintf("                                           Course\n");
+    gamePrintf("   One warp factor is the size of\n");
+    gamePrintf("   one quadrant. Therefore, to get\n");
+    gamePrintf("   from quadrant 6,5 to 5,5, you would\n");
+    gamePrintf("   use course 3, warp factor 1.\n");
+    gamePrintf("\n");
+    gamePrintf("SRS Command = Short Range Sensor Scan\n");
+    gamePrintf("   Shows you a scan of your present quadrant.\n");
+    gamePrintf("\n");
+    gamePrintf("   Symbology on your sensor screen is as follows:\n");
+    gamePrintf("      <*> = Your starship's position\n");
+    gamePrintf("      +K+ = Klingon Battle Cruiser\n");
+    gamePrintf("      >!< = Federation Starbase (Refuel/Repair/Re-arm here!)\n");
+    gamePrintf("\n");
+    gamePrintf("       * = Star\n");
+    gamePrintf("\n");
+    gamePrintf("    A condensed status report will also be presented.\n");
+    gamePrintf("\n");
+    gamePrintf("LRS Command = Long Range Sensor Scan\n");
+    gamePrintf("   Shows conditions in space for one quadrant on each side\n");
+    gamePrintf("   of the Enterprise (which is in the middle of the scan)\n");
+    gamePrintf("   The scan is coded in the form ###, where the units digit\n");
+    gamePrintf("   is the number of stars, the tens digit is the number of\n");
+    gamePrintf("   starbases, and the hundreds digit is the number of Klingons\n");
+    gamePrintf("\n");
+    gamePrintf("   Example - 207 = 2 Klingons, No Starbases & 7 Stars\n");
+    gamePrintf("\n");
+    gamePrintf("PHA Command = Phaser Control\n");
+    gamePrintf("   Allows you to destroy the Klingon Battle Cruisers by\n");
+    gamePrintf("   zapping them with suitably large units of energy to\n");
+    gamePrintf("   deplete their shield power. (Remember, Klingons have\n");
+    gamePrintf("   Phasers too!)\n");
+    gamePrintf("\n");
+    gamePrintf("TOR Command = Photon Torpedo Control\n");
+    gamePrintf("   Torpedo course is the same as used in warp engine control\n");
+    gamePrintf("   If you hit the Klingon Vessel, he is destroyed and\n");
+    gamePrintf("   cannot fire back at you. If you miss, you are subject to\n");
+    gamePrintf("   his Phaser fire. In either case, you are also subject to\n");
+    gamePrintf("   the Phaser fire of all other Klingons in the quadrant\n");
+    gamePrintf("   The library computer ('COM' Command) has an option to\n");
+    gamePrintf("   compute torpedo trajectory for you (Option 2)\n");
+    gamePrintf("\n");
+    gamePrintf("SHE Command = Shield Control\n");
+    gamePrintf("   Defines the number of energy units to be assigned to the\n");
+    gamePrintf("   shields. Energy is taken from total ship's energy. Note\n");
+    gamePrintf("   that the status display total energy includes shield energy\n");
+    gamePrintf("\n");
+    gamePrintf("DAM Command = Damage Control Report\n");
+    gamePrintf("   Gives the state of repair of all devices. Where a negative\n");
+    gamePrintf("   'State of Repair' shows that the device is temporarily damaged\n");
+    gamePrintf("\n");
+    gamePrintf("COM Command = Library-Computer\n");
+    gamePrintf("   The Library-Computer contains eight options:\n");
+    gamePrintf("   Option 0 = Cumulative Galactic Record\n");
+    gamePrintf("      This option shows computer memory of the results of \n");
+    gamePrintf("      previous short and long range sensor scans\n");
+    gamePrintf("   Option 1 = Status Report\n");
+    gamePrintf("      This option shows the number of Klingons, Stardates,\n");
+    gamePrintf("      and Starbases remaining in the game.\n");
+    gamePrintf("   Option 2 = Photon Torpedo Data\n");
+    gamePrintf("      Which gives directions and distance from the Enterprise\n");
+    gamePrintf("      to all Klingons in your quadrant.\n");
+    gamePrintf("   Option 3 = Starbase NAV Data\n");
+    gamePrintf("      This option gives direction and distance to any\n");
+    gamePrintf("      Starbase within your quadrant\n");
+    gamePrintf("   Option 4 = Direction/Distance Calculator\n");
+    gamePrintf("      This option allows you to enter coordinates for\n");
+    gamePrintf("      Direction/Distance calculations\n");
+    gamePrintf("   Option 5 = Galactic / Region Name / Map\n");
+    gamePrintf("      This option prints the names of the sixteen major\n");
+    gamePrintf("      galactic regions referred to in the game\n");
+    gamePrintf("   Option 6 = Nearest Starbase Route\n");
+    gamePrintf("      This option gives the course and warp factor to the\n");
+    gamePrintf("      nearest surviving Starbase anywhere in the galaxy\n");
+    gamePrintf("   Option 7 = Tactical Advice\n");
+    gamePrintf("      This option suggests the best next combat command\n");
+    gamePrintf("      against the Klingons in your quadrant\n");
+    gamePrintf("===========================================================\n");
+    gamePrintf("               (ENTER ANY KEY TO CONTINUE) ");
     char input[STR_SIZE];
+    flushOutput();
     fgets(input, STR_SIZE, stdin);
 }
+
+
+#ifdef STATS
+long long statNow() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+// Values below HIST_SUB get a bucket each, above that every power of two is split in HIST_SUB
+int histBucket(unsigned long long v) {
+    if (v < HIST_SUB) return (int) v;
+    int e = 63 - __builtin_clzll(v);
+    return HIST_SUB + (e - 4) * HIST_SUB + (int) ((v >> (e - 4)) - HIST_SUB);
+}
+
+// Smallest value that lands in bucket
+unsigned long long histValue(int bucket) {
+    if (bucket < HIST_SUB) return (unsigned long long) bucket;
+    int e = (bucket - HIST_SUB) / HIST_SUB + 4;
+    return (unsigned long long) (HIST_SUB + (bucket - HIST_SUB) % HIST_SUB) << (e - 4);
+}
+
+unsigned long long histPercentile(Histogram *hist, double p) {
+    unsigned long long count = atomic_load(&hist->count), seen = 0;
+    unsigned long long rank = (unsigned long long) ceil(p * count);
+    for (int b=0; b<HIST_BUCKETS; b++) {
+        seen += atomic_load_explicit(&hist->bucket[b], memory_order_relaxed);
+        if (seen >= rank && seen > 0) return histValue(b);
+    }
+    return 0;
+}
+
+void statRecord(int op, long long ns) {
+    Histogram *hist = &stats.op[op];
+    unsigned long long v = ns > 0 ? (unsigned long long) ns : 0;
+    atomic_fetch_add_explicit(&hist->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&hist->sum, v, memory_order_relaxed);
+    atomic_fetch_add_explicit(&hist->bucket[histBucket(v)], 1, memory_order_relaxed);
+    unsigned long long max = atomic_load_explicit(&hist->max, memory_order_relaxed);
+    while (v > max && !atomic_compare_exchange_weak(&hist->max, &max, v));
+}
+
+// Latency histograms of the commands & game actions that ran, then the hot spot counters.
+// Times are in nanoseconds, and the commands include waiting for their input
+void printStats(FILE *out, bool json) {
+    const char *names[numStatOps] = {"NAV", "SRS", "LRS", "PHA", "TOR", "SHE", "DAM", "COM", "XXX", "INS",
+                                     "PREVIEW", "STATS", "OTHER", "NAVIGATE", "PHASERS", "TORPEDO", "SHIELDS", "AUTOPILOT",
+                                     "OUTPUT", "WRITE"};
+    if (json) fprintf(out, "{\"ops\": {");
+    else fprintf(out, "%-10s %10s %12s %12s %12s %12s %12s\n", "OP (NS)", "COUNT", "MEAN", "P50", "P90", "P99", "MAX");
+
+    bool first = true;
+    for (int op=0; op<numStatOps; op++) {
+        Histogram *hist = &stats.op[op];
+        unsigned long long count = atomic_load(&hist->count);
+        if (!count) continue;
+        unsigned long long mean = atomic_load(&hist->sum) / count, max = atomic_load(&hist->max);
+        unsigned long long p50 = histPercentile(hist, 0.5), p90 = histPercentile(hist, 0.9);
+        unsigned long long p99 = histPercentile(hist, 0.99);
+        if (json) {
+            fprintf(out, "%s\"%s\": {\"count\": %llu, \"mean\": %llu, \"p50\": %llu, \"p90\": %llu, \"p99\": %llu, "
+                         "\"max\": %llu}", first ? "" : ", ", names[op], count, mean, p50, p90, p99, max);
+        } else {
+            fprintf(out, "%-10s %10llu %12llu %12llu %12llu %12llu %12llu\n", names[op], count, mean, p50, p90, p99, max);
+        }
+        first = false;
+    }
+
+    unsigned long long lookups = atomic_load(&stats.nearbyLookups), compares = atomic_load(&stats.sortCompares);
+    unsigned long long draws = atomic_load(&stats.rngDraws), collisions = atomic_load(&stats.collisionChecks);
+    unsigned long long bytes = atomic_load(&stats.outputBytes), sent = atomic_load(&stats.sentBytes), commands = 0;
+    for (int op=statNAV; op<=statOther; op++) commands += atomic_load(&stats.op[op].count);
+    if (json) {
+        fprintf(out, "}, \"counters\": {\"nearbyLookups\": %llu, \"sortCompares\": %llu, \"rngDraws\": %llu, "
+                     "\"collisionChecks\": %llu, \"outputBytes\": %llu, \"sentBytes\": %llu}}\n",
+                lookups, compares, draws, collisions, bytes, sent);
+    } else {
+        fprintf(out, "NEARBY LOOKUPS %llu, SORT COMPARES %llu, RNG DRAWS %llu, COLLISION CHECKS %llu\n",
+                lookups, compares, draws, collisions);
+        fprintf(out, "OUTPUT BYTES %llu, %.0lf PER COMMAND (%llu SENT, %.0lf PER COMMAND)\n", bytes,
+                commands ? (double) bytes / commands : 0.0, sent, commands ? (double) sent / commands : 0.0);
+    }
+}
+
+// On exit & SIGUSR1. Set STATS_JSON in the environment for JSON
+void dumpStats() {
+    printStats(stderr, getenv("STATS_JSON") != NULL);
+}
+
+void *statsSignalThread(void *arg) {
+    (void) arg;
+    sigset_t usr1;
+    sigemptyset(&usr1);
+    sigaddset(&usr1, SIGUSR1);
+    int sig;
+    while (!sigwait(&usr1, &sig)) dumpStats();
+    return NULL;
+}
+
+// STATS prints text, STATS JSON prints JSON
+void cmdSTATS(char *input) {
+    for (int i=0; input[i]; i++) input[i] = (char) toupper(input[i]);
+    drainOutput();
+    printStats(stdout, strstr(input, "JSON") != NULL);
+    fflush(stdout);
+}
+#endif